@@ -1,7 +1,8 @@
 /*
   darshan_dxt_conflicts - reads the output of darshan-dxt-parser (which
   contains per-call data on each read or write) and outputs any conflicts
-  found.
+  found. Binary Darshan logs (.darshan files) with DXT data can also be
+  read directly; see darshan_log.hh.
 
   A conflict is when a pair of events A and B are found such that:
    - A and B access the same file (A.file_hash == B.file_hash)
@@ -48,38 +49,101 @@
 */
 
 #include "darshan_dxt_conflicts.hh"
+#include "darshan_log.hh"
+#include "event_cache.hh"
+#include "run_stats.hh"
+#include "thread_pool.hh"
+#if HAVE_MPI
+#include "mpi_analysis.hh"
+#endif
+#include <cmath>
+#include <condition_variable>
+#include <zlib.h>
 
 using namespace std;
 
 
-int Event::block_size = 1;
+int64_t Event::block_size = 1;
+int File::throughput_bins = 0;
+bool File::throughput_by_rank = false;
+bool File::track_changes = false;
+bool EventSequence::track_patterns = false;
+const AccessPattern AccessPattern::none;
+File::EventSink File::event_sink;
 
 string DARSHAN_HEADER = "# darshan log";
 string STRACE_HEADER = "# strace io log";
 
+// The records of the -format csv and jsonl output. Byte ranges are
+// offset..end-1, and times are in seconds.
+static const OutputRecord CONFLICT_RECORD =
+  {"conflict", {"file", "offset", "end", "read_ranks", "write_ranks",
+                "read_write_ranks"}};
+// -audit: an access involved in the conflict at conflict_offset
+static const OutputRecord ACCESS_RECORD =
+  {"access", {"file", "conflict_offset", "conflict_end", "rank", "api",
+              "mode", "offset", "end", "start_time", "end_time",
+              "overlap"}};
+// -summary
+static const OutputRecord PATTERN_RECORD =
+  {"pattern", {"file", "rank", "mode", "pattern", "stride", "accesses",
+               "bytes"}};
+static const OutputRecord RANGE_RECORD =
+  {"range", {"file", "rank", "mode", "offset", "end"}};
+// -report matrix or topk
+static const OutputRecord RANK_PAIR_RECORD =
+  {"rank_pair", {"file", "rank", "other_rank", "conflicts", "bytes",
+                 "raw_conflicts", "raw_bytes", "war_conflicts", "war_bytes",
+                 "waw_conflicts", "waw_bytes"}};
+// -blocksizes
+static const OutputRecord BLOCK_SIZE_RECORD =
+  {"block_size", {"file", "block_size", "conflict_blocks", "conflict_bytes",
+                  "rank_pairs"}};
 
-// map file_id (the hash of the file path) to File object.
-// Use the hash rather than the path, because the path is
-// often truncated in Darshan, leading to collisions that would probably
-// be avoided when using the 64-bit hash of the full path.
-// typedef unordered_map<std::string, unique_ptr<File>> FileTableType;
-using FileTableType = map<std::string, unique_ptr<File>>;
 
 void printHelp();
-
-// save_all_events: keep a copy of all events
-int readDarshanDxtInput(istream &in, FileTableType &file_table,
-                        LineReader &line_reader, bool output_per_rank_summary,
-                        bool save_all_events);
-bool parseEventLine(Event &e, const string &line);
-int readStraceInput(istream &in, FileTableType &file_table,
-                    LineReader &line_reader, const string &input_filename,
-                    bool save_all_events);
+void readInputFilesInParallel(const vector<string> &input_files,
+                              FileTableType &file_table,
+                              ReadProgress &progress, const Options &opt,
+                              SpillStore *spill_store);
+bool parseSectionHeader(string_view line, uint64_t &file_id,
+                        string_view &file_name);
+bool parseEventLine(Event &e, string_view line);
+int readStraceInput(LineReader &line_reader, FileTableType &file_table,
+                    const string &input_filename, bool save_all_events,
+                    SpillStore *spill_store);
 void processEventSequences(FileTableType &file_table,
-                           bool output_per_rank_summary);
-void scanForConflicts(File *f, bool output_conflict_details);
-void outputConflictDetails(File *f, int64_t offset, int64_t offset_end);
+                           bool output_per_rank_summary,
+                           SpillStore *spill_store, OutputWriter &out);
+void scanForConflicts(File *f, const Options &opt, OutputWriter &out,
+                      SpillStore *spill_store = nullptr,
+                      File::Stats *list_stats = nullptr);
+int64_t scanChangedRanges(FileTableType &file_table, const Options &opt,
+                          OutputWriter &out);
+int followStraceInput(const Options &opt);
+void outputConflictDetails(const EventIndex &index, string_view file_name,
+                           int64_t offset, int64_t offset_end,
+                           OutputWriter &out);
+void scanFilesInParallel(const vector<File*> &files, const Options &opt,
+                         SpillStore *spill_store, OutputWriter &out);
+bool printThroughput(const FileTableType &file_table, const Options &opt);
 void testEventSequence();
+void testParseEventLine();
+void testReadDarshanBinaryLog();
+void testEventCache();
+void testFileTable();
+void testEventIndex();
+void testSavedEvents();
+void testBlockConflictCounter();
+void testParentEventMerger();
+void testReadStraceInput();
+void testThroughputHistogram();
+void testAccessPattern();
+void testCompressedInput();
+void testFollow();
+void testRankPairMatrix();
+void testOutputWriter();
+int runBenchmarks(int argc, const char **argv);
 
 
 int main(int argc, const char **argv) {
@@ -89,63 +153,128 @@ int main(int argc, const char **argv) {
 #if TESTING
 #undef NDEBUG
   testEventSequence();
+  testParseEventLine();
+  testReadDarshanBinaryLog();
+  testEventCache();
+  testFileTable();
+  testEventIndex();
+  testSavedEvents();
+  testBlockConflictCounter();
+  testParentEventMerger();
+  testReadStraceInput();
+  testThroughputHistogram();
+  testAccessPattern();
+  testCompressedInput();
+  testFollow();
+  testRankPairMatrix();
+  testOutputWriter();
   return 0;
 #endif
 
+#if BENCHMARK
+  return runBenchmarks(argc, argv);
+#endif
+
   if (!opt.parseArgs(argc, argv))
     printHelp();
 
-  LineReader line_reader(5000);
+#if HAVE_MPI
+  return runMpiAnalysis(opt);
+#endif
+
+  if (opt.follow) return followStraceInput(opt);
+
+  // "-" means stdin, which can only be read once
+  vector<string> input_files;
   bool stdin_seen = false;
   for (string &filename : opt.input_files) {
-    istream *inf;
     if (filename == "-") {
       if (stdin_seen) continue;
-      inf = &cin;
       stdin_seen = true;
-    } else {
-      inf = new ifstream(filename);
-      if (!inf->good()) {
-        cerr << "Failed to open \"" << filename << "\"\n";
-        delete inf;
-        continue;
-      }
     }
-    
-    string header_line;
-    if (!line_reader.getline(*inf, header_line)) {
-      fprintf(stderr, "Empty file: %s\n", filename.c_str());
-      continue;
+    input_files.push_back(filename);
+  }
+
+  unique_ptr<SpillStore> spill_store;
+  if (opt.memory_limit > 0) {
+    spill_store.reset(new SpillStore(opt.memory_limit));
+    if (!spill_store->open()) return 1;
+  }
+
+  RunStats stats;
+  stats.startPhase("read");
+
+  ReadProgress progress(5000);
+  {
+    LineReader line_reader(progress);
+    for (string &filename : opt.load_cache_files) {
+      if (!readEventCacheFile(filename, line_reader, file_table,
+                              opt.saveAllEvents(), spill_store.get()))
+        return 1;
     }
+  }
 
-    if (!header_line.compare(0, DARSHAN_HEADER.length(), DARSHAN_HEADER)) {
-      readDarshanDxtInput(*inf, file_table, line_reader,
-                          opt.output_per_rank_summary,
-                          opt.output_conflict_details);
-    } else if (!header_line.compare(0, STRACE_HEADER.length(), STRACE_HEADER)) {
-      readStraceInput(*inf, file_table, line_reader, filename,
-                      opt.output_conflict_details);
-    } else {
-      fprintf(stderr, "Unrecognized file type %s, header=%s\n",
-              filename.c_str(), header_line.c_str());
+  if (opt.n_threads > 1 && input_files.size() > 1) {
+    readInputFilesInParallel(input_files, file_table, progress, opt,
+                             spill_store.get());
+  } else {
+    LineReader line_reader(progress);
+    for (string &filename : input_files) {
+      readInputFile(filename, line_reader, file_table, opt,
+                    spill_store.get());
     }
-    
-    if (inf != &cin) delete inf;
   }
-  line_reader.done();
+  progress.done();
+
+  if (opt.throughput_bins) {
+    stats.startPhase("throughput");
+    bool ok = printThroughput(file_table, opt);
+    stats.endPhase();
+    if (opt.output_stats) stats.printText(stderr, file_table);
+    if (!opt.stats_json_file.empty()
+        && !stats.writeJson(opt.stats_json_file, file_table))
+      return 1;
+    return ok ? 0 : 1;
+  }
+
+  if (!opt.save_cache_file.empty()) {
+    stats.startPhase("save cache");
+    if (!saveEventCache(opt.save_cache_file, file_table, spill_store.get()))
+      return 1;
+  }
 
-  processEventSequences(file_table, opt.output_per_rank_summary);
+  OutputWriter out(&cout, opt.format);
+  writeRecordHeaders(out);
+
+  // Each file is loaded just before it is scanned and released after, so
+  // only do a separate pass over the files for the summary. That doesn't
+  // lower the peak, which comes at the end of the read, when every file
+  // is held; only -memlimit bounds that.
+  if (opt.output_per_rank_summary) {
+    stats.startPhase("process");
+    processEventSequences(file_table, opt.output_per_rank_summary,
+                          spill_store.get(), out);
+  }
 
   // scan files in name order
-  vector<File*> files_by_name;
-  for (auto &file_it : file_table) {
-    files_by_name.push_back(file_it.second.get());
+  stats.startPhase("scan");
+  vector<File*> files_by_name = file_table.byName();
+
+  if (opt.n_threads > 1) {
+    scanFilesInParallel(files_by_name, opt, spill_store.get(), out);
+  } else {
+    for (File *f : files_by_name) {
+      scanFile(f, opt, spill_store.get(), out);
+    }
   }
-  sort(files_by_name.begin(), files_by_name.end(),
-       [](File *a, File *b) {return a->name < b->name;});
-  
-  for (File *f : files_by_name) {
-    scanForConflicts(f, opt.output_conflict_details);
+  out.flush();
+  stats.endPhase();
+
+  if (opt.output_stats) {
+    stats.printText(stderr, file_table);
+  }
+  if (!opt.stats_json_file.empty()) {
+    if (!stats.writeJson(opt.stats_json_file, file_table)) return 1;
   }
   
   return 0;
@@ -158,74 +287,287 @@ void printHelp() {
     "  Parse DxT output from darshan-parser and report any IO conflicts.\n"
     "  An IO conflict is when one process writes a byte of a file, and\n"
     "  another process reads or writes the same byte.\n"
+    "  <dxt_file> may also be a binary Darshan log (a .darshan file) with\n"
+    "  DXT tracing data, which is decoded directly.\n"
+    "  Inputs may be compressed with gzip, or with zstd if built with\n"
+    "  \"make HAVE_ZSTD=1\"; they are decompressed on a separate thread.\n"
     "  If <dxt_file> is \"-\", it will be read from STDIN.\n"
     "\n"
     "  options:\n"
     "  -summary : Before scanning for conflicts, output a per-file summary\n"
-    "     of the ranges of bytes read or written by each process.\n"
+    "     of the ranges of bytes read or written by each process, and how\n"
+    "     it read and wrote them: sequential, strided (with the stride),\n"
+    "     repeated, reverse, or random, with the number of requests of\n"
+    "     each power-of-two size.\n"
     "  -audit : For each reported conflict, output the full details of each IO event\n"
     "     leading to that conflict.\n"
+    "  -memlimit <MiB> : Keep the memory used to hold events while reading\n"
+    "     the input under roughly this many MiB, by spilling sorted runs of\n"
+    "     events to a temporary file in $TMPDIR (or /tmp). The scan merges\n"
+    "     each file's runs as it reads them, a chunk at a time; only the\n"
+    "     events kept for -audit and -report come back into memory whole.\n"
+    "     The output is the same as without a limit. Without -memlimit,\n"
+    "     every file's events stay in memory until the input has all been\n"
+    "     read, so the peak memory use grows with the whole trace, not the\n"
+    "     largest file. Freeing each file after it is scanned only lowers\n"
+    "     the memory used as the scan goes on.\n"
+    "  -save-cache <file> : After reading the input, write all of its events\n"
+    "     to <file>, a compact binary cache.\n"
+    "  -load-cache <file> : Read events from a cache written by -save-cache,\n"
+    "     without parsing the original trace. This may be repeated, and may be\n"
+    "     combined with other input files.\n"
+    "  -blocksize <bytes> : Scan for conflicts at the granularity of blocks\n"
+    "     of this size, as if every access read or wrote every block it\n"
+    "     touches. This finds false sharing of pages or file system stripes.\n"
+    "     A rank counts as a writer of a block if it wrote any byte of it\n"
+    "     that it didn't also read, so the conflicts found are the blocks\n"
+    "     counted in that row of -blocksizes.\n"
+    "  -report detail|matrix|topk : How each file's conflicts are reported.\n"
+    "     detail (the default) lists every conflicting range of bytes. matrix\n"
+    "     prints a table instead, with a row for each pair of ranks in\n"
+    "     conflict: the number of conflicts and bytes where one of the two\n"
+    "     wrote what the other accessed (other ranks don't matter), then\n"
+    "     how many of those conflicts and bytes were a read after write\n"
+    "     (RAW), write after read (WAR), or write after write (WAW), by the\n"
+    "     start times of the events. A conflict accessed more than once\n"
+    "     can have several types. Adjacent bytes where a pair conflicts in\n"
+    "     the same way are one conflict. topk prints only the rows of the\n"
+    "     pairs with the most bytes in conflict. Like -audit, this keeps a\n"
+    "     copy of every event.\n"
+    "  -topk <k> : With -report topk, the number of rank pairs (default 10).\n"
+    "  -format text|csv|jsonl : The format of the report on stdout. text (the\n"
+    "     default) is for reading. csv and jsonl have one record per line,\n"
+    "     the type of record first: conflict, access (-audit), pattern and\n"
+    "     range (-summary), rank_pair (-report matrix|topk), or block_size\n"
+    "     (-blocksizes). The CSV output starts with a header row for each\n"
+    "     type, like \"#conflict,file,offset,end,...\". Byte ranges are\n"
+    "     offset..end-1, and lists of ranks are separated by spaces in CSV.\n"
+    "  -blocksizes <max_bytes> : After each file's conflicts, print a table\n"
+    "     of the number of blocks in conflict and the number of conflicting\n"
+    "     pairs of ranks, for every power-of-two block size up to max_bytes\n"
+    "     (starting at the -blocksize, if given). These all come from the one\n"
+    "     scan. As in the conflicts listed, a rank counts as a writer only\n"
+    "     where it wrote bytes it didn't also read, so the 1-byte row\n"
+    "     counts exactly the conflicting bytes.\n"
+    "  -stats : When done, print to stderr the wall and CPU time of each\n"
+    "     phase (read, process, scan), peak memory use, and counts of the\n"
+    "     events read, event list sizes before and after minimizing,\n"
+    "     subranges swept, and conflicts found, for the largest files.\n"
+    "     Unless -summary is given, minimizing is done in the scan phase.\n"
+    "  -stats-json <file> : Write the same statistics as JSON to <file>\n"
+    "     (\"-\" for stdout), with counts for every file and rank.\n"
+    "  -throughput <bins> : Instead of scanning for conflicts, print the\n"
+    "     read and write bytes and operations, and their rates per second,\n"
+    "     in <bins> equal time intervals from the first access to the last,\n"
+    "     in the format of dxt_throughput.py for throughput_over_time.gnuplot.\n"
+    "     Accesses are counted as they are read and not otherwise kept, and\n"
+    "     each is counted at its start time, to within 1/32 of a bin.\n"
+    "  -throughput-by file|rank : With -throughput, print a table for each\n"
+    "     file or each rank, separated by two blank lines (a gnuplot index).\n"
+    "  -threads <n> : Use n threads to read the input files concurrently and\n"
+    "     to scan files for conflicts. The output is the same as with one thread.\n"
+    "  -follow : Read a single strace log as it is written, like \"tail -f\",\n"
+    "     and report conflicts as they appear. Whenever no more input is\n"
+    "     ready, or every second if it keeps coming, the bytes accessed since\n"
+    "     the last check are rescanned, and any conflicts in them are printed.\n"
+    "     A conflict is reported again if more accesses are made to its bytes.\n"
+    "     Runs until killed, or until the end of the input if it is a pipe.\n"
+    "     May be combined with -audit, -blocksize, and -format.\n"
     "\n";
   exit(1);
 }
 
 
-int readDarshanDxtInput(istream &in, FileTableType &file_table,
-                        LineReader &line_reader, bool output_per_rank_summary,
-                        bool save_all_events) {
-  string line;
+// Read one input file, detecting its format from the first line.
+// Returns false if the file could not be read.
+bool readInputFile(const string &filename, LineReader &line_reader,
+                   FileTableType &file_table, const Options &opt,
+                   SpillStore *spill_store) {
+  if (!line_reader.open(filename)) {
+    cerr << "Failed to open \"" << filename << "\"\n";
+    return false;
+  }
+
+  // binary Darshan logs are recognized by the magic number in the header
+  string_view header_bytes;
+  line_reader.peek(DARSHAN_LOG_HEADER_PEEK, header_bytes);
+  if (isDarshanBinaryLog(header_bytes)) {
+    string_view log_data;
+    line_reader.readAll(log_data);
+    bool ok = readDarshanBinaryLog(log_data, filename, file_table,
+                                   opt.saveAllEvents(), spill_store);
+    line_reader.close();
+    return ok;
+  }
+    
+  string_view header_line;
+  if (!line_reader.getline(header_line)) {
+    fprintf(stderr, "Empty file: %s\n", filename.c_str());
+    line_reader.close();
+    return false;
+  }
+
+  bool ok = true;
+  if (!header_line.compare(0, DARSHAN_HEADER.length(), DARSHAN_HEADER)) {
+    readDarshanDxtInput(line_reader, file_table,
+                        opt.output_per_rank_summary,
+                        opt.saveAllEvents(), spill_store);
+  } else if (!header_line.compare(0, STRACE_HEADER.length(), STRACE_HEADER)) {
+    readStraceInput(line_reader, file_table, filename,
+                    opt.saveAllEvents(), spill_store);
+  } else {
+    fprintf(stderr, "Unrecognized file type %s, header=%.*s\n",
+            filename.c_str(), (int)header_line.length(),
+            header_line.data());
+    ok = false;
+  }
+    
+  line_reader.close();
+  return ok;
+}
+
+
+/* Read each input into its own FileTableType on a pool of threads, then
+   merge them into file_table.
+
+   The merge is sharded by a hash of the file id: each shard collects the
+   files whose id falls in it from every input, in input order, so the
+   per-rank EventSequences are merged in the same order a serial read
+   would have added their events. The shards hold disjoint sets of ids,
+   so they can be merged concurrently and then moved into file_table.
+*/
+void readInputFilesInParallel(const vector<string> &input_files,
+                              FileTableType &file_table,
+                              ReadProgress &progress, const Options &opt,
+                              SpillStore *spill_store) {
+  vector<FileTableType> input_tables(input_files.size());
+
+  {
+    WorkStealingPool pool(opt.n_threads, input_files.size(), [&](size_t i) {
+        LineReader line_reader(progress);
+        readInputFile(input_files[i], line_reader, input_tables[i], opt,
+                      spill_store);
+      });
+  }
+
+  size_t n_shards = opt.n_threads * 4;
+  vector<FileTableType> shards(n_shards);
+
+  // the files of each shard, from every input in input order
+  vector<vector<unique_ptr<File>>> shard_files(n_shards);
+  for (FileTableType &input : input_tables) {
+    for (unique_ptr<File> &f : input) {
+      shard_files[FileTableType::shard(*f, n_shards)].push_back(std::move(f));
+    }
+    input.clear();
+  }
+
+  {
+    WorkStealingPool pool(opt.n_threads, n_shards, [&](size_t shard_no) {
+        for (unique_ptr<File> &f : shard_files[shard_no]) {
+          shards[shard_no].merge(std::move(f), spill_store);
+        }
+      });
+  }
+
+  for (FileTableType &shard : shards) {
+    file_table.merge(shard);
+  }
+}
+
+
+static bool startsWith(string_view s, string_view prefix) {
+  return s.substr(0, prefix.length()) == prefix;
+}
+
+
+/* Remove the first space-delimited token from s and store it in token.
+   Returns false if s contains nothing but spaces. */
+static bool nextToken(string_view &s, string_view &token) {
+  size_t start = s.find_first_not_of(' ');
+  if (start == string_view::npos) return false;
+  size_t end = s.find(' ', start);
+  if (end == string_view::npos) end = s.length();
+  token = s.substr(start, end - start);
+  s.remove_prefix(end);
+  return true;
+}
+
+
+// Parse all of token as a number. Returns false if any of it is left over.
+template<class T>
+static bool parseNumber(string_view token, T &value) {
+  const char *end = token.data() + token.length();
+  from_chars_result r = from_chars(token.data(), end, value);
+  return r.ec == errc() && r.ptr == end;
+}
+
+
+/* Returns true if line is in the form:
+     # DXT, rank: 0, hostname: XPS13
+*/
+static bool isRankLine(string_view line) {
+  static const string_view rank_prefix = "# DXT, rank: ";
+
+  if (!startsWith(line, rank_prefix)) return false;
+  line.remove_prefix(rank_prefix.length());
+  size_t len = 0;
+  while (len < line.length() && isdigit(line[len])) len++;
+  return len > 0 && len < line.length() && line[len] == ',';
+}
+
+
+int readDarshanDxtInput(LineReader &line_reader, FileTableType &file_table,
+                        bool output_per_rank_summary, bool save_all_events,
+                        SpillStore *spill_store) {
+  string_view line;
+  uint64_t file_id;
+  string_view file_name;
+
+  // If the log has an MPI-IO module, hold on to every event until its
+  // POSIX children can be merged into it. Otherwise add events directly.
+  static const string_view mpiio_region = "# DXT_MPIIO module:";
+  ParentEventMerger parent_merger(spill_store);
+  bool merge_parents = false;
 
-  regex section_header_re("^# DXT, file_id: ([0-9]+), file_name: (.*)$");
-  regex rank_line_re("^# DXT, rank: ([0-9]+),");
-  // regex io_event_re("^ *(X_MPIIO|X_POSIX) +[:digit:]+ +([:alpha:]+)");
-  smatch re_matches;
-  
   while (true) {
 
     // skip until the beginning of a section is found
     bool section_found = false;
     while (true) {
-      if (!line_reader.getline(in, line)) break;
-      if (regex_search(line, re_matches, section_header_re)) {
+      if (!line_reader.getline(line)) break;
+      if (parseSectionHeader(line, file_id, file_name)) {
         section_found = true;
         break;
       }
+      if (startsWith(line, mpiio_region)) merge_parents = true;
     }
     if (!section_found) break;
-    
-    assert(re_matches.size() == 3);
-    string file_id_str = re_matches[1];
-    string file_name = re_matches[2];
 
-    File *current_file;
-    FileTableType::iterator ftt_iter = file_table.find(file_id_str);
-    if (ftt_iter == file_table.end()) {
+    File *current_file = file_table.find(file_id);
+    if (!current_file) {
       // cout << "First instance of " << file_name << endl;
-      current_file = new File(file_id_str, file_name, save_all_events);
-      file_table[file_id_str] = unique_ptr<File>(current_file);
-    } else {
-      current_file = ftt_iter->second.get();
+      current_file = file_table.add(unique_ptr<File>
+        (new File(file_id, file_name, save_all_events, spill_store)));
     }
     
     // find the line with the rank id
     bool rank_found = false;
     while (true) {
-      if (!line_reader.getline(in, line)) break;
-      if (regex_search(line, re_matches, rank_line_re)) {
+      if (!line_reader.getline(line)) break;
+      if (isRankLine(line)) {
         rank_found = true;
         break;
       }
     }
     if (!rank_found) break;
 
-    // int rank = stoi(re_matches[1]);
-
     // cout << "reading rank " << rank << " " << file_name << endl;
 
     // read until a blank line at the end of the section or EOF
     bool is_eof = false;
     while (true) {
-      if (!line_reader.getline(in, line)) break;
+      if (!line_reader.getline(line)) break;
       if (line.length() == 0) {
         // cout << "End of section\n";
         break;
@@ -239,8 +581,13 @@ int readDarshanDxtInput(istream &in, FileTableType &file_table,
         // cout << event.str() << endl;
 
         // ignore events with an invalid offset
-        if (event.offset >= 0) {
+        if (event.offset < 0) continue;
+
+        if (merge_parents) {
+          parent_merger.addEvent(current_file, event);
+        } else {
           current_file->addEvent(event);
+          checkMemoryLimit(file_table, spill_store);
         }
 
       }
@@ -249,66 +596,96 @@ int readDarshanDxtInput(istream &in, FileTableType &file_table,
     if (is_eof) break;
   }
 
+  parent_merger.flush(file_table);
+
   // cout << "Reading done.\n";
 
   return 0;
 }
 
 
+/* Parse a line in the form:
+     # DXT, file_id: 8515199880342690440, file_name: /path/to/file
+   On success set file_id and file_name to the two values, which point
+   into line. */
+bool parseSectionHeader(string_view line, uint64_t &file_id,
+                        string_view &file_name) {
+  static const string_view id_prefix = "# DXT, file_id: ";
+  static const string_view name_prefix = ", file_name: ";
+
+  if (!startsWith(line, id_prefix)) return false;
+  line.remove_prefix(id_prefix.length());
+
+  size_t id_len = 0;
+  while (id_len < line.length() && isdigit(line[id_len])) id_len++;
+  if (id_len == 0 || !parseNumber(line.substr(0, id_len), file_id))
+    return false;
+  line.remove_prefix(id_len);
+
+  if (!startsWith(line, name_prefix)) return false;
+  file_name = line.substr(name_prefix.length());
+  return true;
+}
+
+
 /* 
    Parse a line in the form:
       X_POSIX   1  read    9    4718592     524288   1.2240  1.2261
-   Subexpressions:
+   Fields:
    1: io library (X_MPIIO or X_POSIX)
    2: rank
    3: direction (write or read)
-   4: offset
-   5: length
-   6: start time
-   7: end time
+   4: segment number (ignored)
+   5: offset
+   6: length
+   7: start time
+   8: end time
+   Anything after the end time is ignored.
 */
-static regex io_event_re("^ *(X_MPIIO|X_POSIX) +([0-9]+) +([a-z]+) +[0-9]+ +([-0-9]+) +([0-9]+) +([0-9.]+) +([0-9.]+)");
-
-bool parseEventLine(Event &event, const string &line) {
-  smatch re_matches;
-
-  if (!regex_search(line, re_matches, io_event_re)) return false;
-  if (re_matches.size() != 8) return false;
-
-  /*
-  cout << "  " << re_matches[1] << " action=" << re_matches[2]
-       << " offset=" << re_matches[3]
-       << " length=" << re_matches[4]
-       << " start=" << re_matches[5]
-       << " end=" << re_matches[6]
-       << endl;
-  */
-  
-  if (re_matches[1] == "X_POSIX") {
+bool parseEventLine(Event &event, string_view line) {
+  string_view api, rank, mode, segment, offset, length, start_time, end_time;
+
+  if (!(nextToken(line, api)
+        && nextToken(line, rank)
+        && nextToken(line, mode)
+        && nextToken(line, segment)
+        && nextToken(line, offset)
+        && nextToken(line, length)
+        && nextToken(line, start_time)
+        && nextToken(line, end_time)))
+    return false;
+
+  if (api == "X_POSIX") {
     event.api = Event::POSIX;
-  } else if (re_matches[1] == "X_MPIIO") {
+  } else if (api == "X_MPIIO") {
     event.api = Event::MPI;
   } else {
-    cerr << "invalid library: " << re_matches[1] << endl;
     return false;
   }
 
-  event.rank = stoi(re_matches[2]);
+  // these fields are unsigned in the file
+  if (rank[0] == '-' || length[0] == '-' || start_time[0] == '-'
+      || end_time[0] == '-')
+    return false;
+
+  int64_t segment_no;
+  if (!(parseNumber(rank, event.rank)
+        && parseNumber(segment, segment_no)
+        && parseNumber(offset, event.offset)
+        && parseNumber(length, event.length)
+        && parseNumber(start_time, event.start_time)
+        && parseNumber(end_time, event.end_time)))
+    return false;
 
-  if (re_matches[3] == "read") {
+  if (mode == "read") {
     event.mode = Event::READ;
-  } else if (re_matches[3] == "write") {
+  } else if (mode == "write") {
     event.mode = Event::WRITE;
   } else {
-    cerr << "invalid io access type: " << re_matches[3] << endl;
+    cerr << "invalid io access type: " << mode << endl;
     return false;
   }
 
-  event.offset = stoll(re_matches[4]);
-  event.length = stoll(re_matches[5]);
-  event.start_time = stod(re_matches[6]);
-  event.end_time = stod(re_matches[7]);
-
   return true;
 }
 
@@ -329,479 +706,2359 @@ void createEntryForStandardStream
   
   First line: "# strace io log"
   Remaining lines are tab-delimited.
-    <pid> open <fd> <file_name>
-    <pid> open <fd> <file_name> 1   # for files opened with O_APPEND
-    <pid> read|write <offset> <length> <ts> <fd>
+    <pid> open|openat <fd> <file_name>
+    <pid> open|openat <fd> <file_name> 1   # for files opened with O_APPEND
+    <pid> read|pread64|write <offset> <length> <ts> <fd>
+    <pid> close <fd>
+    <pid> dup|dup2|dup3 <old_fd> <new_fd>
+    <pid> lseek <fd> <offset>
 
   pid: process id
   fd: file descriptor (an integer)
   time: timestamp in seconds
+
+  A read or write offset of -1 means the current position of fd, which
+  is moved by lseek and by each read or write (but not pread64). The
+  offset of lseek is the position it returned.
 */
-int readStraceInput(istream &in, FileTableType &file_table,
-                    LineReader &line_reader, const string &input_filename,
-                    bool save_all_events) {
-  string line;
-  OpenFileMap open_files;
-  vector<string> fields;
-  long line_no = 1;  // already read header line
-  Event event;
+StraceReader::StraceReader(FileTableType &file_table_,
+                           const string &input_filename_,
+                           bool save_all_events_, SpillStore *spill_store_)
+  : file_table(file_table_), input_filename(input_filename_),
+    save_all_events(save_all_events_), spill_store(spill_store_),
+    line_no(1), last_key(0), last_open(nullptr) {
+}
+
 
-  while (line_reader.getline(in, line)) {
-    line_no++;
-    splitTabString(fields, line);
+void StraceReader::error(const char *message, string_view line) {
+  fprintf(stderr, "ERROR %s:%ld %s: \"%.*s\"\n", input_filename.c_str(),
+          line_no, message, (int)line.length(), line.data());
+}
 
-    int pid = std::stoi(fields[0]);
-    const string &fn_name = fields[1];
 
-    if (fn_name == "open" or fn_name == "openat") {
-      if (fields.size() < 4
-          || fields.size() > 5
-          || (fields.size() == 5 && fields[4] != "1")) {
-        fprintf(stderr, "ERROR %s:%ld unexpected 'open' file format: \"%s\"\n",
-                input_filename.c_str(), line_no, line.c_str());
-        continue;
-      }
-      int fd = std::stoi(fields[2]);
-      const string &filename = fields[3];
-
-      // create a new entry in file_table if this is a new filename
-      File *f;
-      FileTableType::iterator ftt_iter = file_table.find(filename);
-      if (ftt_iter == file_table.end()) {
-        // cout << "First instance of " << file_name << endl;
-        f = new File(filename, filename, save_all_events);
-        file_table[filename] = unique_ptr<File>(f);
-      } else {
-        f = ftt_iter->second.get();
-      }
+// A strace log has no file ids, so the id is a hash of the path.
+File *StraceReader::getFile(string_view name, bool save_all) {
+  return file_table.getPathFile(name, save_all, spill_store);
+}
+
+
+OpenFile *StraceReader::findOpenFile(int pid, int fd) {
+  uint64_t key = openFileKey(pid, fd);
+  auto it = open_files.find(key);
+  if (it != open_files.end()) return it->second.get();
+  if (fd < 0 || fd > 2) return nullptr;
+  const char *name = fd==0 ? "<STDIN>" : fd==1 ? "<STDOUT>" : "<STDERR>";
+  shared_ptr<OpenFile> &open_file = open_files[key];
+  open_file.reset(new OpenFile{getFile(name, false), 0});
+  return open_file.get();
+}
+
+
+void StraceReader::addLine(string_view line) {
+  static const int MAX_FIELDS = 6;
+  string_view fields[MAX_FIELDS];
+
+  line_no++;
+  int n_fields = splitTabFields(line, fields, MAX_FIELDS);
 
-      open_files[{pid,fd}] = f;
+  int pid;
+  if (n_fields < 2 || !parseNumber(fields[0], pid)) {
+    error("unrecognized input", line);
+    return;
+  }
+  string_view fn_name = fields[1];
+
+  if (fn_name == "read" || fn_name == "pread64" || fn_name == "write") {
+    if (n_fields != 6) {
+      error("expected 6 fields", line);
+      return;
+    }
+    int64_t offset, len;
+    double timestamp;
+    int fd;
+    if (!(parseNumber(fields[2], offset)
+          && parseNumber(fields[3], len)
+          && parseNumber(fields[4], timestamp)
+          && parseNumber(fields[5], fd))) {
+      error("invalid number", line);
+      return;
     }
+    Event::Mode mode = fn_name[0] == 'w' ? Event::WRITE : Event::READ;
 
-    else if (fn_name == "read" || fn_name == "pread64" || fn_name == "write") {
-      if (fields.size() != 6) {
-        fprintf(stderr, "ERROR %s:%ld expected 6 fields: \"%s\"\n",
-                input_filename.c_str(), line_no, line.c_str());
-        continue;
+    // map fd to File
+    uint64_t key = openFileKey(pid, fd);
+    OpenFile *open_file;
+    if (last_open && key == last_key) {
+      open_file = last_open;
+    } else {
+      open_file = findOpenFile(pid, fd);
+      if (!open_file) {
+        error("read of unknown file descriptor", line);
+        return;
       }
-      long offset = std::stol(fields[2]);
-      long len = std::stol(fields[3]);
-      double timestamp = std::stod(fields[4]);
-      int fd = std::stoi(fields[5]);
-      Event::Mode mode = fn_name[0] == 'w' ? Event::WRITE : Event::READ;
-
-      // ignore 0-byte accesses
-      if (len <= 0) continue;
-      
-      Event event(pid, mode, Event::POSIX, offset, len, timestamp, timestamp);
-
-      // map fd to File
-      File *f;
-      auto open_it = open_files.find({pid,fd});
-      if (open_it != open_files.end()) {
-        f = open_it->second;
-        assert(f);
-      } else {
+      last_key = key;
+      last_open = open_file;
+    }
 
-        // is it a standard io stream?
-        if (fd >= 0 && fd <= 2) {
-          const char *name =
-            fd==0 ? "<STDIN>" : fd==1 ? "<STDOUT>" : "<STDERR>";
-
-          auto file_table_entry = file_table.find(name);
-          if (file_table_entry == file_table.end()) {
-            f = new File(name, name, false);
-            file_table[name] = unique_ptr<File>(f);
-          } else {
-            f = file_table_entry->second.get();
-          }
-          open_files[{pid,fd}] = f;
-        }
+    if (offset == -1) offset = open_file->position;
+    if (fn_name[0] != 'p' && len > 0) open_file->position = offset + len;
 
-        else {
-          fprintf(stderr, "ERROR %s:%ld read of unknown file descriptor: "
-                  "\"%s\"\n",
-                  input_filename.c_str(), line_no, line.c_str());
-          continue;
-        }
-      }
-      
-      f->addEvent(event);
+    // ignore 0-byte accesses
+    if (len <= 0) return;
+
+    Event event(pid, mode, Event::POSIX, offset, len, timestamp, timestamp);
+    open_file->file->addEvent(event);
+    checkMemoryLimit(file_table, spill_store);
+  }
+
+  else if (fn_name == "open" or fn_name == "openat") {
+    if (n_fields < 4
+        || n_fields > 5
+        || (n_fields == 5 && fields[4] != "1")) {
+      error("unexpected 'open' file format", line);
+      return;
+    }
+    int fd;
+    if (!parseNumber(fields[2], fd)) {
+      error("invalid file descriptor", line);
+      return;
+    }
+
+    // this replaces anything left open on fd
+    open_files[openFileKey(pid, fd)].reset
+      (new OpenFile{getFile(fields[3], save_all_events), 0});
+    last_open = nullptr;
+  }
+
+  else if (fn_name == "close") {
+    int fd;
+    if (n_fields != 3 || !parseNumber(fields[2], fd)) {
+      error("unexpected 'close' format", line);
+      return;
+    }
+    // standard streams are in the table until they are closed
+    uint64_t key = openFileKey(pid, fd);
+    if (fd >= 0 && fd <= 2) {
+      open_files[key] = nullptr;
+    } else {
+      open_files.erase(key);
     }
+    last_open = nullptr;
+  }
 
-    else {
-      fprintf(stderr, "ERROR %s:%ld unrecognized input: \"%s\"\n",
-              input_filename.c_str(), line_no, line.c_str());
+  else if (fn_name == "dup" || fn_name == "dup2" || fn_name == "dup3") {
+    int old_fd, new_fd;
+    if (n_fields != 4
+        || !parseNumber(fields[2], old_fd)
+        || !parseNumber(fields[3], new_fd)) {
+      error("unexpected 'dup' format", line);
+      return;
     }
+    if (!findOpenFile(pid, old_fd)) {
+      error("dup of unknown file descriptor", line);
+      return;
+    }
+    open_files[openFileKey(pid, new_fd)]
+      = open_files[openFileKey(pid, old_fd)];
+    last_open = nullptr;
+  }
+
+  else if (fn_name == "lseek") {
+    int fd;
+    int64_t offset;
+    if (n_fields != 4
+        || !parseNumber(fields[2], fd)
+        || !parseNumber(fields[3], offset)) {
+      error("unexpected 'lseek' format", line);
+      return;
+    }
+    OpenFile *open_file = findOpenFile(pid, fd);
+    if (!open_file) {
+      error("lseek of unknown file descriptor", line);
+      return;
+    }
+    open_file->position = offset;
+  }
+
+  else {
+    error("unrecognized input", line);
+  }
+}
+
+
+int readStraceInput(LineReader &line_reader, FileTableType &file_table,
+                    const string &input_filename, bool save_all_events,
+                    SpillStore *spill_store) {
+  StraceReader reader(file_table, input_filename, save_all_events,
+                      spill_store);
+  string_view line;
+  while (line_reader.getline(line)) {
+    reader.addLine(line);
   }
-  
   return 0;
 }
 
 
 void processEventSequences(FileTableType &file_table,
-                           bool output_per_rank_summary) {
-  for (auto file_it = file_table.begin();
-       file_it != file_table.end(); file_it++) {
-    File *file = file_it->second.get();
-
-    if (output_per_rank_summary) {
-      cout << "File " << file->name << "\n";
+                           bool output_per_rank_summary,
+                           SpillStore *spill_store, OutputWriter &out) {
+  for (File *file : file_table.byName()) {
+    if (output_per_rank_summary && out.isText()) {
+      out << "File " << file->name << "\n";
     }
+
+    file->load(spill_store);
     
     for (auto rank_seq_it = file->rank_seq.begin();
          rank_seq_it != file->rank_seq.end(); rank_seq_it++) {
-      // cout << "  rank " << rank_seq_it->first << endl;
-      // EventSequence *seq = rank_seq_it->second.get();
       EventSequence &seq = rank_seq_it->second;
-      // seq->print();
-      // cout << "    minimizing\n";
-      seq.minimize();
-      seq.sortAllEvents();
 
       if (output_per_rank_summary &&
           file->name != "<STDOUT>" &&
           file->name != "<STDERR>") {
-        seq.print();
+        seq.print(out, file->name, rank_seq_it->first);
       }
-        
     }
+
+    if (spill_store) file->spill(*spill_store);
   }
 }  
 
 
-// split a line by tab characters
-void splitTabString(std::vector<std::string> &fields, const std::string &line) {
-  size_t pos = 0, field_no = 0;
-  while (true) {
-    size_t next_tab = line.find('\t', pos);
-    size_t len = (next_tab == string::npos)
-      ? line.length() - pos
-      : next_tab - pos;
-
-    // To avoid reallocations, replace the string rather than assign from
-    // a substring.
-    if (fields.size() < field_no+1)
-      fields.resize(field_no+1, "");
-    fields[field_no].replace(0, fields[field_no].length(), line, pos, len);
-
-    if (next_tab == string::npos) break;
-
-    pos = next_tab + 1;
-    field_no++;
+/* Print the -throughput tables to stdout, in the same columns as
+   dxt_throughput.py, and a summary to stderr. Every table covers the
+   same time range, so with -throughput-by the rows line up. */
+bool printThroughput(const FileTableType &file_table, const Options &opt) {
+  // (title, histogram) for each table, with an empty title for the total
+  vector<pair<string, ThroughputHistogram>> tables;
+  const ThroughputHistogram empty(ThroughputHistogram::BINS_PER_OUTPUT_BIN
+                                  * opt.throughput_bins);
+  ThroughputHistogram total(empty);
+  map<int,ThroughputHistogram> by_rank;
+
+  for (const File *f : file_table.byName()) {
+    ThroughputHistogram file_total(empty);
+    for (auto &it : f->throughput) {
+      total.merge(it.second);
+      file_total.merge(it.second);
+      if (opt.throughput_by == "rank") {
+        auto rank_it = by_rank.emplace(it.first, it.second);
+        if (!rank_it.second) rank_it.first->second.merge(it.second);
+      }
+    }
+    if (opt.throughput_by == "file" && !file_total.empty())
+      tables.push_back({"# file: " + string(f->name), file_total});
   }
-  fields.resize(field_no+1);
-}
-
+  for (auto &it : by_rank) {
+    tables.push_back({"# rank: " + to_string(it.first), it.second});
+  }
+  if (opt.throughput_by.empty()) tables.push_back({"", total});
 
-string intSetToString(set<int> &s) {
-  std::ostringstream buf;
-  bool first = true;
-  for (int i : s) {
-    if (first) {
-      first = false;
-    } else {
-      buf << ",";
+  if (total.empty()) {
+    fprintf(stderr, "No reads or writes.\n");
+    return true;
+  }
+  double start_time = total.startTime(), end_time = total.endTime();
+  if (end_time <= start_time) {
+    fprintf(stderr, "Invalid time range. start_time=%f end_time=%f\n",
+            start_time, end_time);
+    return false;
+  }
+  int n_bins = opt.throughput_bins;
+  double bin_size = (end_time - start_time) / n_bins;
+
+  ThroughputHistogram::Bin sum;
+  for (auto &bin : total.getBins(1, start_time, end_time)) sum += bin;
+  fprintf(stderr, "%" PRId64 " reads %" PRId64 " bytes, %" PRId64
+          " writes %" PRId64 " bytes\n", sum.read_count, sum.read_bytes,
+          sum.write_count, sum.write_bytes);
+  fprintf(stderr, "timestamps %f .. %f, %.3f sec elapsed.\n",
+          start_time, end_time, end_time - start_time);
+  fprintf(stderr, "bin size = %.8f sec\n", bin_size);
+
+  for (size_t t = 0; t < tables.size(); t++) {
+    if (t > 0) printf("\n\n");
+    if (!tables[t].first.empty()) printf("%s\n", tables[t].first.c_str());
+    printf("# bin_start_time\tread_bytes\tread_bytes_per_sec\tread_count"
+           "\treads_per_sec\twrite_bytes\twrite_bytes_per_sec\twrite_count"
+           "\twrites_per_sec\n");
+    vector<ThroughputHistogram::Bin> bins
+      = tables[t].second.getBins(n_bins, start_time, end_time);
+    for (int i = 0; i < n_bins; i++) {
+      const ThroughputHistogram::Bin &b = bins[i];
+      printf("%.6f\t%" PRId64 "\t%.0f\t%" PRId64 "\t%.2f\t%" PRId64
+             "\t%.0f\t%" PRId64 "\t%.2f\n",
+             bin_size * (i + 0.5), b.read_bytes, b.read_bytes / bin_size,
+             b.read_count, b.read_count / bin_size, b.write_bytes,
+             b.write_bytes / bin_size, b.write_count,
+             b.write_count / bin_size);
     }
-    buf << i;
   }
-  return buf.str();
-}
-  
 
-/* Scan through the events, looking for instances where multiple ranks
-   accessed the same bytes and at least one of the accesses was a write.
+  fflush(stdout);
+  return !ferror(stdout);
+}
 
-   The data is an EventSequence for each rank, which is an ordered list of
-   nonoverlapping ranges of reads or writes.  For example:
-     rank 0:  read 1..100, write 100-200, read 200-300
-     rank 1:  read 50..250
-     rank 2:  write 120-140, write 220-240, write 400-500
 
-   Loop through the bytes of the file, maintaining a set of all the ranks
-   that accessed the current range of the file. Use two priority queues to
-   track extents that are starting and ending:
-     outgoing min-heap, ordered by endOffset
-       root is the next extent to end
-     incoming min-heap, ordered by offset
-       root is the next extent to start
-*/
-void scanForConflicts(File *f, bool output_conflict_details) {
-  if (f->name == "<STDERR>" || f->name == "<STDOUT>") {
-    // cout << "  ignored\n";
+/* If the memory limit has been reached, spill every file in file_table.
+   That visits every rank of every file, even those with nothing left to
+   spill, so after a spill the next check is put off for a batch of
+   events, at least as many as there are files. Otherwise, while the
+   memory held elsewhere (by a ParentEventMerger, say) keeps the store
+   over its limit, every event would walk the whole table. */
+void checkMemoryLimit(FileTableType &file_table, SpillStore *spill_store) {
+  if (!spill_store) return;
+  if (file_table.spill_countdown > 0) {
+    file_table.spill_countdown--;
     return;
   }
+  if (!spill_store->overLimit()) return;
 
-  cout << f->name << "\n";
+  for (auto &f : file_table) {
+    f->spill(*spill_store);
+  }
+  file_table.spill_countdown = max<int64_t>(FileTableType::SPILL_BATCH_EVENTS,
+                                            file_table.size());
+}
 
-  RangeMerge range_merge(f->rank_seq);
 
-  bool conflicts_found = false;
-  while (range_merge.next()) {
-    const RangeMerge::ActiveSet &active = range_merge.getActiveSet();
-
-    set<int> read_ranks, write_ranks, rw_ranks;
-    for (auto &it : active) {
-      if (it.second==Event::WRITE) {
-        write_ranks.insert(it.first);
-      } else if (it.second==Event::READ) {
-        read_ranks.insert(it.first);
-      } else {
-        rw_ranks.insert(it.first);
-      }
+int64_t ParentEventMerger::mergeChildren(vector<Event> &events) {
+  // Sweep in order of start time. On a tie the MPI event comes first,
+  // since a parent can start at the same time as its first child.
+  vector<size_t> order(events.size());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  sort(order.begin(), order.end(), [&events](size_t a, size_t b) {
+    const Event &ea = events[a], &eb = events[b];
+    if (ea.start_time != eb.start_time) return ea.start_time < eb.start_time;
+    return ea.api == Event::MPI && eb.api != Event::MPI;
+  });
+
+  // MPI events that may still contain a later POSIX event
+  vector<size_t> parents;
+  vector<bool> merged(events.size(), false);
+  int64_t n_merged = 0;
+
+  for (size_t i : order) {
+    const Event &e = events[i];
+    if (e.api == Event::MPI) {
+      parents.push_back(i);
+      continue;
     }
 
-    if (active.size() > 1 && !write_ranks.empty()) {
-      conflicts_found = true;
-      cout << "  CONFLICT bytes " << range_merge.getRangeStart() << ".."
-           << (range_merge.getRangeEnd()-1) << ":";
-      if (!read_ranks.empty()) {
-        cout << " read ranks={" << intSetToString(read_ranks) << "}";
-      }
-
-      if (!write_ranks.empty()) {
-        cout << " write ranks={" << intSetToString(write_ranks) << "}";
-      }
-
-      if (!rw_ranks.empty()) {
-        cout << " read/write ranks={" << intSetToString(rw_ranks) << "}";
-      }
-      cout << "\n";
-
-      if (output_conflict_details) {
-        outputConflictDetails(f, range_merge.getRangeStart(),
-                              range_merge.getRangeEnd());
+    // parents that ended before this event started can't contain it or
+    // anything after it
+    parents.erase(remove_if(parents.begin(), parents.end(),
+                            [&](size_t p) {
+                              return events[p].end_time < e.start_time;
+                            }),
+                  parents.end());
+
+    for (size_t p : parents) {
+      if (e.isParentEvent(events[p])) {
+        events[p].merge(e);
+        merged[i] = true;
+        n_merged++;
+        break;
       }
     }
   }
 
-  if (!conflicts_found) {
-    cout << "  no conflicts\n";
+  if (n_merged > 0) {
+    size_t out = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+      if (!merged[i]) events[out++] = events[i];
+    }
+    events.resize(out);
   }
-  
+  return n_merged;
 }
 
 
-void outputConflictDetails(File *f, int64_t offset, int64_t offset_end) {
-  vector<Event> matches;
-  for (auto &v : f->rank_seq) {
-    // cout << "rank " << v.first << "\n";
-    EventSequence &es = v.second;
-    for (auto e = es.allBegin(); e != es.allEnd(); e++) {
-      if (e->offset < offset_end && e->endOffset() > offset) {
-        matches.push_back(*e);
+int64_t ParentEventMerger::flush(FileTableType &file_table) {
+  int64_t n_merged = 0;
+  vector<Event> events;
+  for (auto &it : pending) {
+    File *f = it.first.first;
+    Pending &p = it.second;
+    if (spill_store) {
+      spill_store->addMemory(-(int64_t) (p.events.size() * sizeof(Event)));
+      held_bytes -= p.events.size() * sizeof(Event);
+    }
+    if (p.spilled.empty()) {
+      events.swap(p.events);
+    } else {
+      events.clear();
+      for (auto &chunk : p.spilled) {
+        size_t n = events.size();
+        events.resize(n + chunk.second);
+        spill_store->read(chunk.first, &events[n],
+                          chunk.second * sizeof(Event));
       }
+      events.insert(events.end(), p.events.begin(), p.events.end());
+    }
+    // release the memory as we go
+    vector<Event>().swap(p.events);
+
+    n_merged += mergeChildren(events);
+    for (const Event &e : events) {
+      f->addEvent(e);
+      checkMemoryLimit(file_table, spill_store);
     }
+    vector<Event>().swap(events);
   }
+  pending.clear();
+  assert(held_bytes == 0);
+  return n_merged;
+}
 
-  sort(matches.begin(), matches.end(), events_order_by_start_time);
 
-  for (auto &e : matches) {
-    int64_t overlap_len = min(offset_end, e.endOffset())
-      - max(offset, e.offset);
-    cout << "  time " << fixed << setprecision(4) << e.start_time
-         << "-" << e.end_time
-         << " rank " << e.rank
-         << " " << (e.api == Event::POSIX ? "POSIX " : "MPI-IO")
-         << " " << (e.mode == Event::READ ? "read " : "write")
-         << " bytes "
-         << e.offset << ".." << (e.endOffset()-1)
-         << " (conflict overlap " << overlap_len << " bytes)\n";
+void ParentEventMerger::spill() {
+  static_assert(std::is_trivially_copyable<Event>::value,
+                "events are spilled as bytes");
+  for (auto &it : pending) {
+    Pending &p = it.second;
+    if (p.events.empty()) continue;
+    int64_t bytes = p.events.size() * sizeof(Event);
+    p.spilled.push_back({spill_store->write(p.events.data(), bytes),
+                         p.events.size()});
+    vector<Event>().swap(p.events);
+    spill_store->addMemory(-bytes);
+    held_bytes -= bytes;
   }
 }
-    
 
-bool Options::parseArgs(int argc, const char **argv) {
-  if (argc <= 1) return false;
 
-  int argno = 1;
-  while (argno < argc) {
-    const char *arg = argv[argno];
-    if (!strcmp(arg, "-summary")) {
-      output_per_rank_summary = true;
-      argno++;
-    } else if (!strcmp(arg, "-audit")) {
-      output_conflict_details = true;
-      argno++;
-    } else if (arg[0] == '-' && strlen(arg) > 1) {
-      return false;
-    } else {
-      break;
+int splitTabFields(string_view line, string_view *fields, int max_fields) {
+  const char *p = line.data(), *end = p + line.length();
+  int n = 0;
+  while (true) {
+    const char *tab = (const char*) memchr(p, '\t', end - p);
+    if (n == max_fields) return max_fields + 1;
+    if (!tab) {
+      fields[n++] = string_view(p, end - p);
+      return n;
     }
+    fields[n++] = string_view(p, tab - p);
+    p = tab + 1;
   }
-
-  // add remaining args to input_files
-  input_files.insert(input_files.begin(), argv+argno, argv+argc);
-  
-  return true;
 }
 
 
-void EventSequence::addEvent(const Event &full_event) {
-  // assert(validate());
+static double getWallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
 
-  if (save_all_events) {
-    all_events.push_back(full_event);
-  }
 
-  SeqEvent e(full_event);
+ReadProgress::ReadProgress(long report_freq_)
+  : lines_read(0), next_report(report_freq_), bytes_read(0),
+    report_freq(report_freq_) {
+  do_report = (isatty(STDERR_FILENO) == 1);
+  start_time = getWallTime();
+}
 
-  EventList::iterator overlap_it = firstOverlapping(e);
-  if (overlap_it == elist.end()) {
-    insert(e);
-    // assert(validate());
-    return;
-  }
 
-  if (overlap_it->second.offset < e.offset) {
-    assert(e.offset < overlap_it->second.endOffset());
-      
-    /* e starts during overlap. Split off the nonoverlapping part of overlap
+void ReadProgress::add(long lines, int64_t bytes) {
+  bytes_read += bytes;
+  long total = (lines_read += lines);
+  if (do_report && total >= next_report) {
+    lock_guard<mutex> guard(print_lock);
+    if (total >= next_report) {
+      print("");
+      next_report = total + report_freq;
+    }
+  }
+}
 
-       overlap  |---------|
-       e1          |------|
-       e2          |---------|
-       e3          |---|
 
-       overlap  |--|
-       overlap2    |------|
-    */
+void ReadProgress::print(const char *end) {
+  double elapsed = getWallTime() - start_time;
+  double mb = bytes_read / (1024.0 * 1024.0);
+  fprintf(stderr, "\r%ld lines read, %.1f MiB, %.1f MiB/s%s",
+          lines_read.load(), mb, elapsed > 0 ? mb / elapsed : 0.0, end);
+  fflush(stderr);
+}
 
-    SeqEvent overlap_remainder = overlap_it->second.split(e.offset);
 
-    overlap_it = insert(overlap_remainder);
+void ReadProgress::done() {
+  if (do_report) {
+    print("\n");
+  }
+}
+
+
+LineReader::LineReader(ReadProgress &progress_)
+  : progress(progress_), uncounted_lines(0), uncounted_bytes(0),
+    fd(-1), map_base(nullptr), map_len(0),
+    buf_pos(0), buf_end(0), at_eof(false), follow(false), growing(false),
+    map_pos(nullptr), map_end(nullptr), map_released(0) {
+}
+
+
+bool LineReader::open(const string &filename, bool follow_) {
+  close();
+
+  if (filename == "-") {
+    fd = STDIN_FILENO;
+  } else {
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+  }
+
+  // Map regular files, unless they are still being written. If stdin is
+  // redirected from a file, only map it if nothing has been read from it
+  // yet.
+  struct stat statbuf;
+  bool is_regular = fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode);
+  follow = follow_;
+  growing = follow && is_regular;
+  if (!follow
+      && is_regular
+      && statbuf.st_size > 0
+      && lseek(fd, 0, SEEK_CUR) == 0) {
+    void *p = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      map_base = (char*) p;
+      map_len = statbuf.st_size;
+      map_pos = map_base;
+      map_end = map_base + map_len;
+      map_released = 0;
+      madvise(map_base, map_len, MADV_SEQUENTIAL);
+
+      string_view magic(map_base, min(map_len, Decompressor::MAGIC_SIZE));
+      Decompressor::Format format = Decompressor::detect(magic);
+      if (format == Decompressor::NONE) return true;
+
+      // read compressed files with read() instead
+      munmap(map_base, map_len);
+      map_base = nullptr;
+      map_pos = map_end = nullptr;
+      map_len = 0;
+      lseek(fd, 0, SEEK_SET);
+      return startDecompressor(format, filename);
+    }
+  }
+
+  buf.resize(BLOCK_SIZE);
+  buf_pos = buf_end = 0;
+  at_eof = false;
+
+  // a pipe can't be rewound, so check the first bytes read
+  while (buf_end < Decompressor::MAGIC_SIZE && fillBuffer()) {}
+  Decompressor::Format format = Decompressor::detect
+    (string_view(buf.data(), buf_end));
+  if (format == Decompressor::NONE) return true;
+  if (follow) {
+    fprintf(stderr, "%s is %s-compressed, and can't be followed\n",
+            filename.c_str(), Decompressor::formatName(format));
+    close();
+    return false;
+  }
+  return startDecompressor(format, filename);
+}
+
+
+bool LineReader::startDecompressor(Decompressor::Format format,
+                                   const string &filename) {
+  if (!Decompressor::supported(format)) {
+    fprintf(stderr, "%s is %s-compressed, which this build doesn't "
+            "support (build with \"make HAVE_ZSTD=1\")\n", filename.c_str(),
+            Decompressor::formatName(format));
+    close();
+    return false;
+  }
+
+  // anything already read is the start of the compressed data
+  string_view prefix(buf.data() + buf_pos, buf_end - buf_pos);
+  decompressor.reset(new Decompressor(format, fd, prefix, filename));
+  buf.resize(BLOCK_SIZE);
+  buf_pos = buf_end = 0;
+  at_eof = false;
+  return true;
+}
+
+
+void LineReader::close() {
+  flushCount();
+  // stop the decompression thread before closing the file it reads
+  decompressor.reset();
+  if (map_base) {
+    munmap(map_base, map_len);
+    map_base = nullptr;
+    map_len = 0;
+    map_pos = map_end = nullptr;
+  }
+  if (fd >= 0 && fd != STDIN_FILENO) {
+    ::close(fd);
+  }
+  fd = -1;
+  buf_pos = buf_end = 0;
+}
+
+
+bool LineReader::fillBuffer() {
+  if (at_eof) return false;
+
+  // move the partial line to the front of the buffer
+  size_t remaining = buf_end - buf_pos;
+  if (buf_pos > 0) {
+    memmove(buf.data(), buf.data() + buf_pos, remaining);
+    buf_pos = 0;
+    buf_end = remaining;
   }
 
-  EventList::iterator next_it = overlap_it;
+  // the partial line fills the buffer; make room for more
+  if (buf_end == buf.size()) {
+    buf.resize(buf.size() * 2);
+  }
+
+  ssize_t n;
+  if (decompressor) {
+    // errors are reported by the decompressor
+    n = decompressor->read(buf.data() + buf_end, buf.size() - buf_end);
+  } else {
+    // when following a pipe, don't wait for more to be written
+    if (follow && !growing) {
+      struct pollfd poll_fd = {fd, POLLIN, 0};
+      if (poll(&poll_fd, 1, 0) == 0) return false;
+    }
+    do {
+      n = read(fd, buf.data() + buf_end, buf.size() - buf_end);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) perror("read");
+  }
+
+  if (n <= 0) {
+    // a followed file may have more written to it later
+    if (!(n == 0 && growing)) at_eof = true;
+    return false;
+  }
+
+  buf_end += n;
+  return true;
+}
+
+
+bool LineReader::getline(string_view &line) {
+  if (map_base) {
+    if (map_pos >= map_end) return false;
+
+    size_t consumed = map_pos - map_base;
+    if (consumed - map_released >= RELEASE_SIZE) {
+      size_t page_size = sysconf(_SC_PAGESIZE);
+      size_t release_end = consumed - consumed % page_size;
+      madvise(map_base + map_released, release_end - map_released,
+              MADV_DONTNEED);
+      map_released = release_end;
+    }
+
+    const char *nl = (const char*) memchr(map_pos, '\n', map_end - map_pos);
+    const char *line_end = nl ? nl : map_end;
+    line = string_view(map_pos, line_end - map_pos);
+    map_pos = nl ? nl + 1 : map_end;
+    countLine(map_pos - line.data());
+    return true;
+  }
+
+  if (fd < 0) return false;
 
-  // e is a new event we're adding to elist
-  // next_it points to the first event in elist that starts at the same offset
-  // as e or later.
+  // number of bytes after buf_pos already known not to contain a newline
+  size_t searched = 0;
   while (true) {
+    char *start = buf.data() + buf_pos;
+    char *nl = (char*) memchr(start + searched, '\n',
+                              buf_end - buf_pos - searched);
+    if (nl) {
+      line = string_view(start, nl - start);
+      buf_pos += line.length() + 1;
+      countLine(line.length() + 1);
+      return true;
+    }
 
-    // if e is past the end of existing elements just insert it
-    if (next_it == elist.end()) {
-      insert(e);
-      break;
+    searched = buf_end - buf_pos;
+    if (!fillBuffer()) break;
+  }
+
+  // EOF; return the last line if it had no trailing newline, unless the
+  // rest of the line may not have been written yet
+  if (buf_pos == buf_end || (follow && !at_eof)) return false;
+  line = string_view(buf.data() + buf_pos, buf_end - buf_pos);
+  buf_pos = buf_end;
+  countLine(line.length());
+  return true;
+}
+
+
+void LineReader::peek(size_t len, string_view &data) {
+  if (map_base) {
+    size_t avail = map_end - map_pos;
+    data = string_view(map_pos, min(len, avail));
+    return;
+  }
+
+  while (buf_end - buf_pos < len && fillBuffer()) {}
+  data = string_view(buf.data() + buf_pos, min(len, buf_end - buf_pos));
+}
+
+
+void LineReader::readAll(string_view &data) {
+  if (map_base) {
+    data = string_view(map_pos, map_end - map_pos);
+    map_pos = map_end;
+  } else {
+    while (fillBuffer()) {}
+    data = string_view(buf.data() + buf_pos, buf_end - buf_pos);
+    buf_pos = buf_end;
+  }
+  uncounted_bytes += data.length();
+  flushCount();
+}
+
+
+bool LineReader::setRange(size_t start, size_t end) {
+  if (!map_base || start > end || end > map_len) return false;
+  map_pos = map_base + start;
+  map_end = map_base + end;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  map_released = start - start % page_size;
+  return true;
+}
+
+
+// Write the header rows of the CSV output. Every row has its type first,
+// so all of them are written whether or not any such rows follow.
+void writeRecordHeaders(OutputWriter &out) {
+  for (const OutputRecord *record
+         : {&CONFLICT_RECORD, &ACCESS_RECORD, &PATTERN_RECORD, &RANGE_RECORD,
+            &RANK_PAIR_RECORD, &BLOCK_SIZE_RECORD}) {
+    out.writeHeader(*record);
+  }
+}
+
+
+// comma-separated list of the ranks in active with the given mode
+static void writeRanksWithMode(const RangeMerge::ActiveSet &active,
+                               Event::Mode mode, OutputWriter &out) {
+  bool first = true;
+  for (auto &it : active) {
+    if (it.second != mode) continue;
+    if (first) {
+      first = false;
+    } else {
+      out << ',';
     }
-    
-    SeqEvent &next = next_it->second;
-    
-    // if there's no overlap we're done
-    if (next.startsAfter(e)) {
-      insert(e);
-      break;
+    out << it.first;
+  }
+}
+
+
+// print a conflict in bytes start..end-1 of file_name between the ranks
+// in active
+static void printConflict(string_view file_name, int64_t start,
+                          int64_t end, const RangeMerge::ActiveSet &active,
+                          OutputWriter &out) {
+  if (!out.isText()) {
+    out.beginRecord(CONFLICT_RECORD);
+    out.field(file_name);
+    out.field(start);
+    out.field(end);
+    for (Event::Mode mode : {Event::READ, Event::WRITE, Event::READ_WRITE}) {
+      out.beginList();
+      for (auto &it : active) {
+        if (it.second == mode) out.listItem(it.first);
+      }
+      out.endList();
     }
-    
-    assert(next.offset >= e.offset);
-    if (!(next.offset < e.endOffset())) {
-      cout << "Error !(next.offset < e.endOffset()), next=" <<
-        next.str() << ", e=" << e.str() << endl;
+    out.endRecord();
+    return;
+  }
+
+  bool has_mode[3] = {false, false, false};
+  for (auto &it : active) has_mode[it.second] = true;
+
+  out << "  CONFLICT bytes " << start << ".." << (end-1) << ":";
+  if (has_mode[Event::READ]) {
+    out << " read ranks={";
+    writeRanksWithMode(active, Event::READ, out);
+    out << "}";
+  }
+
+  if (has_mode[Event::WRITE]) {
+    out << " write ranks={";
+    writeRanksWithMode(active, Event::WRITE, out);
+    out << "}";
+  }
+
+  if (has_mode[Event::READ_WRITE]) {
+    out << " read/write ranks={";
+    writeRanksWithMode(active, Event::READ_WRITE, out);
+    out << "}";
+  }
+  out << "\n";
+}
+
+
+/* Scan through the events, looking for instances where multiple ranks
+   accessed the same bytes and at least one of the accesses was a write.
+
+   The data is an EventSequence for each rank, which is an ordered list of
+   nonoverlapping ranges of reads or writes.  For example:
+     rank 0:  read 1..100, write 100-200, read 200-300
+     rank 1:  read 50..250
+     rank 2:  write 120-140, write 220-240, write 400-500
+
+   Loop through the bytes of the file, maintaining a set of all the ranks
+   that accessed the current range of the file. Use two priority queues to
+   track extents that are starting and ending:
+     outgoing min-heap, ordered by endOffset
+       root is the next extent to end
+     incoming min-heap, ordered by offset
+       root is the next extent to start
+
+   Ranks with spilled runs are read from spill_store (see
+   File::loadForScan()).
+*/
+void scanForConflicts(File *f, const Options &opt, OutputWriter &out,
+                      SpillStore *spill_store, File::Stats *list_stats) {
+  if (f->name == "<STDERR>" || f->name == "<STDOUT>") {
+    // cout << "  ignored\n";
+    return;
+  }
+
+  if (out.isText()) out << f->name << "\n";
+
+  RangeMerge range_merge(f->rank_seq, spill_store, list_stats);
+
+  // only built if a conflict is found
+  unique_ptr<EventIndex> event_index;
+
+  unique_ptr<BlockConflictCounter> block_counter;
+  if (opt.max_report_block_size > 0) {
+    block_counter.reset(new BlockConflictCounter
+                        (opt.block_size, opt.max_report_block_size));
+  }
+
+  // with -report matrix or topk, conflicts are only counted
+  unique_ptr<RankPairMatrix> matrix;
+  if (opt.report != "detail") matrix.reset(new RankPairMatrix(f->rank_seq));
+
+  bool conflicts_found = false;
+  while (range_merge.next()) {
+    f->stats.subranges++;
+    if (block_counter) {
+      block_counter->add(range_merge.getRangeStart(),
+                         range_merge.getRangeEnd(),
+                         range_merge.getActiveSet());
+    }
+    if (range_merge.isConflict()) {
+      conflicts_found = true;
+      if (matrix) {
+        matrix->add(range_merge.getRangeStart(), range_merge.getRangeEnd(),
+                    range_merge.getActiveSet());
+        continue;
+      }
+      f->stats.conflicts++;
+      printConflict(f->name, range_merge.getRangeStart(),
+                    range_merge.getRangeEnd(), range_merge.getActiveSet(),
+                    out);
+
+      if (opt.output_conflict_details) {
+        if (!event_index) event_index.reset(new EventIndex(f->rank_seq));
+        outputConflictDetails(*event_index, f->name,
+                              range_merge.getRangeStart(),
+                              range_merge.getRangeEnd(), out);
+      }
+    }
+  }
+
+  if (!conflicts_found) {
+    if (out.isText()) out << "  no conflicts\n";
+  } else if (matrix) {
+    f->stats.conflicts += matrix->conflicts();
+    matrix->print(out, f->name, opt.report == "topk" ? opt.top_k : 0);
+  }
+
+  if (block_counter) block_counter->print(out, f->name);
+  
+}
+
+
+/* Scan one file, minimizing its events. Spilled events stay in the
+   SpillStore, and the scan merges them as it goes, so only the saved
+   events (for -audit and -report) come back into memory. Nothing looks at
+   a file's events after it is scanned, so they are freed right away, to
+   make room for the next files. */
+void scanFile(File *f, const Options &opt, SpillStore *spill_store,
+              OutputWriter &out) {
+  File::Stats *list_stats = f->loadForScan(spill_store);
+  scanForConflicts(f, opt, out, spill_store, list_stats);
+  f->release(spill_store);
+}
+
+
+/* For -follow: scan just the bytes of each file that have changed since
+   the last call, and print any conflicts in them, under the file's name.
+   Files with no new conflicts are not mentioned. Returns the number of
+   conflicts found.
+
+   The sequences aren't minimized as they grow, so adjacent conflicts
+   with the same ranks are printed as one, as a scan of the minimized
+   sequences would find them. */
+int64_t scanChangedRanges(FileTableType &file_table, const Options &opt,
+                          OutputWriter &out) {
+  int64_t n_conflicts = 0;
+
+  vector<File*> changed_files;
+  for (auto &f : file_table) {
+    if (!f->changed.empty()) changed_files.push_back(f.get());
+  }
+  sort(changed_files.begin(), changed_files.end(),
+       [](const File *a, const File *b) {return a->name < b->name;});
+
+  for (File *f : changed_files) {
+    if (f->name == "<STDERR>" || f->name == "<STDOUT>") {
+      f->changed.clear();
+      continue;
+    }
+
+    unique_ptr<EventIndex> event_index;
+    bool name_printed = false;
+
+    // the conflict not printed yet
+    int64_t start = 0, end = 0;
+    RangeMerge::ActiveSet ranks;
+
+    auto report = [&]() {
+      if (start == end) return;
+      if (!name_printed && out.isText()) {
+        out << f->name << "\n";
+        name_printed = true;
+      }
+      n_conflicts++;
+      f->stats.conflicts++;
+      printConflict(f->name, start, end, ranks, out);
+
+      if (opt.output_conflict_details) {
+        if (!event_index) event_index.reset(new EventIndex(f->rank_seq));
+        outputConflictDetails(*event_index, f->name, start, end, out);
+      }
+      start = end = 0;
+    };
+
+    for (auto &interval : f->changed) {
+      RangeMerge range_merge(f->rank_seq, interval.first, interval.second);
+      while (range_merge.next()) {
+        f->stats.subranges++;
+        if (!range_merge.isConflict()) continue;
+
+        if (range_merge.getRangeStart() == end
+            && range_merge.getActiveSet() == ranks) {
+          end = range_merge.getRangeEnd();
+          continue;
+        }
+        report();
+        start = range_merge.getRangeStart();
+        end = range_merge.getRangeEnd();
+        ranks = range_merge.getActiveSet();
+      }
+      report();
+    }
+
+    f->changed.clear();
+  }
+
+  return n_conflicts;
+}
+
+
+/* The -follow option. Reads the strace log opt.input_files[0] as it
+   grows, and after each batch of new lines, rescans the bytes that the
+   batch accessed. A batch ends when no more input is ready, or after
+   FOLLOW_SCAN_INTERVAL seconds if it keeps coming, so conflicts are
+   reported within a second or two of being written to the log. */
+int followStraceInput(const Options &opt) {
+  static const double FOLLOW_SCAN_INTERVAL = 1.0;
+  static const useconds_t FOLLOW_POLL_USEC = 200000;
+  const string &filename = opt.input_files[0];
+
+  // no progress reports; they would be mixed in with the conflicts
+  ReadProgress progress(LONG_MAX);
+  LineReader line_reader(progress);
+  if (!line_reader.open(filename, true)) {
+    cerr << "Failed to open \"" << filename << "\"\n";
+    return 1;
+  }
+
+  FileTableType file_table;
+  unique_ptr<StraceReader> reader;  // created once the header is read
+  string_view line;
+  OutputWriter out(&cout, opt.format);
+  writeRecordHeaders(out);
+
+  while (true) {
+    bool got_input = false;
+    double batch_start = getWallTime();
+    long batch_lines = 0;
+
+    while (line_reader.getline(line)) {
+      got_input = true;
+      if (!reader) {
+        if (line.compare(0, STRACE_HEADER.length(), STRACE_HEADER)) {
+          fprintf(stderr, "%s is not a strace log, header=%.*s\n",
+                  filename.c_str(), (int)line.length(), line.data());
+          return 1;
+        }
+        reader.reset(new StraceReader(file_table, filename,
+                                      opt.saveAllEvents(), nullptr));
+        continue;
+      }
+      reader->addLine(line);
+
+      // checking the time on every line would be slow
+      if (++batch_lines % 4096 == 0
+          && getWallTime() - batch_start >= FOLLOW_SCAN_INTERVAL)
+        break;
+    }
+
+    scanChangedRanges(file_table, opt, out);
+    out.flush();
+
+    if (line_reader.eof()) break;
+    if (!got_input) usleep(FOLLOW_POLL_USEC);
+  }
+
+  return 0;
+}
+
+
+EventIndex::EventIndex(const File::RankSeqMap &rank_sequences) {
+  size_t n = 0;
+  for (auto &it : rank_sequences) n += it.second.savedEvents().size();
+  nodes.reserve(n);
+
+  // sort by offset, kept in max_end until the tree is built
+  for (auto &it : rank_sequences) {
+    const SavedEvents &events = it.second.savedEvents();
+    uint32_t seq_no = sequences.size();
+    sequences.push_back(&events);
+    assert(events.size() <= UINT32_MAX);
+    for (uint32_t i = 0; i < events.size(); i++) {
+      nodes.push_back({events.offset(i), seq_no, i});
+    }
+  }
+
+  sort(nodes.begin(), nodes.end(),
+       [](const Node &a, const Node &b) {return a.max_end < b.max_end;});
+  buildTree();
+}
+
+
+/* Fill in max_end for every node. Leaves are at even indices, and the
+   node at level k has its lowest k bits set, with children at
+   index +/- 2^(k-1). The rightmost subtrees may be incomplete; "last"
+   carries the max_end of the rightmost node at the previous level, to
+   stand in for children past the end of the array.
+   (This is the layout used by Heng Li's cgranges library.) */
+void EventIndex::buildTree() {
+  size_t n = nodes.size();
+  max_level = 0;
+  if (n == 0) return;
+
+  size_t last_i = 0;
+  int64_t last = 0;
+  for (size_t i = 0; i < n; i += 2) {
+    last_i = i;
+    last = nodes[i].max_end = nodeEnd(nodes[i]);
+  }
+
+  int k;
+  for (k = 1; ((size_t)1 << k) <= n; k++) {
+    size_t x = (size_t)1 << (k-1);
+    size_t step = x << 2;
+    for (size_t i = (x << 1) - 1; i < n; i += step) {
+      int64_t left = nodes[i - x].max_end;
+      int64_t right = (i + x < n) ? nodes[i + x].max_end : last;
+      nodes[i].max_end = max(nodeEnd(nodes[i]), max(left, right));
+    }
+    last_i = ((last_i >> k) & 1) ? last_i - x : last_i + x;
+    if (last_i < n && nodes[last_i].max_end > last)
+      last = nodes[last_i].max_end;
+  }
+  max_level = k - 1;
+}
+
+
+void EventIndex::findOverlapping(int64_t offset, int64_t offset_end,
+                                 vector<Event> &matches) const {
+  matches.clear();
+  size_t n = nodes.size();
+  if (n == 0) return;
+
+  vector<const Node*> found;
+
+  // Walk the tree top-down. done_left is set when a node is revisited
+  // after its left subtree has been pushed.
+  struct StackEntry {
+    size_t x;
+    int k;
+    bool done_left;
+  };
+  StackEntry stack[64];
+  int top = 0;
+  stack[top++] = {((size_t)1 << max_level) - 1, max_level, false};
+
+  while (top > 0) {
+    StackEntry z = stack[--top];
+    if (z.k <= 3) {
+      // small subtree; check every node in it
+      size_t i0 = z.x >> z.k << z.k;
+      size_t i1 = min(n, i0 + ((size_t)1 << (z.k+1)) - 1);
+      for (size_t i = i0; i < i1 && nodeOffset(nodes[i]) < offset_end; i++) {
+        if (nodeEnd(nodes[i]) > offset) found.push_back(&nodes[i]);
+      }
+    } else if (!z.done_left) {
+      stack[top++] = {z.x, z.k, true};
+      // the left child may be past the end of the array
+      size_t y = z.x - ((size_t)1 << (z.k-1));
+      if (y >= n || nodes[y].max_end > offset)
+        stack[top++] = {y, z.k - 1, false};
+    } else if (z.x < n && nodeOffset(nodes[z.x]) < offset_end) {
+      if (nodeEnd(nodes[z.x]) > offset) found.push_back(&nodes[z.x]);
+      stack[top++] = {z.x + ((size_t)1 << (z.k-1)), z.k - 1, false};
     }
-    assert(next.offset < e.endOffset());
+  }
+
+  // in the original order, then by start time
+  sort(found.begin(), found.end(), [](const Node *a, const Node *b) {
+      if (a->seq_no != b->seq_no) return a->seq_no < b->seq_no;
+      return a->event_no < b->event_no;
+    });
+  for (const Node *node : found)
+    matches.push_back((*sequences[node->seq_no])[node->event_no]);
+  stable_sort(matches.begin(), matches.end(), EventsOrderByStartTime());
+}
+
+
+void outputConflictDetails(const EventIndex &index, string_view file_name,
+                           int64_t offset, int64_t offset_end,
+                           OutputWriter &out) {
+  vector<Event> matches;
+  index.findOverlapping(offset, offset_end, matches);
+
+  for (const Event &e : matches) {
+    int64_t overlap_len = min(offset_end, e.endOffset())
+      - max(offset, e.offset);
+    if (!out.isText()) {
+      out.beginRecord(ACCESS_RECORD);
+      out.field(file_name);
+      out.field(offset);
+      out.field(offset_end);
+      out.field(e.rank);
+      out.field(e.api == Event::POSIX ? "POSIX" : "MPI-IO");
+      out.field(e.mode == Event::READ ? "read" : "write");
+      out.field(e.offset);
+      out.field(e.endOffset());
+      out.field(e.start_time, 4);
+      out.field(e.end_time, 4);
+      out.field(overlap_len);
+      out.endRecord();
+      continue;
+    }
+    out << "  time ";
+    out.fixed(e.start_time, 4) << "-";
+    out.fixed(e.end_time, 4)
+      << " rank " << e.rank
+      << " " << (e.api == Event::POSIX ? "POSIX " : "MPI-IO")
+      << " " << (e.mode == Event::READ ? "read " : "write")
+      << " bytes "
+      << e.offset << ".." << (e.endOffset()-1)
+      << " (conflict overlap " << overlap_len << " bytes)\n";
+  }
+}
+    
+
+ReportQueue::ReportQueue(size_t count, int64_t max_held_,
+                         SpillStore *spill_store_)
+  : reports(count), max_held(max_held_), spill_store(spill_store_) {}
+
 
-    // e starts before next: split off the prefix of e
-    if (e.offset < next.offset) {
+SpillStore *ReportQueue::store() {
+  if (spill_store) return spill_store;
+  if (!own_store && !own_store_failed) {
+    own_store.reset(new SpillStore(0));
+    if (!own_store->open()) {
+      own_store.reset();
+      own_store_failed = true;
+    }
+  }
+  return own_store.get();
+}
 
-      // we know next doesn't start after e, so there's an overlap
-      // and e needs to be split
-      SeqEvent tmp = e.split(next.offset);
-      insert(e);
 
-      // continue with the remainder, which shares a start with next
-      e = tmp;
+void ReportQueue::append(size_t i, string_view text) {
+  if (text.empty()) return;
+  Piece piece;
+  piece.length = text.length();
+  SpillStore *s = nullptr;
+  {
+    lock_guard<mutex> guard(lock);
+    if (held + (int64_t) text.length() > max_held
+        || (spill_store && spill_store->overLimit()))
+      s = store();
+    if (!s) {
+      held += text.length();
+      if (spill_store) spill_store->addMemory(text.length());
     }
+  }
+
+  // the store has its own lock
+  if (s) {
+    piece.offset = s->write(text.data(), text.length());
+  } else {
+    piece.text = text;
+  }
+
+  {
+    lock_guard<mutex> guard(lock);
+    reports[i].pieces.push_back(move(piece));
+    reports[i].length += text.length();
+  }
+  piece_ready.notify_all();
+}
+
+
+void ReportQueue::finish(size_t i) {
+  {
+    lock_guard<mutex> guard(lock);
+    reports[i].finished = true;
+  }
+  piece_ready.notify_all();
+}
+
+
+bool ReportQueue::next(size_t i, string &text) {
+  unique_lock<mutex> guard(lock);
+  Report &r = reports[i];
+  piece_ready.wait(guard, [&r] {
+      return r.n_read < r.pieces.size() || r.finished;
+    });
+  if (r.n_read == r.pieces.size()) {
+    vector<Piece>().swap(r.pieces);
+    return false;
+  }
+
+  Piece &piece = r.pieces[r.n_read++];
+  if (piece.offset < 0) {
+    text.swap(piece.text);
+    string().swap(piece.text);
+    held -= piece.length;
+    if (spill_store) spill_store->addMemory(-(int64_t) piece.length);
+    return true;
+  }
+
+  SpillStore *s = store();
+  int64_t offset = piece.offset;
+  guard.unlock();
+  text.resize(piece.length);
+  s->read(offset, &text[0], text.length());
+  return true;
+}
+
+
+/* Scan each file on a pool of threads, and write the reports to out in
+   the same order as files. The threads take the files in that order, and
+   each report goes through a ReportQueue, which holds only a few MiB of
+   them per thread in memory. The one being written to out streams through
+   as it is scanned, and the ones waiting behind it go to a temporary
+   file. */
+void scanFilesInParallel(const vector<File*> &files, const Options &opt,
+                         SpillStore *spill_store, OutputWriter &out) {
+  ReportQueue reports(files.size(), opt.n_threads * ReportQueue::HELD_PER_THREAD,
+                      spill_store);
+
+  OrderedPool pool(opt.n_threads, files.size(), [&](size_t i) {
+      OutputWriter file_out(reports.sink(i), opt.format);
+      scanFile(files[i], opt, spill_store, file_out);
+      file_out.flush();
+      reports.finish(i);
+    });
+
+  string piece;
+  for (size_t i = 0; i < files.size(); i++) {
+    while (reports.next(i, piece)) out << piece;
+  }
+
+  pool.join();
+}
+
 
-    // remaining case: e and next start at the same offset
-    assert(e.offset == next.offset);
+bool Options::parseArgs(int argc, const char **argv) {
+  if (argc <= 1) return false;
+  bool top_k_given = false;
+
+  int argno = 1;
+  while (argno < argc) {
+    const char *arg = argv[argno];
+    if (!strcmp(arg, "-summary")) {
+      output_per_rank_summary = true;
+      EventSequence::track_patterns = true;
+      argno++;
+    } else if (!strcmp(arg, "-audit")) {
+      output_conflict_details = true;
+      argno++;
+    } else if (!strcmp(arg, "-memlimit")) {
+      if (argno+1 >= argc) return false;
+      memory_limit = atoll(argv[argno+1]);
+      if (memory_limit <= 0 || memory_limit > (INT64_MAX >> 20)) {
+        fprintf(stderr, "Invalid memory limit: %s\n", argv[argno+1]);
+        return false;
+      }
+      memory_limit <<= 20;
+      argno += 2;
+    } else if (!strcmp(arg, "-save-cache")) {
+      if (argno+1 >= argc) return false;
+      save_cache_file = argv[argno+1];
+      argno += 2;
+    } else if (!strcmp(arg, "-load-cache")) {
+      if (argno+1 >= argc) return false;
+      load_cache_files.push_back(argv[argno+1]);
+      argno += 2;
+    } else if (!strcmp(arg, "-stats")) {
+      output_stats = true;
+      argno++;
+    } else if (!strcmp(arg, "-stats-json")) {
+      if (argno+1 >= argc) return false;
+      stats_json_file = argv[argno+1];
+      argno += 2;
+    } else if (!strcmp(arg, "-blocksize")) {
+      if (argno+1 >= argc) return false;
+      block_size = atoll(argv[argno+1]);
+      if (block_size < 1) {
+        fprintf(stderr, "Invalid block size: %s\n", argv[argno+1]);
+        return false;
+      }
+      Event::setBlockSize(block_size);
+      argno += 2;
+    } else if (!strcmp(arg, "-blocksizes")) {
+      if (argno+1 >= argc) return false;
+      max_report_block_size = atoll(argv[argno+1]);
+      if (max_report_block_size < 1) {
+        fprintf(stderr, "Invalid block size: %s\n", argv[argno+1]);
+        return false;
+      }
+      argno += 2;
+    } else if (!strcmp(arg, "-throughput")) {
+      if (argno+1 >= argc) return false;
+      throughput_bins = atoi(argv[argno+1]);
+      if (throughput_bins < 1) {
+        fprintf(stderr, "Invalid bin count: %s\n", argv[argno+1]);
+        return false;
+      }
+      argno += 2;
+    } else if (!strcmp(arg, "-throughput-by")) {
+      if (argno+1 >= argc) return false;
+      throughput_by = argv[argno+1];
+      if (throughput_by != "file" && throughput_by != "rank") {
+        fprintf(stderr, "Invalid -throughput-by: %s\n", argv[argno+1]);
+        return false;
+      }
+      argno += 2;
+    } else if (!strcmp(arg, "-report")) {
+      if (argno+1 >= argc) return false;
+      report = argv[argno+1];
+      if (report != "detail" && report != "matrix" && report != "topk") {
+        fprintf(stderr, "Invalid -report: %s\n", argv[argno+1]);
+        return false;
+      }
+      argno += 2;
+    } else if (!strcmp(arg, "-topk")) {
+      if (argno+1 >= argc) return false;
+      top_k = atoi(argv[argno+1]);
+      if (top_k < 1) {
+        fprintf(stderr, "Invalid -topk: %s\n", argv[argno+1]);
+        return false;
+      }
+      top_k_given = true;
+      argno += 2;
+    } else if (!strcmp(arg, "-format")) {
+      if (argno+1 >= argc) return false;
+      if (!OutputWriter::parseFormat(argv[argno+1], format)) {
+        fprintf(stderr, "Invalid -format: %s\n", argv[argno+1]);
+        return false;
+      }
+      argno += 2;
+    } else if (!strcmp(arg, "-follow")) {
+      follow = true;
+      argno++;
+    } else if (!strcmp(arg, "-threads")) {
+      if (argno+1 >= argc) return false;
+      n_threads = atoi(argv[argno+1]);
+      if (n_threads < 1) {
+        fprintf(stderr, "Invalid thread count: %s\n", argv[argno+1]);
+        return false;
+      }
+      argno += 2;
+    } else if (arg[0] == '-' && strlen(arg) > 1) {
+      return false;
+    } else {
+      break;
+    }
+  }
+
+  // add remaining args to input_files
+  input_files.insert(input_files.begin(), argv+argno, argv+argc);
+
+  if (!throughput_by.empty() && !throughput_bins) {
+    fprintf(stderr, "-throughput-by requires -throughput\n");
+    return false;
+  }
+  File::throughput_bins = throughput_bins;
+  File::throughput_by_rank = (throughput_by == "rank");
+
+  if (top_k_given && report != "topk") {
+    fprintf(stderr, "-topk requires -report topk\n");
+    return false;
+  }
+  if (output_conflict_details && report != "detail") {
+    fprintf(stderr, "-audit requires -report detail\n");
+    return false;
+  }
+  if (throughput_bins && format != OutputWriter::TEXT) {
+    fprintf(stderr, "-throughput only supports -format text\n");
+    return false;
+  }
+
+  if (follow) {
+    if (output_per_rank_summary || memory_limit || !save_cache_file.empty()
+        || !load_cache_files.empty() || output_stats
+        || !stats_json_file.empty() || max_report_block_size
+        || throughput_bins || report != "detail") {
+      fprintf(stderr, "-follow can only be combined with -audit, "
+              "-blocksize, and -format\n");
+      return false;
+    }
+    if (input_files.size() != 1) {
+      fprintf(stderr, "-follow requires exactly one input file\n");
+      return false;
+    }
+    File::track_changes = true;
+  }
+  
+  return true;
+}
+
+
+void EventSequence::addEvent(const Event &full_event) {
+  events_added++;
+  if (track_patterns) {
+    if (!patterns) patterns.reset(new Patterns(all_events.resource()));
+    (full_event.mode == Event::READ ? patterns->read : patterns->write)
+      .add(full_event.offset, full_event.length);
+  }
+  if (save_all_events) {
+    all_events.add(full_event);
+  }
+
+  pending.emplace_back(full_event);
+}
+
+
+void EventSequence::merge(EventSequence &other, SpillStore *store) {
+  // Keep the saved events in the order they were added: this sequence's,
+  // then other's. If other has runs in the spill file, spill this one's
+  // in-memory events first so they stay ahead of other's runs.
+  if (!other.spill_runs.empty()) {
+    assert(store);
+    store->addMemory(-spill(*store));
+    spill_runs.insert(spill_runs.end(), other.spill_runs.begin(),
+                      other.spill_runs.end());
+  }
+
+  pending.insert(pending.end(), other.elist.begin(), other.elist.end());
+  pending.insert(pending.end(), other.pending.begin(), other.pending.end());
+  all_events.append(other.all_events);
+  events_added += other.events_added;
+  // other's patterns may be in another File's arena, so copy them
+  if (other.patterns) {
+    if (!patterns) patterns.reset(new Patterns(all_events.resource()));
+    patterns->read.merge(other.patterns->read);
+    patterns->write.merge(other.patterns->write);
+  }
+  other.clear();
+}
+
+
+void AccessPattern::clear() {
+  n_accesses = n_bytes = 0;
+  prev_offset = prev_end = 0;
+  n_transitions = n_sequential = n_backward = n_same_stride = 0;
+  stride_candidate = stride_votes = prev_stride = 0;
+  size_counts.clear();
+}
+
+
+void AccessPattern::add(int64_t offset, int64_t length) {
+  if (n_accesses > 0) {
+    int64_t stride = offset - prev_offset;
+    n_transitions++;
+    if (offset == prev_end) n_sequential++;
+    if (offset < prev_offset) n_backward++;
+    if (n_transitions > 1 && stride == prev_stride) n_same_stride++;
+    prev_stride = stride;
+
+    if (stride_votes == 0) {
+      stride_candidate = stride;
+      stride_votes = 1;
+    } else if (stride == stride_candidate) {
+      stride_votes++;
+    } else {
+      stride_votes--;
+    }
+  }
+
+  n_accesses++;
+  n_bytes += length;
+  prev_offset = offset;
+  prev_end = offset + length;
+
+  int bucket = -1;
+  while (length > 0) {
+    bucket++;
+    length >>= 1;
+  }
+  size_counts[bucket]++;
+}
+
+
+void AccessPattern::merge(const AccessPattern &other) {
+  if (other.n_accesses == 0) return;
+  if (n_accesses == 0) {
+    *this = other;
+    return;
+  }
+
+  n_accesses += other.n_accesses;
+  n_bytes += other.n_bytes;
+  prev_offset = other.prev_offset;
+  prev_end = other.prev_end;
+  prev_stride = other.prev_stride;
+  n_transitions += other.n_transitions;
+  n_sequential += other.n_sequential;
+  n_backward += other.n_backward;
+  n_same_stride += other.n_same_stride;
+
+  // combine the votes as if other's came after these
+  if (other.stride_candidate == stride_candidate) {
+    stride_votes += other.stride_votes;
+  } else if (other.stride_votes > stride_votes) {
+    stride_candidate = other.stride_candidate;
+    stride_votes = other.stride_votes - stride_votes;
+  } else {
+    stride_votes -= other.stride_votes;
+  }
+
+  for (auto &it : other.size_counts) size_counts[it.first] += it.second;
+}
+
+
+const char *AccessPattern::classify() const {
+  if (n_transitions == 0) return "single access";
+  int64_t threshold = n_transitions * PATTERN_PERCENT;
+  if (n_sequential * 100 >= threshold) return "sequential";
+  // n_same_stride counts repeats, so there is one fewer of them
+  if ((n_same_stride + 1) * 100 >= threshold) {
+    if (stride_candidate > 0) return "strided";
+    if (stride_candidate == 0) return "repeated";
+  }
+  if (n_backward * 100 >= threshold) return "reverse";
+  return "random";
+}
+
+
+// 4096 -> "4K"
+static string sizeLabel(int bucket) {
+  if (bucket < 0) return "0";
+  static const char *suffixes[] = {"", "K", "M", "G", "T", "P", "E"};
+  return to_string((int64_t)1 << (bucket % 10)) + suffixes[bucket / 10];
+}
+
+
+string AccessPattern::str() const {
+  ostringstream buf;
+  const char *pattern = classify();
+  buf << pattern;
+  if (!strcmp(pattern, "strided")) buf << " (stride " << stride() << ")";
+  buf << ", " << n_accesses << (n_accesses == 1 ? " access" : " accesses")
+      << ", " << n_bytes << " bytes, sizes";
+  for (auto &it : size_counts) {
+    buf << " " << sizeLabel(it.first) << ":" << it.second;
+  }
+  return buf.str();
+}
+
+
+// Convert seconds to nanoseconds. Returns false if it doesn't fit.
+static bool toNanoseconds(double seconds, int64_t &ns) {
+  if (!(fabs(seconds) < 9e9)) return false;
+  ns = llround(seconds * 1e9);
+  return true;
+}
+
+
+/* Convert nanoseconds to seconds. Dividing the exact count by 1e9 gives
+   the double closest to the decimal number of seconds, so a time read
+   from a log with up to 9 decimal places is returned as it was read. */
+static double toSeconds(int64_t ns) {
+  if (ns > -((int64_t)1 << 53) && ns < ((int64_t)1 << 53))
+    return ns / 1e9;
+  return (double) (ns / 1e9L);
+}
+
+
+void SavedEvents::add(const Event &e) {
+  if (empty()) rank = e.rank;
+  assert(e.rank == rank);
+
+  int64_t start_ns, end_ns;
+  if (!toNanoseconds(e.start_time, start_ns)
+      || !toNanoseconds(e.end_time, end_ns)
+      || !addPacked(e.offset, e.length, start_ns, end_ns - start_ns,
+                    e.mode + 4 * e.api)) {
+    addWide(e);
+  }
+}
+
+
+bool SavedEvents::addPacked(int64_t offset, int64_t length, int64_t start_ns,
+                            int64_t duration_ns, int flags) {
+  if (empty()) base_ns = start_ns;
+  const int64_t max_delta = (int64_t)1 << 59;
+  int64_t delta = start_ns - base_ns;
+  if (length < 0 || length >= WIDE || duration_ns < 0
+      || delta <= -max_delta || delta >= max_delta)
+    return false;
+
+  reserve(size() + 1);
+  if (duration_ns >= LONG) long_durations.push_back({size(), duration_ns});
+  offsets.push_back(offset);
+  starts.push_back(delta * 8 + flags);
+  lengths.push_back(length);
+  durations.push_back(min<int64_t>(duration_ns, LONG));
+  return true;
+}
+
+
+int64_t SavedEvents::duration(size_t i) const {
+  if (durations[i] != LONG) return durations[i];
+  auto it = lower_bound(long_durations.begin(), long_durations.end(),
+                        LongDuration(i, INT64_MIN));
+  assert(it != long_durations.end() && it->first == i);
+  return it->second;
+}
+
+
+void SavedEvents::addWide(const Event &e) {
+  reserve(size() + 1);
+  wide[size()] = e;
+  offsets.push_back(e.offset);
+  starts.push_back(0);
+  lengths.push_back(WIDE);
+  durations.push_back(0);
+}
+
+
+Event SavedEvents::operator[](size_t i) const {
+  if (lengths[i] == WIDE) return wide.at(i);
+  int64_t start_ns = base_ns + (starts[i] >> 3);
+  return Event(rank, (Event::Mode) (starts[i] & 3),
+               (Event::API) (starts[i] >> 2 & 1),
+               offsets[i], lengths[i], toSeconds(start_ns),
+               toSeconds(start_ns + duration(i)));
+}
+
+
+void SavedEvents::append(const SavedEvents &other) {
+  if (other.empty()) return;
+  if (empty()) {
+    *this = other;
+    return;
+  }
+  assert(other.rank == rank);
+
+  reserve(size() + other.size());
+  for (size_t i = 0; i < other.size(); i++) {
+    if (other.lengths[i] == WIDE) {
+      addWide(other.wide.at(i));
+      continue;
+    }
+    int64_t start_ns = other.base_ns + (other.starts[i] >> 3);
+    if (!addPacked(other.offsets[i], other.lengths[i], start_ns,
+                   other.duration(i), other.starts[i] & 7))
+      addWide(other[i]);
+  }
+}
+
+
+void SavedEvents::reserve(size_t n) {
+  size_t capacity = offsets.capacity();
+  if (n <= capacity) return;
+  if (capacity < SLOW_GROWTH_EVENTS) {
+    capacity = max<size_t>(n, 2 * capacity);
+  } else {
+    capacity = max(n, capacity + capacity / 16);
+  }
+  offsets.reserve(capacity);
+  starts.reserve(capacity);
+  lengths.reserve(capacity);
+  durations.reserve(capacity);
+}
+
+
+void SavedEvents::sortByStartTime() {
+  vector<double> start_times(size());
+  for (size_t i = 0; i < size(); i++)
+    start_times[i] = (*this)[i].start_time;
+  if (is_sorted(start_times.begin(), start_times.end())) return;
+
+  vector<size_t> order(size());
+  for (size_t i = 0; i < size(); i++) order[i] = i;
+  stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return start_times[a] < start_times[b];
+    });
+
+  auto permute = [&](auto &column) {
+    typename std::remove_reference<decltype(column)>::type
+      sorted(size(), column.get_allocator());
+    for (size_t i = 0; i < size(); i++) sorted[i] = column[order[i]];
+    column.swap(sorted);
+  };
+  permute(offsets);
+  permute(starts);
+  permute(lengths);
+  permute(durations);
+
+  if (!long_durations.empty()) {
+    pmr::vector<LongDuration> sorted_long(long_durations.get_allocator());
+    sorted_long.reserve(long_durations.size());
+    for (size_t i = 0; i < size(); i++) {
+      if (durations[i] != LONG) continue;
+      auto it = lower_bound(long_durations.begin(), long_durations.end(),
+                            LongDuration(order[i], INT64_MIN));
+      sorted_long.push_back({i, it->second});
+    }
+    long_durations.swap(sorted_long);
+  }
+
+  if (!wide.empty()) {
+    pmr::map<size_t,Event> sorted_wide(wide.get_allocator());
+    for (size_t i = 0; i < size(); i++) {
+      if (lengths[i] == WIDE) sorted_wide[i] = wide.at(order[i]);
+    }
+    wide.swap(sorted_wide);
+  }
+}
+
+
+void SavedEvents::clear() {
+  offsets.clear();
+  offsets.shrink_to_fit();
+  starts.clear();
+  starts.shrink_to_fit();
+  lengths.clear();
+  lengths.shrink_to_fit();
+  durations.clear();
+  durations.shrink_to_fit();
+  long_durations.clear();
+  long_durations.shrink_to_fit();
+  wide.clear();
+  rank = 0;
+  base_ns = 0;
+}
+
+
+/* The spilled events are written as one block, so runs written by other
+   threads can't come between the columns:
+     rank, base_ns, number of long durations, number of wide events
+     the four columns
+     (index, duration) for each long duration
+     (index, Event) for each wide event */
+namespace {
+struct SpilledEventsHeader {
+  int64_t rank, base_ns, long_count, wide_count;
+};
+struct SpilledWideEvent {
+  int64_t index;
+  Event event;
+};
+}
+
+
+int64_t SavedEvents::spill(SpillStore &store) const {
+  size_t n = size();
+  SpilledEventsHeader header = {rank, base_ns, (int64_t)long_durations.size(),
+                                (int64_t)wide.size()};
+  string block;
+  block.reserve(sizeof header + n * BYTES_PER_EVENT
+                + long_durations.size() * sizeof(LongDuration)
+                + wide.size() * sizeof(SpilledWideEvent));
+  block.append((const char*) &header, sizeof header);
+  block.append((const char*) offsets.data(), n * sizeof(int64_t));
+  block.append((const char*) starts.data(), n * sizeof(int64_t));
+  block.append((const char*) lengths.data(), n * sizeof(uint32_t));
+  block.append((const char*) durations.data(), n * sizeof(uint32_t));
+  block.append((const char*) long_durations.data(),
+               long_durations.size() * sizeof(LongDuration));
+  for (auto &it : wide) {
+    SpilledWideEvent w = {(int64_t)it.first, it.second};
+    block.append((const char*) &w, sizeof w);
+  }
+  return store.write(block.data(), block.length());
+}
+
+
+void SavedEvents::unspill(SpillStore &store, int64_t offset, size_t count) {
+  SpilledEventsHeader header;
+  store.read(offset, &header, sizeof header);
+  offset += sizeof header;
+
+  SavedEvents run(resource());
+  run.rank = header.rank;
+  run.base_ns = header.base_ns;
+  run.offsets.resize(count);
+  run.starts.resize(count);
+  run.lengths.resize(count);
+  run.durations.resize(count);
+  store.read(offset, run.offsets.data(), count * sizeof(int64_t));
+  offset += count * sizeof(int64_t);
+  store.read(offset, run.starts.data(), count * sizeof(int64_t));
+  offset += count * sizeof(int64_t);
+  store.read(offset, run.lengths.data(), count * sizeof(uint32_t));
+  offset += count * sizeof(uint32_t);
+  store.read(offset, run.durations.data(), count * sizeof(uint32_t));
+  offset += count * sizeof(uint32_t);
+  run.long_durations.resize(header.long_count);
+  store.read(offset, run.long_durations.data(),
+             header.long_count * sizeof(LongDuration));
+  offset += header.long_count * sizeof(LongDuration);
+  for (int64_t i = 0; i < header.wide_count; i++) {
+    SpilledWideEvent w;
+    store.read(offset, &w, sizeof w);
+    offset += sizeof w;
+    run.wide[w.index] = w.event;
+  }
+
+  if (empty()) {
+    *this = std::move(run);
+  } else {
+    append(run);
+  }
+}
+
+
+int64_t EventSequence::spill(SpillStore &store) {
+  int64_t freed = memoryUsed();
+  build();
+  if (elist.empty() && all_events.empty()) return freed;
+
+  SpillRun run;
+  run.seq_count = elist.size();
+  run.seq_offset = store.write(elist.data(), elist.size() * sizeof(SeqEvent));
+  run.all_count = all_events.size();
+  run.all_offset = run.all_count ? all_events.spill(store) : 0;
+  spill_runs.push_back(run);
+
+  elist.clear();
+  elist.shrink_to_fit();
+  all_events.clear();
+  return freed;
+}
+
+
+void EventSequence::unspill(SpillStore &store) {
+  if (spill_runs.empty()) return;
+
+  // the spilled events were all added before the ones in memory
+  SavedEvents saved(all_events.resource());
+  for (const SpillRun &run : spill_runs) {
+    size_t n = pending.size();
+    pending.resize(n + run.seq_count);
+    store.read(run.seq_offset, pending.data() + n,
+               run.seq_count * sizeof(SeqEvent));
+
+    if (run.all_count) saved.unspill(store, run.all_offset, run.all_count);
+  }
+  spill_runs.clear();
+
+  saved.append(all_events);
+  all_events = std::move(saved);
+}
+
+
+void EventSequence::unspillSavedEvents(SpillStore &store) {
+  SavedEvents saved(all_events.resource());
+  for (SpillRun &run : spill_runs) {
+    if (run.all_count) saved.unspill(store, run.all_offset, run.all_count);
+    run.all_count = 0;
+  }
+  if (saved.empty()) return;
+
+  saved.append(all_events);
+  all_events = std::move(saved);
+}
+
+
+SpillMerge::SpillMerge(const EventSequence &seq, SpillStore &store_,
+                       File::Stats *stats_)
+  : store(store_), stats(stats_) {
+  runs.resize(seq.spillRuns().size() + 1);
+  for (size_t i = 0; i < seq.spillRuns().size(); i++) {
+    runs[i].offset = seq.spillRuns()[i].seq_offset;
+    runs[i].remaining = seq.spillRuns()[i].seq_count;
+    readChunk(runs[i]);
+  }
+  runs.back().it = seq.begin();
+  runs.back().end = seq.end();
+
+  for (size_t i = 0; i < runs.size(); i++) {
+    if (runs[i].it != runs[i].end) heads.push({runs[i].it->offset, i});
+  }
+}
+
+
+void SpillMerge::readChunk(Run &run) {
+  size_t n = min(run.remaining, CHUNK_EVENTS);
+  run.chunk.resize(n);
+  store.read(run.offset, run.chunk.data(), n * sizeof(SeqEvent));
+  run.offset += n * sizeof(SeqEvent);
+  run.remaining -= n;
+  run.it = run.chunk.begin();
+  run.end = run.chunk.end();
+}
+
+
+bool SpillMerge::next(SeqEvent &e) {
+  while (!sweep.take(e)) {
+    if (heads.empty()) {
+      if (finished) return false;
+      finished = true;
+      sweep.finish();
+      if (stats) {
+        stats->list_size_before_minimize += sweep.sweptCount();
+        stats->list_size_after_minimize += sweep.minimizedCount();
+      }
+      continue;
+    }
+
+    size_t i = heads.top().second;
+    heads.pop();
+    Run &run = runs[i];
+    sweep.add(*run.it++);
+    if (run.it == run.end && run.remaining) readChunk(run);
+    if (run.it != run.end) {
+      heads.push({run.it->offset, i});
+    } else {
+      run.chunk.clear();
+      run.chunk.shrink_to_fit();
+    }
+  }
+  return true;
+}
+
+
+void MinimizingSweep::addPiece(const SeqEvent &piece) {
+  n_swept++;
+  if (have_last && last.canExtend(piece)) {
+    last.length += piece.length;
+    return;
+  }
+  if (have_last) {
+    ready.push(last);
+    n_minimized++;
+  }
+  last = piece;
+  have_last = true;
+}
+
+
+void MinimizingSweep::finish() {
+  sweep.finish([this](const SeqEvent &piece) {addPiece(piece);});
+  if (have_last) {
+    ready.push(last);
+    n_minimized++;
+    have_last = false;
+  }
+}
+
+
+void RankSeq::start(EventSequence &seq, SpillStore *store,
+                    File::Stats *stats) {
+  if (!seq.spillRuns().empty()) {
+    assert(store);
+    spill_merge_.reset(new SpillMerge(seq, *store, stats));
+    streamed_ = true;
+  } else {
+    it_ = seq.begin();
+    end_ = seq.end();
+  }
+  if (Event::block_size > 1) {
+    blocks_.reset(new MinimizingSweep(true));
+    streamed_ = true;
+  }
+  if (streamed_) readStreamed();
+  loadOffsets();
+}
+
+
+void RankSeq::readStreamed() {
+  if (!blocks_) {
+    done_ = !readSource(event_);
+    return;
+  }
+
+  // Events are rounded out in order of offset, so they can be added to
+  // the sweep as they are read.
+  while (!blocks_->take(event_)) {
+    if (source_done_) {
+      done_ = true;
+      return;
+    }
+    SeqEvent e;
+    if (readSource(e)) {
+      int64_t end = Event::blockEnd(e.endOffset() - 1) + 1;
+      e.offset = Event::blockStart(e.offset);
+      e.length = end - e.offset;
+      blocks_->add(e);
+    } else {
+      blocks_->finish();
+      source_done_ = true;
+    }
+  }
+}
+
+
+void File::merge(File &other, SpillStore *store) {
+  for (auto &it : other.rank_seq) {
+    getEventSequence(it.first).merge(it.second, store);
+  }
+  other.rank_seq.clear();
+
+  for (auto &it : other.throughput) {
+    auto my_it = throughput.find(it.first);
+    if (my_it == throughput.end()) {
+      throughput.emplace(it.first, it.second);
+    } else {
+      my_it->second.merge(it.second);
+    }
+  }
+  other.throughput.clear();
+}
+
+
+StringPool& StringPool::global() {
+  static StringPool pool;
+  return pool;
+}
+
+
+string_view StringPool::intern(string_view s) {
+  lock_guard<mutex> guard(lock);
+  auto it = strings.find(s);
+  if (it != strings.end()) return *it;
+
+  if (block_size - block_used < s.length() + 1) {
+    block_size = max(BLOCK_SIZE, s.length() + 1);
+    blocks.emplace_back(new char[block_size]);
+    block_used = 0;
+  }
+  char *copy = blocks.back().get() + block_used;
+  memcpy(copy, s.data(), s.length());
+  copy[s.length()] = 0;
+  block_used += s.length() + 1;
+
+  string_view result(copy, s.length());
+  strings.insert(result);
+  return result;
+}
+
+
+File *FileTableType::add(unique_ptr<File> f) {
+  assert(!find(f->id));
+  if ((files.size() + 1) * 2 > slots.size()) {
+    slots.assign(max((size_t)16, slots.size() * 2), 0);
+    for (uint32_t i = 0; i < files.size(); i++) insertSlot(i);
+  }
+  files.push_back(std::move(f));
+  insertSlot(files.size() - 1);
+  return files.back().get();
+}
+
+
+void FileTableType::insertSlot(uint32_t file_no) {
+  size_t mask = slots.size() - 1;
+  size_t i = mix(files[file_no]->id) & mask;
+  while (slots[i]) i = (i + 1) & mask;
+  slots[i] = file_no + 1;
+}
+
+
+File *FileTableType::getPathFile(string_view name, bool save_all_events,
+                                 SpillStore *spill_store) {
+  uint64_t id = File::pathId(name);
+  while (File *f = find(id)) {
+    if (f->id_from_path && f->name == name) return f;
+    id++;
+  }
+  File *f = add(unique_ptr<File>
+                (new File(id, name, save_all_events, spill_store)));
+  f->id_from_path = true;
+  return f;
+}
+
+
+void FileTableType::merge(unique_ptr<File> f, SpillStore *store) {
+  File *existing = find(f->id);
+  if (f->id_from_path) {
+    // Which id a path got depends on which colliding paths its input had
+    // seen first, so look it up by name as getPathFile() does.
+    uint64_t id = File::pathId(f->name);
+    while ((existing = find(id))
+           && !(existing->id_from_path && existing->name == f->name)) {
+      id++;
+    }
+    if (!existing && id != f->id) {
+      existing = add(unique_ptr<File>
+                     (new File(id, f->name, f->save_all_events,
+                               f->spill_store)));
+      existing->id_from_path = true;
+    }
+  }
+  if (existing) {
+    existing->merge(*f, store);
+  } else {
+    add(std::move(f));
+  }
+}
+
+
+void FileTableType::merge(FileTableType &other, SpillStore *store) {
+  for (unique_ptr<File> &f : other.files) merge(std::move(f), store);
+  other.clear();
+}
+
+
+vector<File*> FileTableType::byName() const {
+  vector<File*> result;
+  result.reserve(files.size());
+  for (auto &f : files) result.push_back(f.get());
+  sort(result.begin(), result.end(), [](const File *a, const File *b) {
+    return a->name != b->name ? a->name < b->name : a->id < b->id;
+  });
+  return result;
+}
+
+
+void File::countThroughput(const Event &e) {
+  int key = throughput_by_rank ? e.rank : -1;
+  auto it = throughput.find(key);
+  if (it == throughput.end()) {
+    ThroughputHistogram h(ThroughputHistogram::BINS_PER_OUTPUT_BIN
+                          * throughput_bins);
+    it = throughput.emplace(key, h).first;
+  }
+  it->second.add(e.start_time, e.length, e.mode != Event::READ);
+}
+
+
+void IntervalSet::add(int64_t start, int64_t end) {
+  if (start >= end) return;
+
+  // extend the interval before start if it reaches start
+  auto it = intervals.upper_bound(start);
+  if (it != intervals.begin() && prev(it)->second >= start) {
+    --it;
+    start = it->first;
+  }
+
+  // absorb every interval that starts by end
+  while (it != intervals.end() && it->first <= end) {
+    end = max(end, it->second);
+    it = intervals.erase(it);
+  }
+  intervals.emplace_hint(it, start, end);
+}
+
+
+File::Stats *File::loadForScan(SpillStore *store) {
+  bool first_load = !stats.loaded;
+  stats.loaded = true;
+
+  for (auto &it : rank_seq) {
+    EventSequence &seq = it.second;
+    int64_t before = seq.memoryUsed();
+    if (first_load) stats.rank_events.push_back({it.first, seq.eventsAdded()});
+    if (!seq.spillRuns().empty()) {
+      seq.unspillSavedEvents(*store);
+    } else {
+      if (first_load) stats.list_size_before_minimize += seq.size();
+      seq.minimize();
+      if (first_load) stats.list_size_after_minimize += seq.size();
+    }
+    seq.sortAllEvents();
+    if (store) store->addMemory(seq.memoryUsed() - before);
+  }
+  return first_load ? &stats : nullptr;
+}
+
+
+void File::load(SpillStore *store) {
+  // The first load sees all the events before anything was minimized,
+  // so record the statistics then.
+  bool first_load = !stats.loaded;
+  stats.loaded = true;
+
+  for (auto &it : rank_seq) {
+    EventSequence &seq = it.second;
+    int64_t before = seq.memoryUsed();
+    if (store) seq.unspill(*store);
+    if (first_load) {
+      stats.list_size_before_minimize += seq.size();
+      stats.rank_events.push_back({it.first, seq.eventsAdded()});
+    }
+    seq.minimize();
+    if (first_load) stats.list_size_after_minimize += seq.size();
+    seq.sortAllEvents();
+
+    // Count the events brought back, so spill() can take them off again.
+    if (store) store->addMemory(seq.memoryUsed() - before);
+  }
+}
 
-    SeqEvent e_leftover;
-    
-    // if e and next are different lengths, trim the longer one
-    if (e.length > next.length) {
-      // e is longer, merge the beginnging into next
-      e_leftover = e.split(next.endOffset());
-    } else if (next.length > e.length) {
-      // next is longer, split it, merge e, and finish
-      insert(next.split(e.endOffset()));
-    }
-    
-    assert(e.offset == next.offset);
-    assert(e.length == next.length);
-    next.mergeMode(e);
 
-    /* e longer than next: split e, merge, continue with remainder of e
-       next longer than e: split next, merge, done
-       same length: merge, done */
-    
-    if (e_leftover.length == 0)
-      break;
+bool SpillStore::open() {
+  const char *dir = getenv("TMPDIR");
+  if (!dir || !*dir) dir = "/tmp";
+  string path = string(dir) + "/darshan_dxt_conflicts.XXXXXX";
+  vector<char> path_buf(path.begin(), path.end());
+  path_buf.push_back(0);
 
-    e = e_leftover;
-    next_it++;
+  fd = mkstemp(path_buf.data());
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create temporary file %s: %s\n",
+            path.c_str(), strerror(errno));
+    return false;
   }
-
-  // assert(validate());
+  unlink(path_buf.data());
+  return true;
 }
 
 
-EventSequence::EventList::iterator EventSequence::firstOverlapping
-(const SeqEvent &evt) {
-  EventList::iterator next, prev;
-    
-  /* quick checks. There is no overlap if:
-     - the list is empty
-     - evt finishes before the first element starts
-     - evt begins after the last element finishes
-  */
-  if (elist.empty()
-      || elist.begin()->second.startsAfter(evt)
-      || evt.startsAfter(elist.rbegin()->second)) {
-    return elist.end();
+int64_t SpillStore::write(const void *data, size_t len) {
+  int64_t offset;
+  {
+    lock_guard<mutex> guard(lock);
+    offset = file_size;
+    file_size += len;
   }
-    
-  // get the first element such that it >= evt
-  next = elist.lower_bound(evt.offset);
 
-  // if next is not the first element in the list, check for an overlap
-  // with the element before it
-  if (next != elist.begin()) {
-    EventList::iterator prev = next;
-    prev--;
-    // if evt overlaps prev, then prev is the first overlapping event
-    assert(prev->first < evt.offset);
-    if (!evt.startsAfter(prev->second)) {
-      return prev;
+  const char *p = (const char*) data;
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pwrite(fd, p + done, len - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      fprintf(stderr, "Failed to write temporary file: %s\n", strerror(errno));
+      exit(1);
     }
+    done += n;
   }
-    
-  // the only remaining possible overlap is that evt overlaps next
-  if (next->second.startsAfter(evt)) {
-    return elist.end();
-  }
+  return offset;
+}
 
-  if (!evt.overlaps(next->second)) {
-    cerr << "overlap logic error:\n  " << evt.str() << "\n  "
-         << next->second.str() << "\n";
+
+void SpillStore::read(int64_t offset, void *data, size_t len) {
+  char *p = (char*) data;
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, p + done, len - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      fprintf(stderr, "Failed to read temporary file: %s\n", strerror(errno));
+      exit(1);
+    }
+    done += n;
   }
-  assert(evt.overlaps(next->second));
-  return next;
 }
 
 
-bool EventSequence::validate() {
-  if (elist.empty()) return true;;
-  
-  EventList::iterator prev_it = elist.begin();
-  EventList::iterator it = prev_it;
-  assert(it->first == it->second.offset);
-  it++;
+/* Merge the pending events into elist.
+
+   Sort the pending events by offset and merge them with elist (which is
+   already sorted) into one list. Then sweep through it with an
+   EventSweep, keeping the events that cover the current offset in a
+   min-heap ordered by their end offset, along with a count of how many of
+   them have each mode. Every time an event starts or ends, output a
+   piece covering the bytes since the previous start or end, with the
+   mode that combines all the events covering it.
+
+   This splits ranges exactly where adding the events one at a time and
+   splitting overlaps would. Zero-length events cover no bytes and
+   are dropped.
 
-  while (it != elist.end()) {
+   Only the part of elist that overlaps the span of the pending events is
+   swept; the rest can't change. So adding a few events to a long list,
+   as -follow does, doesn't redo the whole list.
+*/
+void EventSequence::sortAndSweep() const {
+  pending.erase(remove_if(pending.begin(), pending.end(),
+                         [](const SeqEvent &e) {return e.length <= 0;}),
+                pending.end());
+  if (pending.empty()) return;
+
+  auto by_offset = [](const SeqEvent &a, const SeqEvent &b) {
+    return a.offset < b.offset;
+  };
+  sort(pending.begin(), pending.end(), by_offset);
+
+  int64_t span_start = pending.front().offset, span_end = 0;
+  for (const SeqEvent &e : pending) span_end = max(span_end, e.endOffset());
+  auto first = partition_point(elist.begin(), elist.end(),
+                               [span_start](const SeqEvent &e) {
+                                 return e.endOffset() <= span_start;
+                               });
+  auto last = partition_point(first, elist.end(),
+                              [span_end](const SeqEvent &e) {
+                                return e.offset < span_end;
+                              });
+
+  vector<SeqEvent> sorted;
+  sorted.reserve((last - first) + pending.size());
+  std::merge(first, last, pending.begin(), pending.end(),
+             back_inserter(sorted), by_offset);
+  pending.clear();
+  pending.shrink_to_fit();
+
+  // the swept events replace first..last, or all of elist
+  size_t insert_pos = first - elist.begin();
+  elist.erase(first, last);
+  EventList swept;
+  EventList &out = elist.empty() ? elist : swept;
+
+  EventSweep sweep;
+  auto add_piece = [&out](const SeqEvent &piece) {out.push_back(piece);};
+  for (const SeqEvent &e : sorted) sweep.add(e, add_piece);
+  sweep.finish(add_piece);
+
+  if (&out != &elist)
+    elist.insert(elist.begin() + insert_pos, swept.begin(), swept.end());
+}
 
-    const SeqEvent &prev = prev_it->second, &e = it->second;
-    assert(prev.offset == prev_it->first);
-    assert(e.offset == it->first);
+
+bool EventSequence::validate() {
+  build();
+  
+  for (size_t i = 1; i < elist.size(); i++) {
+    const SeqEvent &prev = elist[i-1], &e = elist[i];
 
     if (e.offset <= prev.offset) {
       std::cerr << "Error out of order events (" << prev.str() << ") and ("
@@ -814,46 +3071,74 @@ bool EventSequence::validate() {
                 << e.str() << ")\n";
       return false;
     }
-
-    prev_it = it;
-    it++;
   }
 
   return true;
 }
 
 
-void EventSequence::print() {
-  // std::cout << "EventSequence " << getName() << std::endl;
-  std::cout << "  " << getName() << "\n";
+void EventSequence::print(OutputWriter &out, string_view file_name,
+                          int rank) {
+  if (out.isText()) {
+    out << "  " << getName() << "\n";
+    if (readPattern().count())
+      out << "    read pattern: " << readPattern().str() << "\n";
+    if (writePattern().count())
+      out << "    write pattern: " << writePattern().str() << "\n";
+    for (EventList::const_iterator it = begin(); it != end(); it++) {
+      const SeqEvent &e = *it;
+      out << "    " << Event::mode2str(e.mode) << " " << e.offset << ".."
+          << e.endOffset() << "\n";
+    }
+    return;
+  }
+
+  for (Event::Mode mode : {Event::READ, Event::WRITE}) {
+    const AccessPattern &pattern
+      = mode == Event::READ ? readPattern() : writePattern();
+    if (!pattern.count()) continue;
+    const char *name = pattern.classify();
+    out.beginRecord(PATTERN_RECORD);
+    out.field(file_name);
+    out.field(rank);
+    out.field(Event::mode2str(mode));
+    out.field(name);
+    out.field(strcmp(name, "strided") ? 0 : pattern.stride());
+    out.field(pattern.count());
+    out.field(pattern.bytes());
+    out.endRecord();
+  }
   for (EventList::const_iterator it = begin(); it != end(); it++) {
-    const SeqEvent &e = it->second;
-    /* std::cout << "  " << e.offset << "-" << e.endOffset()
-       << " " << e.str() << std::endl; */
-    std::cout << "    " << e.str() << std::endl;
+    const SeqEvent &e = *it;
+    out.beginRecord(RANGE_RECORD);
+    out.field(file_name);
+    out.field(rank);
+    out.field(Event::mode2str(e.mode));
+    out.field(e.offset);
+    out.field(e.endOffset());
+    out.endRecord();
   }
 }
 
 
 void EventSequence::minimize() {
+  build();
   if (elist.size() <= 1) return;
 
   assert(validate());
-  EventList::iterator it = elist.begin();
 
-  while (true) {
-    EventList::iterator next = it;
-    next++;
-    if (next == elist.end()) break;
-
-    SeqEvent &e = it->second, &n = next->second;
-    if (e.canExtend(n)) {
-      e.length += n.length;
-      elist.erase(next);
+  // copy each event down to 'out', extending the previous one if possible
+  size_t out = 0;
+  for (size_t i = 1; i < elist.size(); i++) {
+    if (elist[out].canExtend(elist[i])) {
+      elist[out].length += elist[i].length;
     } else {
-      it = next;
+      elist[++out] = elist[i];
     }
   }
+  elist.resize(out + 1);
+  elist.shrink_to_fit();
+
   assert(validate());
 }
 
@@ -881,8 +3166,8 @@ static void checkSequence(const EventSequence &s,
   assert(s.size() == bound_pairs.size()/2);
   EventSequence::EventList::const_iterator it = s.begin();
   while (it != s.end()) {
-    assert(it->first == bound_pairs[i]
-           && it->second.endOffset() == bound_pairs[i+1]);
+    assert(it->offset == bound_pairs[i]
+           && it->endOffset() == bound_pairs[i+1]);
     i += 2;
     it++;
   }
@@ -894,9 +3179,9 @@ static void checkSequence2(const EventSequence &s,
   assert(s.size() == bound_pairs.size()/3);
   EventSequence::EventList::const_iterator it = s.begin();
   while (it != s.end()) {
-    assert(it->first == bound_pairs[i]
-           && it->second.endOffset() == bound_pairs[i+1]);
-    assert(it->second.mode == (Event::Mode)bound_pairs[i+2]);
+    assert(it->offset == bound_pairs[i]
+           && it->endOffset() == bound_pairs[i+1]);
+    assert(it->mode == (Event::Mode)bound_pairs[i+2]);
     i += 3;
     it++;
   }
@@ -906,13 +3191,12 @@ static void checkSequence2(const EventSequence &s,
 
 void testEventSequence() {
   EventSequence s("", false);
-  EventSequence::EventList::iterator it;
 
   // |rrrrrr|
   //    |wwwwwww|
   {
     vector<int64_t> in {10, 60, Event::READ, 20, 70, Event::WRITE};
-    vector<int64_t> out {10, 20, Event::READ, 20, 60, Event::WRITE,
+    vector<int64_t> out {10, 20, Event::READ, 20, 60, Event::READ_WRITE,
                           60, 70, Event::WRITE};
     initSequence2(s, in);
     checkSequence2(s, out);
@@ -922,7 +3206,7 @@ void testEventSequence() {
   //    |rrrrrrrr|
   {
     vector<int64_t> in {10, 60, Event::WRITE, 20, 70, Event::READ};
-    vector<int64_t> out {10, 20, Event::WRITE, 20, 60, Event::WRITE,
+    vector<int64_t> out {10, 20, Event::WRITE, 20, 60, Event::READ_WRITE,
                           60, 70, Event::READ};
     initSequence2(s, in);
     checkSequence2(s, out);
@@ -961,140 +3245,1451 @@ void testEventSequence() {
     checkSequence(s, out);
   }
 
-  // |-------|
-  // |-------|
-  {
-    vector<int64_t> in {10, 50, 10, 50};
-    vector<int64_t> out {10, 50};
-    initSequence(s, in);
-    checkSequence(s, out);
-  }
+  // |-------|
+  // |-------|
+  {
+    vector<int64_t> in {10, 50, 10, 50};
+    vector<int64_t> out {10, 50};
+    initSequence(s, in);
+    checkSequence(s, out);
+  }
+
+  // |-------|
+  // |------------|
+  {
+    vector<int64_t> in {10, 50, 10, 100};
+    vector<int64_t> out {10, 50, 50, 100};
+    initSequence(s, in);
+    checkSequence(s, out);
+  }
+
+  // |-------|
+  //     |------------|
+  {
+    vector<int64_t> in {10, 50, 20, 80};
+    vector<int64_t> out {10, 20, 20, 50, 50, 80};
+    initSequence(s, in);
+    checkSequence(s, out);
+    vector<int64_t> out2 {10, 80};
+    s.minimize();
+    checkSequence(s, out2);
+  }
+
+  // |-------|
+  //             |------------|
+  {
+    vector<int64_t> in {10, 50, 80, 100};
+    vector<int64_t> out {10, 50, 80, 100};
+    initSequence(s, in);
+    checkSequence(s, out);
+    s.minimize();
+    checkSequence(s, out);
+  }
+  
+  //             |------------|
+  // |-------|
+  {
+    vector<int64_t> in {80, 100, 10, 50};
+    vector<int64_t> out {10, 50, 80, 100};
+    initSequence(s, in);
+    checkSequence(s, out);
+    s.minimize();
+    checkSequence(s, out);
+  }
+  
+  //         |------------|
+  // |-------|
+  {
+    vector<int64_t> in {50, 100, 10, 50};
+    vector<int64_t> out {10, 50, 50, 100};
+    initSequence(s, in);
+    checkSequence(s, out);
+    vector<int64_t> out2 {10, 100};
+    s.minimize();
+    checkSequence(s, out2);
+  }
+  
+  // |-------|
+  //         |------------|
+  {
+    vector<int64_t> in {10, 50, 50, 100};
+    vector<int64_t> out {10, 50, 50, 100};
+    initSequence(s, in);
+    checkSequence(s, out);
+    vector<int64_t> out2 {10, 100};
+    s.minimize();
+    checkSequence(s, out2);
+  }
+
+  //   |--|  |--|  |--|
+  // |-------------------|
+  {
+    vector<int64_t> in {10, 20, 30, 40, 50, 60, 0, 70};
+    vector<int64_t> out {0, 10, 10, 20, 20, 30, 30, 40, 40, 50, 50, 60, 60, 70};
+    initSequence(s, in);
+    checkSequence(s, out);
+    s.minimize();
+    vector<int64_t> out2 {0, 70};
+    checkSequence(s, out2);
+  }
+
+  //   |---|   |---|   |---|
+  // |---------------|
+  {
+    vector<int64_t> in {10, 30, 50, 70, 90, 110, -1, 80};
+    vector<int64_t> out {-1, 10, 10, 30, 30, 50, 50, 70, 70, 80, 90, 110};
+    initSequence(s, in);
+    checkSequence(s, out);
+    s.minimize();
+    vector<int64_t> out2 {-1, 80, 90, 110};
+    checkSequence(s, out2);
+  }
+
+  
+  //   |ww|  |rr|  |ww|
+  // |rrrrrrrrrrrrrrrrrr|
+  //1|r|xx|rr|rr|rr|xx|r|
+  //2|r|xx|rrrrrrrr|xx|r|   (x = read/write)
+  {
+    vector<int64_t> in {10, 20, Event::WRITE, 30, 40, Event::READ,
+                        50, 60, Event::WRITE, 0, 70, Event::READ};
+    vector<int64_t> out {0, 10, Event::READ, 10, 20, Event::READ_WRITE,
+                         20, 30, Event::READ, 30, 40, Event::READ,
+                         40, 50, Event::READ, 50, 60, Event::READ_WRITE,
+                         60, 70, Event::READ};
+    initSequence2(s, in);
+    checkSequence2(s, out);
+    s.minimize();
+    vector<int64_t> out2 {0, 10, Event::READ, 10, 20, Event::READ_WRITE,
+                         20, 50, Event::READ, 50, 60, Event::READ_WRITE,
+                         60, 70, Event::READ};
+    checkSequence2(s, out2);
+  }
+
+  // compare random overlapping events against a byte-by-byte model,
+  // adding them all at once, in two batches, via merge(), and with
+  // some of them spilled to a SpillStore, read back whole or through a
+  // SpillMerge
+  {
+    const int file_size = 1000;
+    SpillStore store(0);
+    assert(store.open());
+    srand(42);
+    for (int trial = 0; trial < 20; trial++) {
+      vector<int> byte_mode(file_size, -1);
+      vector<Event> events;
+      for (int i = 0; i < 50; i++) {
+        int64_t offset = rand() % file_size;
+        int64_t len = rand() % min<int64_t>(100, file_size - offset);
+        Event::Mode mode = (Event::Mode) (rand() % 2);
+        events.push_back(Event(offset, len, mode));
+        for (int64_t b = offset; b < offset + len; b++) {
+          if (byte_mode[b] == -1) {
+            byte_mode[b] = mode;
+          } else if (byte_mode[b] != mode) {
+            byte_mode[b] = Event::READ_WRITE;
+          }
+        }
+      }
+
+      EventSequence all, halves, merged, other, spilled("", true), streamed;
+      for (size_t i = 0; i < events.size(); i++) {
+        all.addEvent(events[i]);
+        halves.addEvent(events[i]);
+        if (i == events.size() / 2) halves.size();  // build the first half
+        (i % 2 ? merged : other).addEvent(events[i]);
+        spilled.addEvent(events[i]);
+        if (i % 20 == 19) spilled.spill(store);
+        streamed.addEvent(events[i]);
+        if (i % 20 == 19) streamed.spill(store);
+        if (i == 45) streamed.size();  // some of the rest in elist
+      }
+      assert(streamed.spillRuns().size() == 2);
+
+      // the merge gives the same events and list sizes as load()
+      File::Stats stats;
+      vector<SeqEvent> merge_out;
+      for (RankSeq rs(0, streamed, &store, &stats); !rs.done(); rs.next())
+        merge_out.push_back(rs.event());
+      int64_t before_minimize = all.size();
+      all.minimize();
+      assert(stats.list_size_before_minimize == before_minimize);
+      assert(stats.list_size_after_minimize == (int64_t) all.size());
+      assert(equal(merge_out.begin(), merge_out.end(), all.begin(), all.end(),
+                   [](const SeqEvent &a, const SeqEvent &b) {
+                     return a.offset == b.offset && a.length == b.length
+                       && a.mode == b.mode;
+                   }));
+
+      merged.merge(other);
+      assert(other.size() == 0);
+      spilled.unspill(store);
+      assert(equal(spilled.allBegin(), spilled.allEnd(), events.begin(),
+                   [](const Event &a, const Event &b) {
+                     return a.offset == b.offset && a.length == b.length;
+                   }));
+
+      for (EventSequence *seq : {&all, &halves, &merged, &spilled}) {
+        assert(seq->validate());
+        seq->minimize();
+        vector<int> seq_mode(file_size, -1);
+        for (const SeqEvent &e : *seq) {
+          assert(e.length > 0);
+          for (int64_t b = e.offset; b < e.endOffset(); b++)
+            seq_mode[b] = e.mode;
+        }
+        assert(seq_mode == byte_mode);
+      }
+    }
+  }
+
+  cout << "OK\n";
+}
+
+
+void testParseEventLine() {
+  Event e;
+
+  assert(parseEventLine(e, " X_POSIX       1   read        9         4718592          524288      1.2240      1.2261"));
+  assert(e.api == Event::POSIX && e.rank == 1 && e.mode == Event::READ);
+  assert(e.offset == 4718592 && e.length == 524288);
+  assert(e.start_time == 1.2240 && e.end_time == 1.2261);
+
+  assert(parseEventLine(e, "   X_MPIIO     3  write        0              -1              10     12.5000     12.5100   extra"));
+  assert(e.api == Event::MPI && e.rank == 3 && e.mode == Event::WRITE);
+  assert(e.offset == -1 && e.length == 10);
+
+  assert(!parseEventLine(e, " X_STDIO       1   read        9         0          5      1.2240      1.2261"));
+  assert(!parseEventLine(e, " X_POSIX       1   read        9         0          5      1.2240"));
+  assert(!parseEventLine(e, " X_POSIX       1   read        9         0         5x      1.2240      1.2261"));
+  assert(!parseEventLine(e, " X_POSIX      -1   read        9         0          5      1.2240      1.2261"));
+  assert(!parseEventLine(e, ""));
+
+  uint64_t id;
+  string_view name;
+  assert(parseSectionHeader("# DXT, file_id: 8515199880342690440, file_name: /tmp/a b", id, name));
+  assert(id == 8515199880342690440ull && name == "/tmp/a b");
+  assert(!parseSectionHeader("# DXT, file_id: , file_name: /tmp/a", id, name));
+  assert(!parseSectionHeader("# DXT, file_id: 18446744073709551616, file_name: /tmp/a", id, name));
+  assert(!parseSectionHeader("# DXT, rank: 0, hostname: XPS13", id, name));
+
+  assert(isRankLine("# DXT, rank: 0, hostname: XPS13"));
+  assert(!isRankLine("# DXT, rank: x, hostname: XPS13"));
+
+  cout << "OK\n";
+}
+
+
+template<class T>
+static void appendBytes(string &s, T value) {
+  s.append((const char*) &value, sizeof value);
+}
+
+static void appendDxtRecord(string &s, uint64_t id, int64_t rank,
+                            const vector<Event> &writes,
+                            const vector<Event> &reads) {
+  appendBytes(s, id);
+  appendBytes(s, rank);
+  appendBytes(s, (int64_t) 0);
+  s.append(64, '\0');
+  appendBytes(s, (int64_t) writes.size());
+  appendBytes(s, (int64_t) reads.size());
+  for (const vector<Event> *events : {&writes, &reads}) {
+    for (const Event &e : *events) {
+      appendBytes(s, e.offset);
+      appendBytes(s, e.length);
+      appendBytes(s, e.start_time);
+      appendBytes(s, e.end_time);
+    }
+  }
+}
+
+// compress data as a zlib stream
+static string zlibCompress(const string &data) {
+  uLongf len = compressBound(data.length());
+  string out(len, '\0');
+  compress((Bytef*) out.data(), &len, (const Bytef*) data.data(),
+           data.length());
+  out.resize(len);
+  return out;
+}
+
+void testReadDarshanBinaryLog() {
+  string names;
+  appendBytes(names, (uint64_t) 11788350222015526000ull);
+  names.append("/tmp/a", 7);
+
+  // the POSIX module is split across two zlib streams
+  string posix1, posix2, mpiio;
+  appendDxtRecord(posix1, 11788350222015526000ull, 0,
+                  {Event(0, 100)}, {Event(200, 50, Event::READ)});
+  appendDxtRecord(posix2, 11788350222015526000ull, 1,
+                  {Event(-1, 10), Event(50, 100)}, {});
+  appendDxtRecord(mpiio, 42, 1, {}, {Event(0, 10, Event::READ)});
+
+  string regions[3] = {zlibCompress(names),
+                       zlibCompress(posix1) + zlibCompress(posix2),
+                       zlibCompress(mpiio)};
+
+  string log(360, '\0');
+  memcpy(&log[0], "3.21", 4);
+  int64_t magic = 6567223;
+  memcpy(&log[8], &magic, sizeof magic);
+  size_t map_pos[3] = {24, 40 + 16 * 9, 40 + 16 * 10};
+  for (int i = 0; i < 3; i++) {
+    uint64_t map[2] = {log.length(), regions[i].length()};
+    memcpy(&log[map_pos[i]], map, sizeof map);
+    log += regions[i];
+  }
+
+  assert(isDarshanBinaryLog(log));
+  assert(!isDarshanBinaryLog(DARSHAN_HEADER));
+
+  FileTableType file_table;
+  assert(readDarshanBinaryLog(log, "test", file_table, true, nullptr));
+  assert(file_table.size() == 2);
+
+  File *f = file_table.find(11788350222015526000ull);
+  assert(f->name == "/tmp/a");
+  assert(f->rank_seq.size() == 2);
+  EventSequence &rank0 = f->rank_seq.at(0);
+  rank0.sortAllEvents();
+  assert(rank0.allEnd() - rank0.allBegin() == 2);
+  assert(rank0.allBegin()->mode == Event::WRITE);
+  assert((rank0.allBegin()+1)->mode == Event::READ);
+  assert((rank0.allBegin()+1)->offset == 200);
+
+  // the event with a negative offset is dropped
+  EventSequence &rank1 = f->rank_seq.at(1);
+  assert(rank1.allEnd() - rank1.allBegin() == 1);
+  assert(rank1.allBegin()->offset == 50);
+
+  File *g = file_table.find(42);
+  assert(g->name == "<unknown>");
+  assert(g->rank_seq.at(1).allBegin()->api == Event::MPI);
+
+  // truncated log
+  FileTableType empty_table;
+  assert(!readDarshanBinaryLog(string_view(log).substr(0, log.length() - 5),
+                               "test", empty_table, true, nullptr));
+
+  cout << "OK\n";
+}
+
+
+void testEventCache() {
+  FileTableType file_table;
+  File *f = file_table.add(unique_ptr<File>(new File(123, "/tmp/a", true)));
+  f->addEvent(Event(0, Event::WRITE, Event::POSIX, 0, 100, 1.5, 2.5));
+  f->addEvent(Event(0, Event::READ, Event::MPI, 50, 10, 0.5, 0.75));
+  f->addEvent(Event(3, Event::READ, Event::POSIX, 1000, 1, 3, 4));
+  file_table.add(unique_ptr<File>(new File(456, "/tmp/b", true)));
+  // a strace path that looks like the first file's id
+  file_table.getPathFile("123", true, nullptr)
+    ->addEvent(Event(1, Event::WRITE, Event::POSIX, 0, 5, 1, 2));
+
+  char cache_name[] = "/tmp/darshan_dxt_conflicts_test.XXXXXX";
+  int fd = mkstemp(cache_name);
+  assert(fd >= 0);
+  ::close(fd);
+  assert(saveEventCache(cache_name, file_table, nullptr));
+
+  std::ifstream in(cache_name, std::ios::binary);
+  string data((std::istreambuf_iterator<char>(in)),
+              std::istreambuf_iterator<char>());
+  unlink(cache_name);
+
+  FileTableType loaded;
+  assert(loadEventCache(data, "test", loaded, true, nullptr));
+  assert(loaded.size() == 3);
+  File *path_file = loaded.find(File::pathId("123"));
+  assert(path_file->name == "123" && path_file->id_from_path);
+  assert(path_file->rank_seq.at(1).eventsAdded() == 1);
+  assert(!loaded.find(123)->id_from_path);
+  assert(loaded.find(456)->name == "/tmp/b");
+  assert(loaded.find(456)->rank_seq.empty());
+
+  File *f2 = loaded.find(123);
+  assert(f2->name == "/tmp/a");
+  assert(f2->rank_seq.size() == 2);
+  EventSequence &seq = f2->rank_seq.at(0);
+  assert(seq.allEnd() - seq.allBegin() == 2);
+  const Event &e = *(seq.allBegin() + 1);
+  assert(e.rank == 0 && e.mode == Event::READ && e.api == Event::MPI);
+  assert(e.offset == 50 && e.length == 10);
+  assert(e.start_time == 0.5 && e.end_time == 0.75);
+  assert(seq.size() == 3);
+  assert(f2->rank_seq.at(3).allBegin()->offset == 1000);
+
+  // a cache with a different version is rejected
+  string old_version = data;
+  old_version[8]++;
+  FileTableType rejected;
+  assert(!loadEventCache(old_version, "test", rejected, true, nullptr));
+
+  assert(!loadEventCache(data.substr(0, data.length() - 8), "test",
+                         rejected, true, nullptr));
+
+  cout << "OK\n";
+}
+
+
+void testFileTable() {
+  // enough files to grow the hash table several times
+  FileTableType a, b;
+  for (uint64_t id = 0; id < 1000; id++) {
+    string name = "/f" + to_string(999 - id);
+    a.add(unique_ptr<File>(new File(id * 7919, name, false)));
+  }
+  assert(a.size() == 1000);
+  for (uint64_t id = 0; id < 1000; id++) {
+    assert(a.find(id * 7919)->name == "/f" + to_string(999 - id));
+  }
+  assert(!a.find(1));
+
+  // equal strings share one copy
+  string_view name = a.find(0)->name;
+  assert(StringPool::global().intern(string("/f999")).data() == name.data());
+  assert(name.data()[name.length()] == 0);
+
+  b.add(unique_ptr<File>(new File(0, "/f999", false)))
+    ->addEvent(Event(1, Event::WRITE, Event::POSIX, 0, 10, 1, 2));
+  b.add(unique_ptr<File>(new File(5, "/new", false)));
+  a.merge(b);
+  assert(b.empty() && a.size() == 1001);
+  assert(a.find(0)->rank_seq.at(1).eventsAdded() == 1);
+  vector<File*> by_name = a.byName();
+  assert(by_name.front()->name == "/f0" && by_name.back()->name == "/new");
+
+  // a strace path whose hash is taken by another file gets the next id
+  FileTableType file_table;
+  uint64_t id = File::pathId("/a");
+  file_table.add(unique_ptr<File>(new File(id, "/not-a", false)));
+  StraceReader reader(file_table, "test", false, nullptr);
+  reader.addLine("1\topen\t3\t/a");
+  reader.addLine("1\twrite\t0\t5\t1.0\t3");
+  assert(file_table.size() == 2);
+  assert(file_table.find(id)->rank_seq.empty());
+  assert(file_table.find(id + 1)->name == "/a");
+  assert(file_table.find(id + 1)->rank_seq.at(1).eventsAdded() == 1);
+
+  // Another input that saw /a first gave it the unbumped id. Merging
+  // goes by name for path ids, so the two /a files are joined, and the
+  // file with /a's hash is not.
+  FileTableType other;
+  other.getPathFile("/a", false, nullptr)
+    ->addEvent(Event(2, Event::READ, Event::POSIX, 0, 5, 1, 2));
+  assert(other.find(id)->name == "/a");
+  assert(FileTableType::shard(*other.find(id), 7)
+         == FileTableType::shard(*file_table.find(id + 1), 7));
+  file_table.merge(other);
+  assert(file_table.size() == 2);
+  assert(file_table.find(id)->rank_seq.empty());
+  assert(file_table.find(id + 1)->rank_seq.size() == 2);
+
+  // and a path file whose id is taken by a different path gets its own
+  other.add(unique_ptr<File>(new File(id, "/b", false)))->id_from_path = true;
+  file_table.merge(other);
+  assert(file_table.size() == 3);
+  assert(file_table.find(File::pathId("/b"))->name == "/b");
+
+  cout << "OK\n";
+}
+
+
+// compare BlockConflictCounter with checking each block of each size
+void testBlockConflictCounter() {
+  srand(5);
+  for (int iter = 0; iter < 50; iter++) {
+    File f(1, "test", false);
+    vector<Event> events;
+    for (int i = 0; i < 12; i++) {
+      Event e(rand() % 4, rand() % 3 ? Event::READ : Event::WRITE,
+              Event::POSIX, rand() % 200, 1 + rand() % 30, 0, 0);
+      events.push_back(e);
+      f.addEvent(e);
+    }
+
+    BlockConflictCounter counter(1, 64);
+    RangeMerge range_merge(f.rank_seq);
+    while (range_merge.next()) {
+      counter.add(range_merge.getRangeStart(), range_merge.getRangeEnd(),
+                  range_merge.getActiveSet());
+    }
+    OutputWriter actual(nullptr);
+    counter.print(actual, "test");
+
+    // the bytes in conflict at each -blocksize
+    auto conflictBytes = [&f](int64_t size) {
+      Event::setBlockSize(size);
+      vector<bool> bytes(256);
+      RangeMerge block_merge(f.rank_seq);
+      while (block_merge.next()) {
+        if (!block_merge.isConflict()) continue;
+        assert(block_merge.getRangeStart() % size == 0
+               && block_merge.getRangeEnd() % size == 0);
+        for (int64_t i = block_merge.getRangeStart();
+             i < block_merge.getRangeEnd(); i++)
+          bytes.at(i) = true;
+      }
+      Event::setBlockSize(1);
+      return bytes;
+    };
+    vector<bool> byte_conflicts = conflictBytes(1);
+
+    ostringstream expected;
+    expected << "  block size  conflict blocks  conflict bytes  rank pairs\n";
+    for (int64_t size = 1; size <= 64; size *= 2) {
+      int64_t blocks = 0;
+      set<pair<int,int>> pairs;
+      for (int64_t b = 0; b * size < 240; b++) {
+        // As in RangeMerge::isConflict(), a rank is a writer if it wrote
+        // some byte of the block without also reading that byte.
+        map<int,bool> writer;
+        for (int64_t byte = b * size; byte < (b+1) * size; byte++) {
+          map<int,int> modes;  // rank -> 1 if read | 2 if written
+          for (const Event &e : events) {
+            if (e.offset <= byte && e.endOffset() > byte)
+              modes[e.rank] |= (e.mode == Event::READ) ? 1 : 2;
+          }
+          for (auto &it : modes) {
+            writer[it.first] = writer[it.first] || it.second == 2;
+          }
+        }
+        bool conflict = false;
+        for (auto x = writer.begin(); x != writer.end(); x++) {
+          for (auto y = next(x); y != writer.end(); y++) {
+            if (x->second || y->second) {
+              conflict = true;
+              pairs.insert({x->first, y->first});
+            }
+          }
+        }
+        if (conflict) blocks++;
+      }
+
+      // -blocksize finds the blocks of this row, which cover every byte
+      // in conflict
+      vector<bool> block_conflicts = conflictBytes(size);
+      assert(count(block_conflicts.begin(), block_conflicts.end(), true)
+             == blocks * size);
+      for (size_t i = 0; i < byte_conflicts.size(); i++)
+        assert(!byte_conflicts[i] || block_conflicts[i]);
+
+      expected << "  " << setw(10) << size << "  " << setw(15) << blocks
+               << "  " << setw(14) << blocks * size
+               << "  " << setw(10) << pairs.size() << "\n";
+    }
+    assert(actual.take() == expected.str());
+  }
+
+  // A rank that read and wrote the same bytes isn't a writer, so the
+  // 1-byte row has only the bytes scanForConflicts() reports: 50..59,
+  // where rank 3 wrote alone. Its pairs are (1,3) and (2,3).
+  FileTableType file_table;
+  StraceReader reader(file_table, "test", false, nullptr);
+  for (const char *line : {"1\topen\t3\t/a", "1\tread\t0\t100\t1.0\t3",
+                           "1\twrite\t0\t100\t2.0\t3",
+                           "2\topen\t3\t/a", "2\tread\t0\t100\t1.0\t3",
+                           "3\topen\t3\t/a", "3\twrite\t50\t10\t1.0\t3"}) {
+    reader.addLine(line);
+  }
+  File *f = file_table.find(File::pathId("/a"));
+  BlockConflictCounter counter(1, 1);
+  int64_t conflict_bytes = 0;
+  RangeMerge range_merge(f->rank_seq);
+  while (range_merge.next()) {
+    counter.add(range_merge.getRangeStart(), range_merge.getRangeEnd(),
+                range_merge.getActiveSet());
+    if (range_merge.isConflict())
+      conflict_bytes += range_merge.getRangeEnd() - range_merge.getRangeStart();
+  }
+  assert(conflict_bytes == 10);
+  OutputWriter actual(nullptr);
+  counter.print(actual, "/a");
+  assert(actual.take() ==
+         "  block size  conflict blocks  conflict bytes  rank pairs\n"
+         "           1               10              10           2\n");
+
+  // Rank 0's read and write of one block don't make it a reader and
+  // writer of the same bytes, so rank 1's read still conflicts with it.
+  File g(1, "test", false);
+  g.addEvent(Event(0, Event::READ, Event::POSIX, 0, 50, 0, 0));
+  g.addEvent(Event(0, Event::WRITE, Event::POSIX, 50, 50, 0, 0));
+  g.addEvent(Event(1, Event::READ, Event::POSIX, 60, 10, 0, 0));
+  for (int64_t size : {1, 100, 128}) {
+    Event::setBlockSize(size);
+    vector<pair<int64_t,int64_t>> conflicts;
+    RangeMerge block_merge(g.rank_seq);
+    while (block_merge.next()) {
+      if (block_merge.isConflict())
+        conflicts.push_back({block_merge.getRangeStart(),
+                             block_merge.getRangeEnd()});
+    }
+    Event::setBlockSize(1);
+    int64_t start = size == 1 ? 60 : 0, end = size == 1 ? 70 : size;
+    assert(conflicts == (vector<pair<int64_t,int64_t>>{{start, end}}));
+  }
+
+  cout << "OK\n";
+}
+
+
+/* Time each stage of the analysis on each trace named on the command
+   line (for example, traces written by dxt_trace_gen), and print the
+   throughput of each stage:
+     parse   reading and parsing the trace into a FileTableType
+     insert  EventSequence::addEvent() for every event
+     build   sorting and sweeping each sequence, then minimize()
+     sweep   RangeMerge::next() over every subrange of every file
+*/
+int runBenchmarks(int argc, const char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "\n  darshan_dxt_conflicts.bench <trace> ...\n\n");
+    return 1;
+  }
+
+  printf("%-24s %10s %9s %8s %10s %12s %10s %13s %10s\n", "trace",
+         "events", "lines/s", "MiB/s", "parse s", "inserts/s", "builds/s",
+         "subranges/s", "conflicts");
+
+  for (int argno = 1; argno < argc; argno++) {
+    string filename = argv[argno];
+    Options opt;
+
+    // parse, without saving a copy of every event
+    ReadProgress progress(LONG_MAX);
+    FileTableType file_table;
+    double start = getWallTime();
+    {
+      LineReader line_reader(progress);
+      if (!readInputFile(filename, line_reader, file_table, opt, nullptr))
+        continue;
+    }
+    double parse_time = getWallTime() - start;
+    file_table.clear();
+
+    // read it again, saving every event to replay into new sequences
+    opt.output_conflict_details = true;
+    ReadProgress progress2(LONG_MAX);
+    {
+      LineReader line_reader(progress2);
+      readInputFile(filename, line_reader, file_table, opt, nullptr);
+    }
+
+    FileTableType replay_table;
+    int64_t event_count = 0;
+    start = getWallTime();
+    for (auto &f : file_table) {
+      File *copy = replay_table.add(unique_ptr<File>
+                                    (new File(f->id, f->name, false)));
+      for (auto &rank_it : f->rank_seq) {
+        const EventSequence &seq = rank_it.second;
+        for (auto e = seq.allBegin(); e != seq.allEnd(); e++) {
+          copy->addEvent(*e);
+          event_count++;
+        }
+      }
+    }
+    double insert_time = getWallTime() - start;
+    file_table.clear();
+
+    start = getWallTime();
+    for (auto &f : replay_table) {
+      f->load(nullptr);
+    }
+    double build_time = getWallTime() - start;
+
+    int64_t subrange_count = 0, conflict_count = 0;
+    start = getWallTime();
+    for (auto &f : replay_table) {
+      RangeMerge range_merge(f->rank_seq);
+      while (range_merge.next()) {
+        subrange_count++;
+        if (range_merge.isConflict()) conflict_count++;
+      }
+    }
+    double sweep_time = getWallTime() - start;
+
+    auto rate = [](double count, double seconds) {
+      return seconds > 0 ? count / seconds : 0.0;
+    };
+
+    size_t slash = filename.rfind('/');
+    string short_name = (slash == string::npos)
+      ? filename : filename.substr(slash + 1);
+    printf("%-24s %10" PRId64 " %9.3g %8.1f %10.3f %12.3g %10.3g %13.3g"
+           " %10" PRId64 "\n",
+           short_name.c_str(), event_count,
+           rate(progress.linesRead(), parse_time),
+           rate(progress.bytesRead() / (1024.0 * 1024.0), parse_time),
+           parse_time,
+           rate(event_count, insert_time),
+           rate(event_count, build_time),
+           rate(subrange_count, sweep_time), conflict_count);
+  }
+
+  return 0;
+}
+
+
+// compare EventIndex with a scan of every event
+void testEventIndex() {
+  srand(3);
+  for (int n : {0, 1, 2, 7, 8, 9, 100, 1000}) {
+    File f(1, "test", true);
+    for (int i = 0; i < n; i++) {
+      f.addEvent(Event(rand() % 4, Event::READ, Event::POSIX,
+                       rand() % 10000, rand() % 50 == 0 ? 0 : rand() % 300,
+                       rand() % 20, 0));
+    }
+    EventIndex index(f.rank_seq);
+
+    for (int q = 0; q < 200; q++) {
+      int64_t offset = rand() % 10500 - 100;
+      int64_t offset_end = offset + 1 + rand() % 400;
+
+      vector<Event> expected;
+      for (auto &it : f.rank_seq) {
+        const EventSequence &es = it.second;
+        for (auto e = es.allBegin(); e != es.allEnd(); e++) {
+          if (e->offset < offset_end && e->endOffset() > offset)
+            expected.push_back(*e);
+        }
+      }
+      stable_sort(expected.begin(), expected.end(),
+                  EventsOrderByStartTime());
+
+      vector<Event> matches;
+      index.findOverlapping(offset, offset_end, matches);
+      assert(equal(matches.begin(), matches.end(),
+                   expected.begin(), expected.end(),
+                   [](const Event &a, const Event &b) {
+                     return a.rank == b.rank && a.offset == b.offset
+                       && a.length == b.length
+                       && a.start_time == b.start_time;
+                   }));
+    }
+  }
+
+  cout << "OK\n";
+}
 
-  // |-------|
-  // |------------|
-  {
-    vector<int64_t> in {10, 50, 10, 100};
-    vector<int64_t> out {10, 50, 50, 100};
-    initSequence(s, in);
-    checkSequence(s, out);
+
+void testSavedEvents() {
+  vector<Event> events = {
+    Event(3, Event::WRITE, Event::MPI, 100, 10, 2.5, 2.75),
+    Event(3, Event::READ, Event::POSIX, 0, 4096, 0.0001, 0.0002),
+    // a strace time, with microseconds since 1970
+    Event(3, Event::READ_WRITE, Event::POSIX, 5, 0, 1700000000.123456,
+          1700000000.123457),
+    // don't fit in the columns
+    Event(3, Event::WRITE, Event::POSIX, 1, (int64_t)1 << 40, 1.2, 1.3),
+    // a duration too long for its column
+    Event(3, Event::READ, Event::POSIX, 2, 10, 1.0, 100.0),
+    Event(3, Event::READ, Event::MPI, 3, 10, NAN, 1.0),
+    Event(3, Event::WRITE, Event::POSIX, 4, 10, 1.2240, 1.2261),
+  };
+  auto same = [](const Event &a, const Event &b) {
+    return a.rank == b.rank && a.mode == b.mode && a.api == b.api
+      && a.offset == b.offset && a.length == b.length
+      && (a.start_time == b.start_time
+          || (std::isnan(a.start_time) && std::isnan(b.start_time)))
+      && a.end_time == b.end_time;
+  };
+
+  // in an arena, as in a File
+  std::pmr::unsynchronized_pool_resource arena;
+  SavedEvents saved(&arena);
+  for (const Event &e : events) saved.add(e);
+  assert(saved.size() == events.size());
+  assert(equal(saved.begin(), saved.end(), events.begin(), same));
+  assert(saved[0].start_time == 2.5 && saved[6].end_time == 1.2261);
+  // the strace time (see below), 4 TiB, and NAN events are kept whole
+  assert(saved.memoryUsed() == 7 * SavedEvents::BYTES_PER_EVENT + 16
+         + 3 * (int64_t) (sizeof(Event) + 48));
+  for (size_t i = 0; i < events.size(); i++) {
+    assert(saved.offset(i) == events[i].offset);
+    assert(saved.endOffset(i) == events[i].endOffset());
   }
 
-  // |-------|
-  //     |------------|
-  {
-    vector<int64_t> in {10, 50, 20, 80};
-    vector<int64_t> out {10, 20, 20, 50, 50, 80};
-    initSequence(s, in);
-    checkSequence(s, out);
-    vector<int64_t> out2 {10, 80};
-    s.minimize();
-    checkSequence(s, out2);
+  // here the strace time is too far from the first and is kept whole,
+  // so check it on its own
+  SavedEvents strace_time;
+  strace_time.add(events[2]);
+  assert(same(strace_time[0], events[2]));
+
+  // append to events with a different starting time
+  SavedEvents other, appended;
+  other.add(Event(3, Event::READ, Event::POSIX, 7, 1, 1000.5, 1000.5));
+  appended.append(saved);
+  appended.append(other);
+  assert(appended.size() == events.size() + 1);
+  assert(equal(saved.begin(), saved.end(), appended.begin(), same));
+  assert(appended[events.size()].start_time == 1000.5);
+
+  SpillStore store(0);
+  assert(store.open());
+  int64_t offset = appended.spill(store);
+  SavedEvents restored;
+  restored.add(events[1]);
+  restored.unspill(store, offset, appended.size());
+  assert(restored.size() == appended.size() + 1);
+  assert(same(restored[0], events[1]));
+  assert(equal(appended.begin(), appended.end(), restored.begin() + 1, same));
+
+  // NAN sorts unpredictably, so leave it out
+  saved.clear();
+  for (const Event &e : events) {
+    if (!std::isnan(e.start_time)) saved.add(e);
   }
+  saved.add(Event(3, Event::READ, Event::POSIX, 8, 1, 1.2, 1.2));
+  saved.sortByStartTime();
+  vector<int64_t> offsets;
+  for (auto e = saved.begin(); e != saved.end(); e++)
+    offsets.push_back(e->offset);
+  assert((offsets == vector<int64_t>{0, 2, 1, 8, 4, 100, 5}));
 
-  // |-------|
-  //             |------------|
-  {
-    vector<int64_t> in {10, 50, 80, 100};
-    vector<int64_t> out {10, 50, 80, 100};
-    initSequence(s, in);
-    checkSequence(s, out);
-    s.minimize();
-    checkSequence(s, out);
+  cout << "OK\n";
+}
+
+
+void testParentEventMerger() {
+  // the POSIX events come first, as in a DXT log
+  vector<Event> events = {
+    Event(0, Event::READ, Event::POSIX, 0, 100, 1.0, 1.2),
+    Event(0, Event::WRITE, Event::POSIX, 0, 50, 1.3, 1.4),
+    Event(0, Event::WRITE, Event::POSIX, 200, 100, 1.5, 1.6),
+    Event(0, Event::WRITE, Event::POSIX, 10, 10, 3, 4),
+    Event(0, Event::WRITE, Event::POSIX, 500, 10, 5.1, 5.5),
+    Event(0, Event::WRITE, Event::MPI, 0, 100, 1.0, 2.0),
+    Event(0, Event::READ, Event::MPI, 500, 100, 5.0, 6.0),
+    Event(0, Event::READ, Event::MPI, 700, 100, 7.0, 8.0),
+  };
+
+  assert(ParentEventMerger::mergeChildren(events) == 3);
+  assert(events.size() == 5);
+  // outside the MPI event's byte range or timespan
+  assert(events[0].offset == 200 && events[0].api == Event::POSIX);
+  assert(events[1].offset == 10 && events[1].api == Event::POSIX);
+  // parents keep their range, and become writes if a child wrote
+  assert(events[2].offset == 0 && events[2].length == 100);
+  assert(events[2].mode == Event::WRITE && events[2].start_time == 1.0);
+  assert(events[3].offset == 500 && events[3].mode == Event::WRITE);
+  assert(events[4].offset == 700 && events[4].mode == Event::READ);
+
+  // with no MPI events nothing changes
+  vector<Event> posix = {
+    Event(1, Event::WRITE, Event::POSIX, 0, 100, 1.0, 2.0),
+    Event(1, Event::WRITE, Event::POSIX, 0, 100, 1.0, 2.0)};
+  assert(ParentEventMerger::mergeChildren(posix) == 0);
+  assert(posix.size() == 2);
+
+  // Events held past the memory limit are spilled, and flushed the same.
+  SpillStore store(0);
+  assert(store.open());
+  FileTableType in_memory, spilled;
+  File *f1 = in_memory.add(unique_ptr<File>(new File(1, "/a", true)));
+  File *f2 = spilled.add(unique_ptr<File>(new File(1, "/a", true)));
+  ParentEventMerger merger1, merger2(&store);
+  for (int api = Event::POSIX; api <= Event::MPI; api++) {
+    for (int i = 0; i < 30000; i++) {
+      Event e(i % 3, Event::WRITE, (Event::API) api, i * 100,
+              api == Event::MPI ? 100 : 10, i, i + 0.5);
+      merger1.addEvent(f1, e);
+      merger2.addEvent(f2, e);
+    }
   }
-  
-  //             |------------|
-  // |-------|
-  {
-    vector<int64_t> in {80, 100, 10, 50};
-    vector<int64_t> out {10, 50, 80, 100};
-    initSequence(s, in);
-    checkSequence(s, out);
-    s.minimize();
-    checkSequence(s, out);
+  assert(merger1.flush(in_memory) == 30000);
+  assert(merger2.flush(spilled) == 30000);
+  f1->load(nullptr);
+  f2->load(&store);
+  for (int rank = 0; rank < 3; rank++) {
+    EventSequence &seq1 = f1->rank_seq.at(rank), &seq2 = f2->rank_seq.at(rank);
+    assert(seq1.eventsAdded() == 10000 && seq2.eventsAdded() == 10000);
+    assert(equal(seq1.allBegin(), seq1.allEnd(), seq2.allBegin(),
+                 seq2.allEnd(), [](const Event &a, const Event &b) {
+                   return a.offset == b.offset && a.length == b.length
+                     && a.api == b.api && a.start_time == b.start_time;
+                 }));
   }
-  
-  //         |------------|
-  // |-------|
-  {
-    vector<int64_t> in {50, 100, 10, 50};
-    vector<int64_t> out {10, 50, 50, 100};
-    initSequence(s, in);
-    checkSequence(s, out);
-    vector<int64_t> out2 {10, 100};
-    s.minimize();
-    checkSequence(s, out2);
+
+  // load() counts the events it brings back, so they can be spilled and
+  // loaded again without the count drifting
+  int64_t counted = store.memoryUsed();
+  f2->spill(store);
+  int64_t spilled_bytes = counted - store.memoryUsed();
+  assert(spilled_bytes > 0);
+  f2->load(&store);
+  assert(store.memoryUsed() == counted);
+  f2->spill(store);
+  assert(store.memoryUsed() == counted - spilled_bytes);
+
+  cout << "OK\n";
+}
+
+
+void testReadStraceInput() {
+  char input_name[] = "/tmp/darshan_dxt_conflicts_test.XXXXXX";
+  int fd = mkstemp(input_name);
+  assert(fd >= 0);
+  const char *input =
+    "# strace io log\n"
+    "1\topen\t3\t/a\n"
+    "1\twrite\t-1\t10\t1.0\t3\n"
+    "1\twrite\t-1\t10\t1.1\t3\n"
+    "1\tlseek\t3\t100\n"
+    "1\tpread64\t-1\t5\t1.2\t3\n"
+    "1\tread\t-1\t5\t1.3\t3\n"
+    // fd 4 shares fd 3's position
+    "1\tdup2\t3\t4\n"
+    "1\twrite\t-1\t1\t1.4\t4\n"
+    "1\tclose\t3\n"
+    "1\twrite\t7\t1\t1.5\t3\n"
+    "1\topen\t3\t/b\n"
+    "1\twrite\t0\t1\t1.6\t3\n"
+    "1\twrite\t-1\t1\t1.7\t4\n"
+    "2\twrite\t0\t3\t1.8\t1\n"
+    "2\tclose\t1\n"
+    "2\twrite\t0\t3\t1.9\t1\n";
+  assert(write(fd, input, strlen(input)) == (ssize_t) strlen(input));
+  ::close(fd);
+
+  ReadProgress progress(LONG_MAX);
+  LineReader reader(progress);
+  assert(reader.open(input_name));
+  string_view header;
+  assert(reader.getline(header));
+  FileTableType file_table;
+  readStraceInput(reader, file_table, "test", true, nullptr);
+  reader.close();
+  unlink(input_name);
+
+  auto offsets = [&](const char *name) {
+    vector<int64_t> result;
+    File *f = file_table.find(File::pathId(name));
+    EventSequence &seq = f->rank_seq.begin()->second;
+    for (auto e = seq.allBegin(); e != seq.allEnd(); e++)
+      result.push_back(e->offset);
+    return result;
+  };
+
+  assert(file_table.size() == 3);
+  assert((offsets("/a") == vector<int64_t>{0, 10, 100, 100, 105, 106}));
+  assert((offsets("/b") == vector<int64_t>{0}));
+  // standard streams don't keep their events
+  File *out = file_table.find(File::pathId("<STDOUT>"));
+  assert(out->rank_seq.at(2).eventsAdded() == 1);
+
+  cout << "OK\n";
+}
+
+
+void testThroughputHistogram() {
+  const int n_bins = 10;
+  const int capacity = ThroughputHistogram::BINS_PER_OUTPUT_BIN * n_bins;
+  srand(5);
+
+  // Events at the middle of each output bin land in that bin exactly,
+  // whatever order they are added in and however the histogram is split.
+  vector<int> bin_of_event;
+  for (int i = 0; i < 1000; i++) bin_of_event.push_back(rand() % n_bins);
+  bin_of_event.push_back(0);
+  bin_of_event.push_back(n_bins);  // the end time, which goes in the last bin
+
+  ThroughputHistogram all(capacity), part1(capacity), part2(capacity);
+  vector<int64_t> expected_writes(n_bins), expected_reads(n_bins);
+  for (size_t i = 0; i < bin_of_event.size(); i++) {
+    int b = bin_of_event[i];
+    // from time 100 to 150
+    double time = 100 + 5 * (b + (b < n_bins && i < 1000 ? 0.5 : 0));
+    bool is_write = i % 3 == 0;
+    all.add(time, i, is_write);
+    (i % 2 ? part1 : part2).add(time, i, is_write);
+    (is_write ? expected_writes : expected_reads)[min(b, n_bins-1)] += i;
   }
-  
-  // |-------|
-  //         |------------|
-  {
-    vector<int64_t> in {10, 50, 50, 100};
-    vector<int64_t> out {10, 50, 50, 100};
-    initSequence(s, in);
-    checkSequence(s, out);
-    vector<int64_t> out2 {10, 100};
-    s.minimize();
-    checkSequence(s, out2);
+  part1.merge(part2);
+  assert(all.startTime() == 100 && all.endTime() == 150);
+  assert(part1.startTime() == 100 && part1.endTime() == 150);
+
+  for (ThroughputHistogram *h : {&all, &part1}) {
+    vector<ThroughputHistogram::Bin> bins = h->getBins(n_bins, 100, 150);
+    for (int b = 0; b < n_bins; b++) {
+      assert(bins[b].write_bytes == expected_writes[b]);
+      assert(bins[b].read_bytes == expected_reads[b]);
+    }
   }
 
-  //   |--|  |--|  |--|
-  // |-------------------|
-  {
-    vector<int64_t> in {10, 20, 30, 40, 50, 60, 0, 70};
-    vector<int64_t> out {0, 10, 10, 20, 20, 30, 30, 40, 40, 50, 50, 60, 60, 70};
-    initSequence(s, in);
-    checkSequence(s, out);
-    s.minimize();
-    vector<int64_t> out2 {0, 70};
-    checkSequence(s, out2);
+  // times far apart and out of order keep the counts
+  ThroughputHistogram wide(capacity);
+  wide.add(1e6, 1, true);
+  wide.add(-5, 2, false);
+  wide.add(0.001, 4, true);
+  assert(wide.startTime() == -5 && wide.endTime() == 1e6);
+  vector<ThroughputHistogram::Bin> bins = wide.getBins(2, -5, 1e6);
+  assert(bins[0].write_bytes == 4 && bins[0].read_bytes == 2);
+  assert(bins[1].write_bytes == 1 && bins[1].write_count == 1);
+
+  cout << "OK\n";
+}
+
+
+void testAccessPattern() {
+  auto classify = [](const vector<int64_t> &offsets, int64_t length) {
+    AccessPattern p;
+    for (int64_t offset : offsets) p.add(offset, length);
+    return string(p.classify());
+  };
+
+  assert(classify({100}, 10) == "single access");
+  assert(classify({0, 10, 20, 30, 40}, 10) == "sequential");
+  assert(classify({0, 100, 200, 300, 400}, 10) == "strided");
+  assert(classify({0, 0, 0, 0}, 10) == "repeated");
+  assert(classify({400, 300, 200, 100, 0}, 100) == "reverse");
+  assert(classify({500, 20, 300, 7, 1000, 40}, 10) == "random");
+  // one jump doesn't change the pattern
+  assert(classify({0, 100, 200, 300, 400, 5000, 5100, 5200, 5300, 5400,
+                   5500}, 10) == "strided");
+
+  AccessPattern p, q;
+  for (int i = 0; i < 10; i++) p.add(i * 64, 8);
+  for (int i = 20; i < 30; i++) q.add(i * 64, 4096);
+  p.merge(q);
+  assert(p.count() == 20 && p.stride() == 64);
+  assert(p.str() == "strided (stride 64), 20 accesses, 41040 bytes, "
+         "sizes 8:10 4K:10");
+
+  AccessPattern sizes;
+  for (int64_t length : {(int64_t)0, (int64_t)1, (int64_t)3, INT64_MAX})
+    sizes.add(0, length);
+  assert(sizes.str().substr(sizes.str().find("sizes"))
+         == "sizes 0:1 1:1 2:1 4E:1");
+
+  // sequences only keep their patterns for -summary
+  EventSequence untracked, tracked, merged;
+  untracked.addEvent(Event(0, 10, Event::READ));
+  EventSequence::track_patterns = true;
+  tracked.addEvent(Event(0, 10, Event::READ));
+  merged.addEvent(Event(10, 10, Event::WRITE));
+  EventSequence::track_patterns = false;
+  assert(untracked.readPattern().count() == 0);
+  assert(tracked.readPattern().count() == 1);
+  untracked.merge(tracked);
+  untracked.merge(merged);
+  assert(untracked.readPattern().count() == 1);
+  assert(untracked.writePattern().count() == 1);
+
+  cout << "OK\n";
+}
+
+
+// compress data as one gzip member
+static string gzipString(const string &data) {
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  assert(deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8,
+                      Z_DEFAULT_STRATEGY) == Z_OK);
+  string out(deflateBound(&zs, data.length()) + 32, 0);
+  zs.next_in = (Bytef*) data.data();
+  zs.avail_in = data.length();
+  zs.next_out = (Bytef*) &out[0];
+  zs.avail_out = out.length();
+  assert(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+
+void testCompressedInput() {
+  // more than one decompressed chunk, in two gzip members
+  string text;
+  for (int i = 0; i < 1000000; i++) text += to_string(i) + "\n";
+  string compressed = gzipString(text.substr(0, 3000000))
+    + gzipString(text.substr(3000000));
+  assert(Decompressor::detect(compressed) == Decompressor::GZIP);
+  assert(Decompressor::detect("# darshan") == Decompressor::NONE);
+
+  char input_name[] = "/tmp/darshan_dxt_conflicts_test.XXXXXX";
+  int fd = mkstemp(input_name);
+  assert(fd >= 0);
+  assert(write(fd, compressed.data(), compressed.length())
+         == (ssize_t) compressed.length());
+  ::close(fd);
+
+  ReadProgress progress(LONG_MAX);
+  LineReader reader(progress);
+  assert(reader.open(input_name));
+  string_view line;
+  int n_lines = 0;
+  while (reader.getline(line)) {
+    assert(line == to_string(n_lines));
+    n_lines++;
   }
+  assert(n_lines == 1000000);
+
+  // closing early stops the decompressor
+  assert(reader.open(input_name));
+  assert(reader.getline(line) && line == "0");
+  reader.close();
+
+  // a truncated file ends early
+  truncate(input_name, compressed.length() / 2);
+  assert(reader.open(input_name));
+  n_lines = 0;
+  while (reader.getline(line)) n_lines++;
+  assert(n_lines > 0 && n_lines < 1000000);
+  reader.close();
+  unlink(input_name);
 
-  //   |---|   |---|   |---|
-  // |---------------|
-  {
-    vector<int64_t> in {10, 30, 50, 70, 90, 110, -1, 80};
-    vector<int64_t> out {-1, 10, 10, 30, 30, 50, 50, 70, 70, 80, 90, 110};
-    initSequence(s, in);
-    checkSequence(s, out);
-    s.minimize();
-    vector<int64_t> out2 {-1, 80, 90, 110};
-    checkSequence(s, out2);
+  cout << "OK\n";
+}
+
+
+void testFollow() {
+  IntervalSet changed;
+  changed.add(10, 20);
+  changed.add(30, 40);
+  changed.add(20, 25);
+  changed.add(5, 5);
+  assert((IntervalSet::Map(changed.begin(), changed.end())
+          == IntervalSet::Map{{10, 25}, {30, 40}}));
+  changed.add(0, 100);
+  assert((IntervalSet::Map(changed.begin(), changed.end())
+          == IntervalSet::Map{{0, 100}}));
+
+  // adding to a built sequence gives the same list as adding all at once
+  EventSequence incremental, all_at_once;
+  Event e1(0, Event::WRITE, Event::POSIX, 0, 100, 0, 0);
+  Event e2(0, Event::READ, Event::POSIX, 200, 100, 0, 0);
+  Event e3(0, Event::READ, Event::POSIX, 50, 200, 0, 0);
+  incremental.addEvent(e1);
+  incremental.addEvent(e2);
+  incremental.size();
+  incremental.addEvent(e3);
+  all_at_once.addEvent(e1);
+  all_at_once.addEvent(e2);
+  all_at_once.addEvent(e3);
+  assert(incremental.size() == 5);
+  assert(equal(incremental.begin(), incremental.end(), all_at_once.begin(),
+               [](const SeqEvent &a, const SeqEvent &b) {
+                 return a.offset == b.offset && a.length == b.length
+                   && a.mode == b.mode;
+               }));
+
+  // a log that grows while it is followed, ending in a partial line
+  char input_name[] = "/tmp/darshan_dxt_conflicts_test.XXXXXX";
+  int fd = mkstemp(input_name);
+  assert(fd >= 0);
+  auto append = [fd](const char *s) {
+    assert(write(fd, s, strlen(s)) == (ssize_t) strlen(s));
+  };
+  append("# strace io log\n"
+         "1\topen\t3\t/a\n"
+         "2\topen\t3\t/a\n"
+         "1\twrite\t0\t10\t1.0\t3\n"
+         "2\tre");
+
+  ReadProgress progress(LONG_MAX);
+  LineReader reader(progress);
+  assert(reader.open(input_name, true));
+  string_view line;
+  assert(reader.getline(line) && line == "# strace io log");
+
+  File::track_changes = true;
+  FileTableType file_table;
+  StraceReader strace_reader(file_table, "test", false, nullptr);
+  Options opt;
+
+  auto readAndScan = [&]() {
+    while (reader.getline(line)) strace_reader.addLine(line);
+    assert(!reader.eof());
+    OutputWriter out(nullptr);
+    scanChangedRanges(file_table, opt, out);
+    return out.take();
+  };
+
+  assert(readAndScan() == "");
+  assert(file_table.find(File::pathId("/a"))->changed.empty());
+
+  append("ad\t5\t10\t1.1\t3\n");
+  assert(readAndScan()
+         == "/a\n  CONFLICT bytes 5..9: read ranks={2} write ranks={1}\n");
+
+  // only the new bytes are rescanned
+  append("2\tread\t100\t10\t1.2\t3\n");
+  assert(readAndScan() == "");
+
+  // 8..9 and 10..14 are separate events of rank 1, but one conflict
+  append("1\twrite\t8\t100\t1.3\t3\n");
+  assert(readAndScan()
+         == "/a\n"
+         "  CONFLICT bytes 8..14: read ranks={2} write ranks={1}\n"
+         "  CONFLICT bytes 100..107: read ranks={2} write ranks={1}\n");
+
+  File::track_changes = false;
+  reader.close();
+  ::close(fd);
+  unlink(input_name);
+
+  cout << "OK\n";
+}
+
+
+void testRankPairMatrix() {
+  srand(7);
+  for (int iter = 0; iter < 50; iter++) {
+    File f(1, "test", true);
+    vector<Event> events;
+    for (int i = 0; i < 12; i++) {
+      double t = rand() % 5;
+      Event e(rand() % 4, rand() % 3 ? Event::READ : Event::WRITE,
+              Event::POSIX, rand() % 200, 1 + rand() % 30, t, t + 1);
+      events.push_back(e);
+      f.addEvent(e);
+    }
+    f.load(nullptr);
+
+    RankPairMatrix matrix(f.rank_seq);
+    RangeMerge range_merge(f.rank_seq);
+    while (range_merge.next()) {
+      if (range_merge.isConflict())
+        matrix.add(range_merge.getRangeStart(), range_merge.getRangeEnd(),
+                   range_merge.getActiveSet());
+    }
+
+    // Check every byte. Each rank's modes are 1 if it read, 2 if it wrote.
+    RankPairMatrix::PairMap expected;
+    map<int,int> prev_modes;
+    // for each pair, its modes at the previous byte if it conflicted there,
+    // and which types its current conflict has had
+    map<pair<int,int>,pair<int,int>> prev_pair_modes;
+    map<pair<int,int>,array<bool,RankPairMatrix::N_TYPES>> types_seen;
+    int64_t n_conflicts = 0;
+    for (int64_t b = 0; b < 240; b++) {
+      map<int,int> modes;
+      for (const Event &e : events) {
+        if (e.offset <= b && e.endOffset() > b)
+          modes[e.rank] |= (e.mode == Event::READ) ? 1 : 2;
+      }
+      // as in RangeMerge::isConflict(), a rank must have only written
+      bool conflict = modes.size() > 1
+        && any_of(modes.begin(), modes.end(), [](auto &r) {
+            return r.second == 2;
+          });
+      if (conflict && modes != prev_modes) n_conflicts++;
+      prev_modes = conflict ? modes : map<int,int>();
+
+      map<pair<int,int>,pair<int,int>> pair_modes;
+      for (auto x = modes.begin(); x != modes.end(); x++) {
+        for (auto y = next(x); y != modes.end(); y++) {
+          if (x->second != 2 && y->second != 2) continue;
+          pair<int,int> key(x->first, y->first);
+          pair_modes[key] = {x->second, y->second};
+          RankPairMatrix::Counts &c = expected[key];
+          auto prev = prev_pair_modes.find(key);
+          if (prev == prev_pair_modes.end()
+              || prev->second != pair_modes[key]) {
+            c.conflicts++;
+            types_seen[key] = {false, false, false};
+          }
+          c.bytes++;
+
+          array<bool,RankPairMatrix::N_TYPES> types = {false, false, false};
+          for (const Event &ex : events) {
+            if (ex.rank != x->first || ex.offset > b || ex.endOffset() <= b)
+              continue;
+            for (const Event &ey : events) {
+              if (ey.rank != y->first || ey.offset > b
+                  || ey.endOffset() <= b
+                  || (ex.mode == Event::READ && ey.mode == Event::READ))
+                continue;
+              if (ex.mode == Event::WRITE && ey.mode == Event::WRITE) {
+                types[RankPairMatrix::WAW] = true;
+              } else {
+                const Event &r = (ex.mode == Event::READ) ? ex : ey;
+                const Event &w = (ex.mode == Event::READ) ? ey : ex;
+                types[r.start_time >= w.start_time
+                      ? RankPairMatrix::RAW : RankPairMatrix::WAR] = true;
+              }
+            }
+          }
+          for (int t = 0; t < RankPairMatrix::N_TYPES; t++) {
+            if (!types[t]) continue;
+            c.type_bytes[t]++;
+            if (!types_seen[key][t]) c.type_conflicts[t]++;
+            types_seen[key][t] = true;
+          }
+        }
+      }
+      prev_pair_modes.swap(pair_modes);
+    }
+
+    assert(matrix.conflicts() == n_conflicts);
+    const RankPairMatrix::PairMap &actual = matrix.pairs();
+    assert(actual.size() == expected.size());
+    for (auto &it : expected) {
+      const RankPairMatrix::Counts &a = actual.at(it.first), &e = it.second;
+      assert(a.conflicts == e.conflicts && a.bytes == e.bytes);
+      for (int t = 0; t < RankPairMatrix::N_TYPES; t++) {
+        assert(a.type_conflicts[t] == e.type_conflicts[t]);
+        assert(a.type_bytes[t] == e.type_bytes[t]);
+      }
+    }
   }
 
-  
-  //   |ww|  |rr|  |ww|
-  // |rrrrrrrrrrrrrrrrrr|
-  //1|r|ww|rr|rr|rr|ww|r|
-  //2|r|ww|rrrrrrrr|ww|r|
+  // Rank 1 reads and then writes 0..99, rank 2 reads it, and between
+  // them rank 3 writes 50..59. Rank 1 read and wrote the same bytes, so
+  // ranks 1 and 2 don't conflict, with or without rank 3.
+  FileTableType file_table;
+  StraceReader reader(file_table, "test", true, nullptr);
+  for (const char *line : {"1\topen\t3\t/a", "1\tread\t0\t100\t1.0\t3",
+                           "1\twrite\t0\t100\t2.0\t3",
+                           "2\topen\t3\t/a", "2\tread\t0\t100\t1.0\t3",
+                           "3\topen\t3\t/a", "3\twrite\t50\t10\t1.5\t3"}) {
+    reader.addLine(line);
+  }
+  File *f = file_table.find(File::pathId("/a"));
+  f->load(nullptr);
+  RankPairMatrix matrix(f->rank_seq);
+  RangeMerge range_merge(f->rank_seq);
+  while (range_merge.next()) {
+    if (range_merge.isConflict())
+      matrix.add(range_merge.getRangeStart(), range_merge.getRangeEnd(),
+                 range_merge.getActiveSet());
+  }
+  OutputWriter out(nullptr);
+  matrix.print(out, "test", 1);
+  assert(out.take() ==
+         "  1 conflicts, 10 bytes, 2 rank pairs\n"
+         "  top 1 rank pairs by bytes in conflict\n"
+         "    rank    rank  conflicts        bytes"
+         "  RAW conflicts    RAW bytes  WAR conflicts    WAR bytes"
+         "  WAW conflicts    WAW bytes\n"
+         "       1       3          1           10"
+         "              0            0              1           10"
+         "              1           10\n");
+  assert(matrix.pairs().at({2, 3}).type_bytes[RankPairMatrix::WAR] == 10);
+
+  cout << "OK\n";
+}
+
+
+void testOutputWriter() {
+  static const OutputRecord record = {"r", {"name", "n", "t", "ranks"}};
+  auto writeRecord = [](OutputWriter &out, string_view name) {
+    out.beginRecord(record);
+    out.field(name);
+    out.field(-42);
+    out.field(1.23456, 4);
+    out.beginList();
+    out.listItem(3);
+    out.listItem(10);
+    out.endList();
+    out.endRecord();
+  };
+
+  OutputWriter text(nullptr);
+  text << "a " << 12 << ' ' << (int64_t)-5 << " ";
+  text.fixed(0.5, 4) << "|";
+  text.aligned(123, 6) << "|";
+  text.aligned(1234567, 3) << "\n";
+  assert(text.take() == "a 12 -5 0.5000|   123|1234567\n");
+  assert(text.take() == "");
+
+  OutputWriter csv(nullptr, OutputWriter::CSV);
+  csv.writeHeader(record);
+  writeRecord(csv, "/plain");
+  writeRecord(csv, "/a,\"b\"");
+  assert(csv.take() ==
+         "#r,name,n,t,ranks\n"
+         "r,/plain,-42,1.2346,3 10\n"
+         "r,\"/a,\"\"b\"\"\",-42,1.2346,3 10\n");
+
+  OutputWriter jsonl(nullptr, OutputWriter::JSONL);
+  jsonl.writeHeader(record);
+  writeRecord(jsonl, "/a\"\\\n\x01");
+  jsonl.beginRecord(record);
+  jsonl.field("");
+  jsonl.field(0);
+  jsonl.field(0.0, 4);
+  jsonl.beginList();
+  jsonl.endList();
+  jsonl.endRecord();
+  assert(jsonl.take() ==
+         "{\"type\":\"r\",\"name\":\"/a\\\"\\\\\\n\\u0001\","
+         "\"n\":-42,\"t\":1.2346,\"ranks\":[3,10]}\n"
+         "{\"type\":\"r\",\"name\":\"\",\"n\":0,\"t\":0.0000,"
+         "\"ranks\":[]}\n");
+
+  // output written to a stream in the same order as it was added
+  ostringstream stream;
   {
-    vector<int64_t> in {10, 20, Event::WRITE, 30, 40, Event::READ,
-                        50, 60, Event::WRITE, 0, 70, Event::READ};
-    vector<int64_t> out {0, 10, Event::READ, 10, 20, Event::WRITE,
-                         20, 30, Event::READ, 30, 40, Event::READ,
-                         40, 50, Event::READ, 50, 60, Event::WRITE,
-                         60, 70, Event::READ};
-    initSequence2(s, in);
-    checkSequence2(s, out);
-    s.minimize();
-    vector<int64_t> out2 {0, 10, Event::READ, 10, 20, Event::WRITE,
-                         20, 50, Event::READ, 50, 60, Event::WRITE,
-                         60, 70, Event::READ};
-    checkSequence2(s, out2);
+    OutputWriter out(&stream);
+    string line(1000, 'x');
+    for (int i = 0; i < 2000; i++) out << i << line << "\n";
+    out.flush();
+    assert(stream.str().length() == 2000 * 1001 + 10 + 90*2 + 900*3 + 1000*4);
+    out << "end\n";
+  }
+  assert(stream.str().substr(0, 5) == "0xxxx");
+  assert(stream.str().substr(stream.str().length() - 8) == "xxx\nend\n");
+
+  // Reports written on several threads through a ReportQueue come out
+  // in order, whether their pieces waited in memory or in the store.
+  for (int64_t max_held : {(int64_t)0, (int64_t)3 << 20}) {
+    const size_t n_reports = 6;
+    ReportQueue reports(n_reports, max_held, nullptr);
+    OrderedPool pool(3, n_reports, [&reports](size_t i) {
+        OutputWriter out(reports.sink(i));
+        string line(1000, 'a' + i);
+        for (size_t j = 0; j < i * 1000; j++) out << line << "\n";
+        out.flush();
+        reports.finish(i);
+      });
+    string all, piece;
+    for (size_t i = 0; i < n_reports; i++) {
+      while (reports.next(i, piece)) all += piece;
+    }
+    pool.join();
+    assert(all.length() == 15000 * 1001);
+    for (size_t i = 1; i < n_reports; i++) {
+      assert(reports.length(i) == (int64_t) i * 1000 * 1001);
+      assert(all[(i * (i-1) / 2 * 1000) * 1001] == (char)('a' + i));
+    }
   }
 
   cout << "OK\n";
 }
 
 
-RangeMerge::RangeMerge(File::RankSeqMap &rank_sequences) {
+RangeMerge::RangeMerge(File::RankSeqMap &rank_sequences, SpillStore *store,
+                       File::Stats *stats) {
   // create vector of RankSeq objects
+  ranks.reserve(rank_sequences.size());
+  for (auto &it : rank_sequences) {
+    ranks.emplace_back(it.first, it.second, store, stats);
+  }
+  init();
+}
+
+
+RangeMerge::RangeMerge(File::RankSeqMap &rank_sequences, int64_t start,
+                       int64_t end) {
   for (auto &it : rank_sequences) {
-    ranks.emplace_back(it.first, it.second);
+    ranks.emplace_back(it.first, it.second, start, end);
   }
+  init();
+}
+
 
-  // add all the RankSeq objects to a priority queue
+void RangeMerge::init() {
+  // add all the RankSeq objects with events to a priority queue
   for (size_t i = 0; i < ranks.size(); i++)
-    incoming_queue.push(ranks.data() + i);
+    if (!ranks[i].done()) incoming_queue.push(ranks.data() + i);
+
+  mode_count[Event::READ] = mode_count[Event::WRITE]
+    = mode_count[Event::READ_WRITE] = 0;
 
   // initialize range to a junk value
   range_end = range_start = INT64_MIN;
@@ -1118,6 +4713,7 @@ bool RangeMerge::next() {
          outgoing_queue.top()->endOffset() == range_start) {
     RankSeq *rs = outgoing_queue.top();
     outgoing_queue.pop();
+    mode_count[rs->event().mode]--;
     active_set.erase(rs->rank());
     
     // if this rank has more events, push it back into incoming_queue
@@ -1142,6 +4738,7 @@ bool RangeMerge::next() {
     assert(active_set.find(rs->rank()) == active_set.end());
 
     active_set[rs->rank()] = rs->event().mode;
+    mode_count[rs->event().mode]++;
     outgoing_queue.push(rs);
   }
 
@@ -1160,3 +4757,289 @@ bool RangeMerge::next() {
   return true;
 }
 
+
+BlockConflictCounter::BlockConflictCounter(int64_t min_block_size,
+                                           int64_t max_block_size) {
+  int shift = 0;
+  while (shift < 62 && ((int64_t)1 << shift) < min_block_size) shift++;
+  for (; shift < 62 && ((int64_t)1 << shift) <= max_block_size; shift++) {
+    levels.push_back({shift, -1, {}, 0, {}});
+  }
+}
+
+
+void BlockConflictCounter::add(int64_t start, int64_t end,
+                               const RangeMerge::ActiveSet &active) {
+  if (active.empty() || end <= start) return;
+  active_ranks.assign(active.begin(), active.end());
+
+  for (Level &level : levels) {
+    int64_t first = start >> level.shift;
+    int64_t last = (end - 1) >> level.shift;
+
+    if (level.block != first) {
+      finishBlock(level);
+      level.block = first;
+    }
+    mergeRanks(level);
+
+    if (last > first) {
+      finishBlock(level);
+      // every block strictly between first and last sees only this subrange
+      if (last - first > 1)
+        countConflict(level, active_ranks, last - first - 1);
+      level.block = last;
+      level.ranks = active_ranks;
+    }
+  }
+}
+
+
+void BlockConflictCounter::mergeRanks(Level &level) {
+  if (level.ranks.empty()) {
+    level.ranks = active_ranks;
+    return;
+  }
+
+  merge_buf.clear();
+  auto a = level.ranks.begin(), b = active_ranks.begin();
+  while (a != level.ranks.end() || b != active_ranks.end()) {
+    if (b == active_ranks.end()
+        || (a != level.ranks.end() && a->first < b->first)) {
+      merge_buf.push_back(*a++);
+    } else if (a == level.ranks.end() || b->first < a->first) {
+      merge_buf.push_back(*b++);
+    } else {
+      // WRITE if the rank wrote without reading anywhere in the block
+      Event::Mode mode = a->second;
+      if (a->second != b->second)
+        mode = (a->second == Event::WRITE || b->second == Event::WRITE)
+          ? Event::WRITE : Event::READ_WRITE;
+      merge_buf.push_back({a->first, mode});
+      a++;
+      b++;
+    }
+  }
+  level.ranks.swap(merge_buf);
+}
+
+
+void BlockConflictCounter::finishBlock(Level &level) {
+  if (level.block >= 0) countConflict(level, level.ranks, 1);
+  level.block = -1;
+  level.ranks.clear();
+}
+
+
+void BlockConflictCounter::countConflict(Level &level,
+                                         const RankModes &ranks,
+                                         int64_t n_blocks) {
+  if (ranks.size() < 2) return;
+  bool any_writer = false;
+  for (auto &it : ranks) {
+    if (it.second == Event::WRITE) any_writer = true;
+  }
+  if (!any_writer) return;
+
+  level.conflict_blocks += n_blocks;
+  for (size_t a = 0; a < ranks.size(); a++) {
+    for (size_t b = a + 1; b < ranks.size(); b++) {
+      if (ranks[a].second == Event::WRITE || ranks[b].second == Event::WRITE)
+        level.rank_pairs.insert({ranks[a].first, ranks[b].first});
+    }
+  }
+}
+
+
+void BlockConflictCounter::print(OutputWriter &out, string_view file_name) {
+  if (out.isText())
+    out << "  block size  conflict blocks  conflict bytes  rank pairs\n";
+  for (Level &level : levels) {
+    finishBlock(level);
+    int64_t block_size = (int64_t)1 << level.shift;
+    if (!out.isText()) {
+      out.beginRecord(BLOCK_SIZE_RECORD);
+      out.field(file_name);
+      out.field(block_size);
+      out.field(level.conflict_blocks);
+      out.field(level.conflict_blocks * block_size);
+      out.field((int64_t)level.rank_pairs.size());
+      out.endRecord();
+      continue;
+    }
+    out << "  ";
+    out.aligned(block_size, 10) << "  ";
+    out.aligned(level.conflict_blocks, 15) << "  ";
+    out.aligned(level.conflict_blocks * block_size, 14) << "  ";
+    out.aligned(level.rank_pairs.size(), 10) << "\n";
+  }
+}
+
+
+void RankPairMatrix::add(int64_t start_, int64_t end_,
+                         const RangeMerge::ActiveSet &active) {
+  for (auto x = active.begin(); x != active.end(); x++) {
+    for (auto y = next(x); y != active.end(); y++) {
+      if (x->second != Event::WRITE && y->second != Event::WRITE) continue;
+      pair<int,int> key(x->first, y->first);
+      auto it = open_conflicts.find(key);
+      if (it == open_conflicts.end()) {
+        open_conflicts.emplace(key, PairConflict{start_, end_, x->second,
+                                                 y->second});
+        continue;
+      }
+      PairConflict &c = it->second;
+      if (c.end == start_ && c.mode == x->second
+          && c.other_mode == y->second) {
+        c.end = end_;
+      } else {
+        countPairConflict(key, c);
+        c = {start_, end_, x->second, y->second};
+      }
+    }
+  }
+
+  if (start_ == end && active == ranks) {
+    end = end_;
+    return;
+  }
+  if (start < end) {
+    n_conflicts++;
+    conflict_bytes += end - start;
+  }
+  start = start_;
+  end = end_;
+  ranks = active;
+}
+
+
+void RankPairMatrix::finish() {
+  for (auto &it : open_conflicts) countPairConflict(it.first, it.second);
+  open_conflicts.clear();
+
+  if (start < end) {
+    n_conflicts++;
+    conflict_bytes += end - start;
+  }
+  start = end = 0;
+}
+
+
+void RankPairMatrix::countPairConflict(const pair<int,int> &key,
+                                       const PairConflict &conflict) {
+  Counts &counts = pair_counts[key];
+  counts.conflicts++;
+  counts.bytes += conflict.end - conflict.start;
+
+  // Pairs often conflict over the same range, so keep the last matches.
+  if (!index) index.reset(new EventIndex(rank_seq));
+  if (conflict.start != query_start || conflict.end != query_end
+      || matches_by_rank.empty()) {
+    query_start = conflict.start;
+    query_end = conflict.end;
+    index->findOverlapping(query_start, query_end, matches);
+    matches_by_rank.clear();
+    for (const Event &e : matches) matches_by_rank[e.rank].push_back(e);
+  }
+
+  // the byte ranges of each type, clipped to the conflict
+  vector<pair<int64_t,int64_t>> spans[N_TYPES];
+  const vector<Event> &xs = matches_by_rank[key.first];
+  const vector<Event> &ys = matches_by_rank[key.second];
+  for (const Event &x : xs) {
+    for (const Event &y : ys) {
+      if (x.mode == Event::READ && y.mode == Event::READ) continue;
+      int64_t span_start = max({conflict.start, Event::blockStart(x.offset),
+                                Event::blockStart(y.offset)});
+      int64_t span_end
+        = min({conflict.end, Event::blockEnd(x.endOffset() - 1) + 1,
+               Event::blockEnd(y.endOffset() - 1) + 1});
+      if (span_start >= span_end) continue;
+
+      Type type;
+      if (x.mode == Event::WRITE && y.mode == Event::WRITE) {
+        type = WAW;
+      } else {
+        const Event &read = (x.mode == Event::READ) ? x : y;
+        const Event &write = (x.mode == Event::READ) ? y : x;
+        type = (read.start_time >= write.start_time) ? RAW : WAR;
+      }
+      spans[type].push_back({span_start, span_end});
+    }
+  }
+
+  for (int type = 0; type < N_TYPES; type++) {
+    if (spans[type].empty()) continue;
+    sort(spans[type].begin(), spans[type].end());
+    int64_t bytes = 0, covered = spans[type][0].first;
+    for (auto &span : spans[type]) {
+      covered = max(covered, span.first);
+      if (span.second > covered) {
+        bytes += span.second - covered;
+        covered = span.second;
+      }
+    }
+    counts.type_conflicts[type]++;
+    counts.type_bytes[type] += bytes;
+  }
+}
+
+
+void RankPairMatrix::print(OutputWriter &out, string_view file_name,
+                           int top_k) {
+  finish();
+  if (out.isText())
+    out << "  " << n_conflicts << " conflicts, " << conflict_bytes
+        << " bytes, " << pair_counts.size() << " rank pairs\n";
+
+  vector<PairMap::const_iterator> rows;
+  for (auto it = pair_counts.begin(); it != pair_counts.end(); it++)
+    rows.push_back(it);
+
+  if (top_k > 0) {
+    // most bytes first, then in order of rank
+    size_t n = min(rows.size(), (size_t)top_k);
+    partial_sort(rows.begin(), rows.begin() + n, rows.end(),
+                 [](PairMap::const_iterator a, PairMap::const_iterator b) {
+                   if (a->second.bytes != b->second.bytes)
+                     return a->second.bytes > b->second.bytes;
+                   return a->first < b->first;
+                 });
+    rows.resize(n);
+    if (out.isText())
+      out << "  top " << n << " rank pairs by bytes in conflict\n";
+  }
+
+  if (out.isText())
+    out << "    rank    rank  conflicts        bytes"
+      "  RAW conflicts    RAW bytes  WAR conflicts    WAR bytes"
+      "  WAW conflicts    WAW bytes\n";
+  for (PairMap::const_iterator row : rows) {
+    const Counts &c = row->second;
+    if (!out.isText()) {
+      out.beginRecord(RANK_PAIR_RECORD);
+      out.field(file_name);
+      out.field(row->first.first);
+      out.field(row->first.second);
+      out.field(c.conflicts);
+      out.field(c.bytes);
+      for (int type = 0; type < N_TYPES; type++) {
+        out.field(c.type_conflicts[type]);
+        out.field(c.type_bytes[type]);
+      }
+      out.endRecord();
+      continue;
+    }
+    out << "  ";
+    out.aligned(row->first.first, 6) << "  ";
+    out.aligned(row->first.second, 6) << "  ";
+    out.aligned(c.conflicts, 9) << "  ";
+    out.aligned(c.bytes, 11);
+    for (int type = 0; type < N_TYPES; type++) {
+      out << "  ";
+      out.aligned(c.type_conflicts[type], 13) << "  ";
+      out.aligned(c.type_bytes[type], 11);
+    }
+    out << "\n";
+  }
+}
@@ -2,39 +2,85 @@
 #define DARSHAN_DXT_CONFLICTS_HH
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <charconv>
+#include <condition_variable>
 #include <cinttypes>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <poll.h>
 #include <queue>
-#include <regex>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <type_traits>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include "decompress.hh"
+#include "output_writer.hh"
+#include "throughput.hh"
 
 
-// split a line by tab characters
-void splitTabString(std::vector<std::string> &fields, const std::string &line);
+// Split a line by tab characters into at most max_fields fields.
+// Returns the number of fields, or max_fields+1 if there are more.
+int splitTabFields(std::string_view line, std::string_view *fields,
+                   int max_fields);
 
 
 struct Options {
   bool output_per_rank_summary;
   bool output_conflict_details;
+  int n_threads;
+  int64_t memory_limit;  // in bytes; 0 if there is no limit
+  std::string save_cache_file;  // empty if no cache is written
+  bool output_stats;
+  std::string stats_json_file;  // empty if no JSON statistics are written
+  int64_t block_size;  // granularity of the conflict scan, in bytes
+  // if nonzero, report conflicts at each power-of-two block size up to this
+  int64_t max_report_block_size;
+  int throughput_bins;  // if nonzero, report throughput instead of conflicts
+  std::string throughput_by;  // "", "file", or "rank"
+  bool follow;  // tail a growing strace log, reporting conflicts as they occur
+  std::string report;  // "detail", "matrix", or "topk"
+  int top_k;  // number of rank pairs listed by "-report topk"
+  OutputWriter::Format format;
+  std::vector<std::string> load_cache_files;
   std::vector<std::string> input_files;
 
   Options() :
-    output_per_rank_summary(false), output_conflict_details(false) {}
+    output_per_rank_summary(false), output_conflict_details(false),
+    n_threads(1), memory_limit(0), output_stats(false), block_size(1),
+    max_report_block_size(0), throughput_bins(0), follow(false),
+    report("detail"), top_k(10), format(OutputWriter::TEXT) {}
 
   // return false on error
   bool parseArgs(int args, const char **argv);
+
+  // Keep a copy of every event, for -audit or to write them to a cache.
+  bool saveAllEvents() const {
+    return output_conflict_details || !save_cache_file.empty()
+      || report != "detail";
+  }
 };
 
 
@@ -173,8 +219,8 @@ public:
      In RAW or WAR situations, if the byte range doesn't actually overlap, the
      read will get the same result whether preceding write completed or not.
   */
-  static int block_size;
-  static void setBlockSize(int b) {block_size = b;}
+  static int64_t block_size;
+  static void setBlockSize(int64_t b) {block_size = b;}
 
   bool overlapsBlocks(const Event &other) const {
     int64_t this_start, this_end, other_start, other_end;
@@ -223,7 +269,7 @@ public:
   bool operator () (const Event &a, const Event &b) const {
     return a.start_time < b.start_time;
   }
-} events_order_by_start_time;
+};
 
 
 struct SeqEvent {
@@ -291,116 +337,733 @@ struct SeqEvent {
 };
 
 
+/* Splits events that may overlap into sorted, non-overlapping pieces, as
+   described at EventSequence::sortAndSweep(). The events are added in
+   order of offset, and each piece is passed to out as soon as no later
+   event can change it, so the input can be streamed through.
+
+   If writes_win is set, a piece that a WRITE event covers is a WRITE,
+   whatever else covers it. That is how the modes of one rank's bytes
+   combine into the mode of a block (see BlockConflictCounter): the rank
+   is a writer if it wrote some byte without also reading it. */
+class EventSweep {
+public:
+  explicit EventSweep(bool writes_win_ = false) : writes_win(writes_win_) {}
+
+  // Add an event with a positive length, starting at or after the
+  // previous one.
+  template<class Out> void add(const SeqEvent &e, Out &&out) {
+    advance(e.offset, out);
+    active.push(Active(e.endOffset(), e.mode));
+    mode_count[e.mode]++;
+  }
+
+  // Pass out the pieces of the events still active.
+  template<class Out> void finish(Out &&out) {advance(INT64_MAX, out);}
+
+private:
+  // (end offset, mode) of each active event
+  using Active = std::pair<int64_t, Event::Mode>;
+  std::priority_queue<Active, std::vector<Active>, std::greater<Active>>
+    active;
+  int mode_count[3] = {0, 0, 0};
+  int64_t pos = INT64_MIN;
+  bool writes_win;
+
+  // Output the pieces up to offset, ending the events that end by then.
+  template<class Out> void advance(int64_t offset, Out &out) {
+    while (!active.empty() || pos < offset) {
+      int64_t boundary = active.empty() ? offset
+        : std::min(offset, active.top().first);
+      if (!active.empty() && pos < boundary) {
+        SeqEvent piece;
+        piece.offset = pos;
+        piece.length = boundary - pos;
+        piece.mode = mode();
+        out(piece);
+      }
+      pos = boundary;
+      if (pos == offset && (active.empty() || active.top().first > pos))
+        break;
+      while (!active.empty() && active.top().first == pos) {
+        mode_count[active.top().second]--;
+        active.pop();
+      }
+    }
+  }
+
+  // the combination of the modes of the active events
+  Event::Mode mode() const {
+    if (writes_win && mode_count[Event::WRITE] > 0) return Event::WRITE;
+    if (mode_count[Event::READ_WRITE] > 0
+        || (mode_count[Event::READ] > 0 && mode_count[Event::WRITE] > 0))
+      return Event::READ_WRITE;
+    return mode_count[Event::READ] > 0 ? Event::READ : Event::WRITE;
+  }
+};
+
+
+/* An EventSweep whose pieces are joined where they are adjacent and have
+   the same mode, as EventSequence::minimize() joins them. The events are
+   held until nothing later can extend them. */
+class MinimizingSweep {
+public:
+  explicit MinimizingSweep(bool writes_win = false) : sweep(writes_win) {}
+
+  // Add an event, as for EventSweep::add().
+  void add(const SeqEvent &e) {
+    sweep.add(e, [this](const SeqEvent &piece) {addPiece(piece);});
+  }
+
+  // Call after the last event is added, to release the rest.
+  void finish();
+
+  // Set e to the next finished event. Returns false if there is none yet.
+  bool take(SeqEvent &e) {
+    if (ready.empty()) return false;
+    e = ready.front();
+    ready.pop();
+    return true;
+  }
+
+  // number of pieces before and after joining them
+  int64_t sweptCount() const {return n_swept;}
+  int64_t minimizedCount() const {return n_minimized;}
+
+private:
+  EventSweep sweep;
+
+  // the finished events, and the last one, which may be extended
+  std::queue<SeqEvent> ready;
+  SeqEvent last;
+  bool have_last = false;
+  int64_t n_swept = 0, n_minimized = 0;
+
+  // take a piece from the sweep, joining it to the last one if it can
+  void addPiece(const SeqEvent &piece);
+};
+
+
+/* A temporary file holding events that were moved out of memory to keep
+   memory use under a limit (the -memlimit option). Each EventSequence
+   remembers the location of its own runs of events in the file.
+
+   The file is unlinked as soon as it is created, so it disappears when
+   the program exits. write() and read() may be called from multiple
+   threads.
+*/
+class SpillStore {
+public:
+  SpillStore(int64_t memory_limit_)
+    : fd(-1), file_size(0), memory_used(0), memory_limit(memory_limit_) {}
+  ~SpillStore() {if (fd >= 0) ::close(fd);}
+
+  // Create the temporary file in $TMPDIR or /tmp. Returns false on error.
+  bool open();
+
+  // Append len bytes, returning the offset at which they were written.
+  int64_t write(const void *data, size_t len);
+
+  void read(int64_t offset, void *data, size_t len);
+
+  // Track the memory held by events that have not been spilled.
+  void addMemory(int64_t bytes) {memory_used += bytes;}
+  int64_t memoryUsed() const {return memory_used;}
+  bool overLimit() const {return memory_used > memory_limit;}
+
+private:
+  int fd;
+  std::mutex lock;
+  int64_t file_size;
+  std::atomic<int64_t> memory_used;
+  const int64_t memory_limit;
+};
+
+
+/* How one rank walks a file with reads or with writes, computed as
+   events are added. Each access is compared with the previous one:
+     sequential  it starts where the previous one ended
+     strided     it starts a constant distance after the previous one
+     repeated    it starts at the same offset as the previous one
+     reverse     it starts before the previous one
+     random      none of these, for most of the accesses
+   A pattern holds if at least PATTERN_PERCENT of the transitions follow
+   it. Request sizes are counted in power-of-two buckets, labelled with
+   their lower bound. */
+class AccessPattern {
+public:
+  static const int PATTERN_PERCENT = 80;
+
+  // with no accesses
+  static const AccessPattern none;
+
+  // size_counts is allocated from resource
+  explicit AccessPattern(std::pmr::memory_resource *resource
+                         = std::pmr::get_default_resource())
+    : size_counts(resource) {clear();}
+
+  void add(int64_t offset, int64_t length);
+
+  // Add the counts from another sequence of accesses. The transition
+  // from the last access of this one to the first of other isn't counted.
+  void merge(const AccessPattern &other);
+
+  void clear();
+
+  int64_t count() const {return n_accesses;}
+  int64_t bytes() const {return n_bytes;}
+
+  // "sequential", "strided", "repeated", "reverse", "random",
+  // or "single access"
+  const char *classify() const;
+
+  // the most common distance between accesses, if classify() is "strided"
+  int64_t stride() const {return stride_candidate;}
+
+  // for example: "strided (stride 8192), 100 accesses, 409600 bytes,
+  // sizes 4K:100"
+  std::string str() const;
+
+private:
+  int64_t n_accesses, n_bytes;
+  int64_t prev_offset, prev_end;
+
+  // counts of transitions between consecutive accesses
+  int64_t n_transitions, n_sequential, n_backward, n_same_stride;
+
+  // most frequent stride by Boyer-Moore majority vote
+  int64_t stride_candidate, stride_votes;
+  int64_t prev_stride;
+
+  // log2 of the request size -> count, with -1 for 0-byte requests
+  std::pmr::map<int,int64_t> size_counts;
+};
+
+
+/* The events of one rank in one file, saved in the order they were added
+   for -audit and -save-cache. They are packed into columns, 24 bytes per
+   event rather than the 48 of an Event:
+     offset    int64
+     start     int64: the start time in nanoseconds after the first
+               event's, times 8, plus the mode and the API
+     length    uint32
+     duration  uint32: the end time minus the start time, in nanoseconds
+   The rank is the same for every event, so it is only stored once. A
+   duration of 4.29 seconds or more is kept in a side list, sorted by
+   event index. An event that doesn't fit at all (4 GiB or more, or a
+   time that isn't finite) is kept whole in a side table.
+
+   Times are rounded to the nearest nanosecond. Times read from a log
+   with up to 9 decimal places come back exactly as they were read.
+
+   Events are returned as Event values, by index or through iterators.
+   The columns are allocated from resource.
+*/
+class SavedEvents {
+public:
+  static const int64_t BYTES_PER_EVENT = 24;
+
+  explicit SavedEvents(std::pmr::memory_resource *resource
+                       = std::pmr::get_default_resource())
+    : rank(0), base_ns(0), offsets(resource), starts(resource),
+      lengths(resource), durations(resource), long_durations(resource),
+      wide(resource) {}
+
+  std::pmr::memory_resource *resource() const {
+    return offsets.get_allocator().resource();
+  }
+
+  size_t size() const {return offsets.size();}
+  bool empty() const {return offsets.empty();}
+
+  // Every event added must have the same rank.
+  void add(const Event &e);
+
+  // Add all of other's events after this one's.
+  void append(const SavedEvents &other);
+
+  Event operator[](size_t i) const;
+
+  // (*this)[i].offset and (*this)[i].endOffset(), without making the Event
+  int64_t offset(size_t i) const {return offsets[i];}
+  int64_t endOffset(size_t i) const {
+    return lengths[i] == WIDE ? wide.at(i).endOffset()
+      : offsets[i] + lengths[i];
+  }
+
+  // sort by start time, keeping events with the same start time in order
+  void sortByStartTime();
+
+  void clear();
+
+  int64_t memoryUsed() const {
+    return size() * BYTES_PER_EVENT
+      + long_durations.size() * sizeof(LongDuration)
+      + wide.size() * (sizeof(Event) + 48);
+  }
+
+  /* Write the events to store, returning where they were written. Read
+     them back with unspill(), which adds them to this object's events
+     like append(). */
+  int64_t spill(SpillStore &store) const;
+  void unspill(SpillStore &store, int64_t offset, size_t count);
+
+  // An iterator that returns events by value.
+  class const_iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Event;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Event*;
+    using reference = Event;
+
+    const_iterator(const SavedEvents *events_, size_t i_)
+      : events(events_), i(i_) {}
+
+    Event operator*() const {return (*events)[i];}
+
+    // holds a copy of the event, so e->offset works
+    struct Arrow {
+      Event e;
+      const Event* operator->() const {return &e;}
+    };
+    Arrow operator->() const {return {**this};}
+
+    const_iterator& operator++() {i++; return *this;}
+    const_iterator operator++(int) {return const_iterator(events, i++);}
+    const_iterator operator+(difference_type n) const {
+      return const_iterator(events, i + n);
+    }
+    difference_type operator-(const const_iterator &other) const {
+      return i - other.i;
+    }
+    bool operator==(const const_iterator &other) const {return i == other.i;}
+    bool operator!=(const const_iterator &other) const {return i != other.i;}
+
+  private:
+    const SavedEvents *events;
+    size_t i;
+  };
+
+  const_iterator begin() const {return const_iterator(this, 0);}
+  const_iterator end() const {return const_iterator(this, size());}
+
+private:
+  // the length of an event kept in wide
+  static const uint32_t WIDE = UINT32_MAX;
+
+  // the duration of an event whose duration is in long_durations
+  static const uint32_t LONG = UINT32_MAX;
+
+  int rank;
+  int64_t base_ns;  // the start of the first event, in nanoseconds
+
+  std::pmr::vector<int64_t> offsets, starts;
+  std::pmr::vector<uint32_t> lengths, durations;
+
+  // (index, duration in nanoseconds) of the events with LONG durations
+  using LongDuration = std::pair<size_t,int64_t>;
+  std::pmr::vector<LongDuration> long_durations;
+
+  // index -> event, for the events that don't fit in the columns
+  std::pmr::map<size_t,Event> wide;
+
+  // the duration of packed event i, in nanoseconds
+  int64_t duration(size_t i) const;
+
+  /* Make room in the columns for n events. Once they hold
+     SLOW_GROWTH_EVENTS events they grow by a sixteenth at a time, rather
+     than doubling as push_back() would, so a long sequence leaves at most
+     a sixteenth of its columns unused. The extra copying costs little
+     next to parsing the events. */
+  static const size_t SLOW_GROWTH_EVENTS = 4096;
+  void reserve(size_t n);
+
+  // Append an event, or return false if it doesn't fit in the columns.
+  // flags is the mode plus 4 times the API.
+  bool addPacked(int64_t offset, int64_t length, int64_t start_ns,
+                 int64_t duration_ns, int flags);
+
+  void addWide(const Event &e);
+};
+
+
+/* The set of byte ranges one rank read or wrote in one file.
+
+   Events are added in bulk: addEvent() just appends to a vector of raw
+   events. The first time the sequence is examined (size(), begin(), ...)
+   the raw events are sorted and swept in one pass into elist, a flat
+   array of sorted, non-overlapping SeqEvents. Where events overlap, the
+   range is split and the mode of each piece is the combination of all the
+   events covering it (see SeqEvent::mergeMode). Events added after that
+   are merged into elist the next time it is examined.
+*/
 class EventSequence {
   
 public:
-  // map offset to Event
-  using EventList = std::map<int64_t, SeqEvent>;
+  // sorted by offset, non-overlapping
+  using EventList = std::pmr::vector<SeqEvent>;
+
+  // The events are allocated from alloc's memory resource. A File passes
+  // its arena when the sequence is created in its RankSeqMap.
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
 
-  EventSequence(std::string name_="", bool save_all=false)
-    : name(name_), save_all_events(save_all) {}
+  EventSequence(std::string name_="", bool save_all=false,
+                const allocator_type &alloc = {})
+    : name(name_), elist(alloc), pending(alloc), save_all_events(save_all),
+      all_events(alloc.resource()), events_added(0) {}
 
   const std::string& getName() {return name;}
   
   void addEvent(const Event &e);
+
+  // number of events added, including those merged from other sequences
+  int64_t eventsAdded() const {return events_added;}
+
+  /* If track_patterns is set, the access patterns of the events added
+     are kept, in the order they were added. They are only printed by
+     -summary, so otherwise they aren't kept. */
+  static bool track_patterns;
+  const AccessPattern& readPattern() const {
+    return patterns ? patterns->read : AccessPattern::none;
+  }
+  const AccessPattern& writePattern() const {
+    return patterns ? patterns->write : AccessPattern::none;
+  }
+
+  // Move all of other's events into this sequence, leaving other empty.
+  // If other has spilled events, store must be the SpillStore they are in.
+  void merge(EventSequence &other, SpillStore *store = nullptr);
+
+  // Approximate memory used by events held in memory.
+  int64_t memoryUsed() const {
+    return (pending.size() + elist.size()) * sizeof(SeqEvent)
+      + all_events.memoryUsed();
+  }
+
+  /* Write the events held in memory to store as one run, and free them.
+     The run is already sorted and swept, so it is usually much smaller
+     than the raw events. Returns the number of bytes of memory freed. */
+  int64_t spill(SpillStore &store);
+
+  /* Read all of this sequence's runs back from store into memory,
+     merging them with any events still in memory. Saved events are
+     restored in the order they were added. */
+  void unspill(SpillStore &store);
+
+  // Read back just the saved events of the runs, leaving the rest in
+  // store to be read by a SpillMerge.
+  void unspillSavedEvents(SpillStore &store);
+
+  // location of each run of spilled events in a SpillStore
+  struct SpillRun {
+    int64_t seq_offset, all_offset;
+    size_t seq_count, all_count;
+  };
+  const std::vector<SpillRun>& spillRuns() const {return spill_runs;}
   
   bool validate();
-  void print();
+
+  // the -summary report for this sequence, which is rank's in file_name
+  void print(OutputWriter &out, std::string_view file_name, int rank);
 
   // join adjacent events with matching types
   void minimize();
 
   // remove all events
-  void clear() {elist.clear();}
+  void clear() {
+    elist.clear();
+    pending.clear();
+    all_events.clear();
+    spill_runs.clear();
+    events_added = 0;
+    patterns.reset();
+  }
 
-  size_t size() const {return elist.size();}
-  EventList::const_iterator begin() const {return elist.begin();}
-  EventList::const_iterator end() const {return elist.end();}
+  size_t size() const {build(); return elist.size();}
+  EventList::const_iterator begin() const {build(); return elist.begin();}
+  EventList::const_iterator end() const {build(); return elist.end();}
 
-  // sort the all_events vector by start_time
-  void sortAllEvents() {
-    // std::cout << "sorting " << all_events.size() << " events\n";
-    std::sort(all_events.begin(),
-              all_events.end(),
-              events_order_by_start_time);
-  }
-  
-  std::vector<Event>::const_iterator allBegin() const
-    {return all_events.begin();}
-  std::vector<Event>::const_iterator allEnd() const
-    {return all_events.end();}
+  // sort the saved events by start_time
+  void sortAllEvents() {all_events.sortByStartTime();}
+
+  const SavedEvents& savedEvents() const {return all_events;}
+  SavedEvents::const_iterator allBegin() const {return all_events.begin();}
+  SavedEvents::const_iterator allEnd() const {return all_events.end();}
 
 private:
   std::string name;
-  EventList elist;
+
+  // These are mutable so the const accessors can fold pending into elist.
+  mutable EventList elist;
+
+  // events added since elist was last built, in the order they were added
+  mutable EventList pending;
 
   // if save_all_events is true, save a copy of all events in all_events
   bool save_all_events;
-  std::vector<Event> all_events;
+  SavedEvents all_events;
+
+  int64_t events_added;
 
-  // Returns the first event in elist that overlaps e, or elist.end()
-  // if no event overlaps e.
-  EventList::iterator firstOverlapping(const SeqEvent &evt);
+  // created by the first event added, if track_patterns is set
+  struct Patterns {
+    AccessPattern read, write;
+    explicit Patterns(std::pmr::memory_resource *resource)
+      : read(resource), write(resource) {}
+  };
+  std::unique_ptr<Patterns> patterns;
+
+  std::vector<SpillRun> spill_runs;
 
-  // insert e.offset->e, and return an iterator to the destination
-  EventList::iterator insert(const SeqEvent &e) {
-    return elist.insert( std::pair<int64_t,SeqEvent> (e.offset, e) ).first;
+  // merge pending into elist
+  void build() const {
+    if (!pending.empty()) sortAndSweep();
   }
+
+  void sortAndSweep() const;
 };
 
 using EventSequencePtr = std::unique_ptr<EventSequence>;
 
 
-class LineReader {
-  long lines_read, next_report, report_freq;
+/* A running count of the lines and bytes read from all the inputs,
+   printed to stderr every report_freq lines if stderr is a terminal.
+   It can be shared by LineReaders reading inputs on different threads.
+*/
+class ReadProgress {
+  std::atomic<long> lines_read, next_report;
+  std::atomic<int64_t> bytes_read;
+  const long report_freq;
+  double start_time;
   bool do_report;
+  std::mutex print_lock;
+
+  void print(const char *end);
 
 public:
-  LineReader(long report_freq_) : lines_read(0), next_report(report_freq_),
-                                  report_freq(report_freq_) {
-    do_report = (isatty(STDERR_FILENO) == 1);
-  }
-
-  bool getline(std::istream &in, std::string &line) {
-    if (std::getline(in, line)) {
-      lines_read++;
-      if (do_report) {
-        if (lines_read >= next_report) {
-          std::cerr << "\r" << lines_read << " lines read";
-          std::cerr.flush();
-          next_report = lines_read + report_freq;
-        }
-      }
-      return true;
-    } else {
-      return false;
-    }
+  ReadProgress(long report_freq_);
+
+  void add(long lines, int64_t bytes);
+
+  // print the final count
+  void done();
+
+  long linesRead() const {return lines_read;}
+  int64_t bytesRead() const {return bytes_read;}
+};
+
+
+/* Reads an input file one line at a time, adding the number of lines and
+   bytes read to a ReadProgress. One LineReader can be reused for a series
+   of files with open() and close().
+
+   Regular files are mapped into memory, and getline() returns a view
+   directly into the mapping, so no bytes are copied. Stdin, pipes, and
+   anything else that can't be mapped is read in large blocks into a
+   buffer. Either way, the line returned by getline() (without its
+   trailing newline) is only valid until the next call to getline()
+   or close().
+*/
+class LineReader {
+  ReadProgress &progress;
+
+  // lines and bytes not yet added to progress
+  long uncounted_lines;
+  int64_t uncounted_bytes;
+
+  int fd;
+
+  // memory-mapped file, or nullptr if the file is being read in blocks
+  char *map_base;
+  size_t map_len;
+
+  // block-buffered input: buf[buf_pos..buf_end) has not been returned yet
+  static const size_t BLOCK_SIZE = 4 * 1024 * 1024;
+  std::vector<char> buf;
+  size_t buf_pos, buf_end;
+  bool at_eof;
+
+  // Reading a file as it is written (see open()). If growing is true,
+  // the input is a regular file, so reaching its end isn't the end.
+  bool follow, growing;
+
+  // unread part of the mapped file: [map_pos, map_end)
+  const char *map_pos, *map_end;
+
+  // if the input is compressed, buf is filled from this rather than fd
+  std::unique_ptr<Decompressor> decompressor;
+
+  // Pages before this have been released with madvise(MADV_DONTNEED),
+  // so a large input doesn't stay resident after it has been parsed.
+  size_t map_released;
+  static const size_t RELEASE_SIZE = 64 * 1024 * 1024;
+
+  // fill buf with more data, keeping the unreturned part.
+  // Returns false on EOF or error.
+  bool fillBuffer();
+
+  // Start decompressing the open file; anything in buf is its first bytes.
+  bool startDecompressor(Decompressor::Format format,
+                         const std::string &filename);
+
+  void countLine(size_t len) {
+    uncounted_bytes += len;
+    if (++uncounted_lines == 1024) flushCount();
   }
 
-  void done() {
-    if (do_report) {
-      std::cerr << "\r" << lines_read << " lines read" << std::endl;
-    }
+  void flushCount() {
+    progress.add(uncounted_lines, uncounted_bytes);
+    uncounted_lines = 0;
+    uncounted_bytes = 0;
   }
+
+public:
+  LineReader(ReadProgress &progress_);
+  ~LineReader() {close();}
+
+  /* Opens a file, or stdin if filename is "-". If it is compressed with
+     gzip (or zstd, if supported), it is decompressed on another thread.
+     Returns false on error.
+
+     If follow is true, the input is read as it is written, like
+     "tail -f". When getline() has returned everything written so far,
+     it returns false without returning a partial last line, and it can
+     be called again later to get more. eof() is true once the input has
+     really ended, which only happens for a pipe. Compressed input can't
+     be followed. */
+  bool open(const std::string &filename, bool follow = false);
+  void close();
+
+  bool eof() const {return at_eof;}
+
+  bool getline(std::string_view &line);
+
+  /* Look at the first len bytes that have not been returned yet, without
+     consuming them. data may be shorter than len at the end of the file. */
+  void peek(size_t len, std::string_view &data);
+
+  /* Return all of the rest of the file at once. For inputs that can't be
+     mapped, this reads the rest of the input into memory. */
+  void readAll(std::string_view &data);
+
+  /* Read only bytes [start, end) of the open file, which is only possible
+     if it was mapped (an uncompressed regular file). Returns false if it
+     wasn't, or if the range is not within the file. */
+  bool setRange(size_t start, size_t end);
 };
     
 
 
+/* A set of byte ranges, kept as disjoint, non-adjacent [start,end)
+   intervals in order. Used to remember which parts of a file have
+   changed since it was last scanned (the -follow option). */
+class IntervalSet {
+public:
+  // start -> end
+  using Map = std::map<int64_t,int64_t>;
+
+  // add start..end-1, joining it with any intervals it overlaps or touches
+  void add(int64_t start, int64_t end);
+
+  bool empty() const {return intervals.empty();}
+  void clear() {intervals.clear();}
+  size_t size() const {return intervals.size();}
+
+  Map::const_iterator begin() const {return intervals.begin();}
+  Map::const_iterator end() const {return intervals.end();}
+
+private:
+  Map intervals;
+};
+
+
+/* One copy of each distinct string, kept in large blocks that are never
+   freed, so the many Files of a trace can refer to their names with a
+   string_view rather than each allocating its own copy. Each string is
+   followed by a NUL. It may be used from several threads. */
+class StringPool {
+public:
+  // the pool that holds file names
+  static StringPool& global();
+
+  // Return the pool's copy of s, adding it if it isn't there yet.
+  std::string_view intern(std::string_view s);
+
+private:
+  static const size_t BLOCK_SIZE = 64 * 1024;
+
+  std::mutex lock;
+  std::vector<std::unique_ptr<char[]>> blocks;
+  size_t block_used = 0, block_size = 0;  // of blocks.back()
+  std::unordered_set<std::string_view> strings;
+};
+
+
 class File {
 public:
-  const std::string id;  // a hash of the filename generated by Darshan
-  const std::string name;
+  /* For Darshan input, the 64-bit hash of the full path that Darshan
+     generates. Use it rather than the path, because the path is often
+     truncated in Darshan, leading to collisions that the hash avoids.
+     strace logs have no such id, so pathId() is used instead. */
+  const uint64_t id;
+  const std::string_view name;  // in StringPool::global()
   bool save_all_events;
 
+  /* True if id came from pathId(name) rather than from the trace. If
+     another path had the same hash, id may be a later one, depending on
+     which path was seen first, so such files are matched by name. See
+     FileTableType::getPathFile(). */
+  bool id_from_path = false;
+
+  /* Holds rank_seq and all of its events. The sequences are only ever
+     touched by one thread at a time, so it needs no locking. Small
+     allocations, like the map's nodes and the event lists of ranks with
+     few events, are carved out of larger chunks, and release() returns
+     all of them at once. Larger blocks come straight from the heap, so
+     the memory of growing vectors can be reused. */
+  std::pmr::unsynchronized_pool_resource arena;
+  static const size_t ARENA_LARGEST_POOL_BLOCK = 256;
+
   // rank -> EventSequence
   // this stores one EventSequence for each rank that accessed the file
-  using RankSeqMap = std::map<int,EventSequence>;
+  using RankSeqMap = std::pmr::map<int,EventSequence>;
   
   RankSeqMap rank_seq;
 
-  File(const std::string &id_, const std::string &name_,
-       bool save_all_events_) : id(id_), name(name_),
-                                save_all_events(save_all_events_) {}
+  // if not null, memory used by new events is counted here
+  SpillStore *spill_store;
+
+  // Counts for the -stats option. These are kept after the events
+  // themselves are released.
+  struct Stats {
+    bool loaded;
+    // total size of the ranks' EventLists when first loaded
+    int64_t list_size_before_minimize, list_size_after_minimize;
+    int64_t subranges, conflicts;
+    // (rank, number of events added) for each rank
+    std::vector<std::pair<int,int64_t>> rank_events;
+
+    Stats() : loaded(false), list_size_before_minimize(0),
+              list_size_after_minimize(0), subranges(0), conflicts(0) {}
+  } stats;
+
+  File(uint64_t id_, std::string_view name_,
+       bool save_all_events_, SpillStore *spill_store_ = nullptr)
+    : id(id_), name(StringPool::global().intern(name_)),
+      save_all_events(save_all_events_),
+      arena(std::pmr::pool_options{0, ARENA_LARGEST_POOL_BLOCK}),
+      rank_seq(&arena), spill_store(spill_store_) {}
+
+  // 64-bit FNV-1a hash of a path, the id of a file read from strace
+  static uint64_t pathId(std::string_view path) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : path) {
+      h ^= (unsigned char) c;
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
 
   EventSequence& getEventSequence(int rank) {
     auto it = rank_seq.find(rank);
@@ -418,56 +1081,379 @@ public:
     }
   }
 
+  /* For -throughput. If throughput_bins is nonzero, events are only
+     counted in a histogram for each rank, or for all ranks (with the key
+     -1) if throughput_by_rank is false, and not otherwise kept. */
+  static int throughput_bins;
+  static bool throughput_by_rank;
+  std::map<int,ThroughputHistogram> throughput;
+
+  /* For -follow. If track_changes is true, the bytes covered by each
+     event added (rounded out to Event::block_size) are added to changed,
+     so they can be rescanned. */
+  static bool track_changes;
+  IntervalSet changed;
+
+  /* For the MPI build (mpi_analysis.cc). If event_sink is set, the events
+     added are only passed to it, in the order they were read, to be sent
+     to the process that scans this file. */
+  using EventSink = std::function<void(File&, const Event&)>;
+  static EventSink event_sink;
+
   void addEvent(const Event &e) {
+    if (throughput_bins) {
+      countThroughput(e);
+      return;
+    }
+    if (event_sink) {
+      event_sink(*this, e);
+      return;
+    }
     EventSequence &seq = getEventSequence(e.rank);
     seq.addEvent(e);
+    if (track_changes && e.length > 0) {
+      changed.add(Event::blockStart(e.offset),
+                  Event::blockEnd(e.endOffset() - 1) + 1);
+    }
+    if (spill_store) {
+      spill_store->addMemory(sizeof(SeqEvent)
+                             + (save_all_events
+                                ? SavedEvents::BYTES_PER_EVENT : 0));
+    }
+  }
+
+  // Move all the events from another File with the same id into this one.
+  // If other has spilled events, store must be the SpillStore they are in.
+  void merge(File &other, SpillStore *store = nullptr);
+
+  void countThroughput(const Event &e);
+
+  // Spill all of this file's events.
+  void spill(SpillStore &store) {
+    int64_t freed = 0;
+    for (auto &it : rank_seq) freed += it.second.spill(store);
+    store.addMemory(-freed);
+  }
+
+  // Bring this file's events back into memory, minimize each rank's
+  // sequence, and sort its saved events. store may be null.
+  void load(SpillStore *store);
+
+  /* Like load(), but the events of ranks with spilled runs are left in
+     store, to be merged as RangeMerge reads them (see SpillMerge). Only
+     their saved events are brought back. Returns the Stats that merge
+     should add their list sizes to, or null if this isn't the first
+     load. */
+  Stats *loadForScan(SpillStore *store);
+
+  // Free all of this file's events, and the memory of its arena, after
+  // it has been scanned. Its stats are kept. If store isn't null, the
+  // events are no longer counted in it.
+  void release(SpillStore *store = nullptr) {
+    if (store) {
+      for (auto &it : rank_seq) store->addMemory(-it.second.memoryUsed());
+    }
+    rank_seq.clear();
+    arena.release();
+  }
+};
+
+
+/* Every File that has been read, found by its id.
+
+   The Files are kept in a vector in the order they were added, and an
+   open-addressed hash table of indexes into it maps the ids, so a lookup
+   is a multiply and a probe or two with no string compares. Iterating
+   gives the unique_ptrs in the order they were added; use byName() where
+   the order shows in the output. */
+class FileTableType {
+public:
+  using Files = std::vector<std::unique_ptr<File>>;
+
+  // Returns null if no File has this id.
+  File *find(uint64_t id) const {
+    if (slots.empty()) return nullptr;
+    size_t mask = slots.size() - 1;
+    for (size_t i = mix(id) & mask; slots[i]; i = (i + 1) & mask) {
+      File *f = files[slots[i] - 1].get();
+      if (f->id == id) return f;
+    }
+    return nullptr;
+  }
+
+  // Add a File whose id isn't in the table yet. Returns it.
+  File *add(std::unique_ptr<File> f);
+
+  /* The File for a path from a trace with no file ids, added if it is
+     new. Its id is pathId(name), or in the unlikely case that another
+     path already has that id, the next unused one. */
+  File *getPathFile(std::string_view name, bool save_all_events,
+                    SpillStore *spill_store);
+
+  // Add f, or if there is already a File with its id (or for a file with
+  // id_from_path, its name), merge f into it. If f has spilled events,
+  // store must be the SpillStore they are in.
+  void merge(std::unique_ptr<File> f, SpillStore *store = nullptr);
+
+  // Move or merge every File of other into this table, leaving it empty.
+  void merge(FileTableType &other, SpillStore *store = nullptr);
+
+  // the Files, ordered by name and then id
+  std::vector<File*> byName() const;
+
+  size_t size() const {return files.size();}
+  bool empty() const {return files.empty();}
+  void clear() {
+    files.clear();
+    slots.clear();
+  }
+
+  Files::iterator begin() {return files.begin();}
+  Files::iterator end() {return files.end();}
+  Files::const_iterator begin() const {return files.begin();}
+  Files::const_iterator end() const {return files.end();}
+
+  /* Which of n_shards parts of a table f goes in, when Files are split
+     between threads or processes. The high bits of mix() are used, since
+     the slots use the low bits, and a file with id_from_path goes by its
+     name, so it lands in the same shard whatever id it was given. */
+  static size_t shard(const File &f, size_t n_shards) {
+    uint64_t id = f.id_from_path ? File::pathId(f.name) : f.id;
+    return (mix(id) >> 32) % n_shards;
+  }
+
+  // Scrambles the bits of an id, for the hash table and for sharding.
+  static uint64_t mix(uint64_t id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdull;
+    id ^= id >> 33;
+    return id;
+  }
+
+  // For checkMemoryLimit(), the number of events to add before the next
+  // check.
+  static const int64_t SPILL_BATCH_EVENTS = 4096;
+  int64_t spill_countdown = 0;
+
+private:
+  Files files;
+
+  // 1 + the index in files of each File, or 0 for an empty slot.
+  // The size is a power of two, and at most half the slots are full.
+  std::vector<uint32_t> slots;
+
+  void insertSlot(uint32_t file_no);
+};
+
+// If the memory limit has been reached, spill every file in file_table.
+// Call it after adding each event; after a spill it waits a batch of
+// events before looking again.
+void checkMemoryLimit(FileTableType &file_table, SpillStore *spill_store);
+
+
+/* Folds the POSIX events made by an MPI-IO call into the event for that
+   call. Darshan logs each X_MPIIO call and also the X_POSIX calls it
+   generates, so otherwise every byte would be counted twice.
+
+   The two modules are in separate sections of a log, so events are held
+   here until the whole log has been read. Then the events of each rank
+   of each file are swept in order of start time, and a POSIX event is
+   merged into an MPI event whose byte range and time span contain it.
+   Whatever is left is added to the files in the order it was read.
+
+   The events held are counted in the SpillStore, if there is one, and
+   when it is over its limit they are written to it, so only one rank of
+   one file at a time needs to be in memory. */
+class ParentEventMerger {
+public:
+  explicit ParentEventMerger(SpillStore *spill_store_ = nullptr)
+    : spill_store(spill_store_) {}
+
+  void addEvent(File *f, const Event &e) {
+    pending[{f, e.rank}].events.push_back(e);
+    if (spill_store) {
+      spill_store->addMemory(sizeof(Event));
+      held_bytes += sizeof(Event);
+      // don't write tiny pieces when the files are what fill memory
+      if (held_bytes >= MIN_SPILL_BYTES && spill_store->overLimit()) spill();
+    }
   }
+
+  // Merge and add everything to the files, then clear.
+  // Returns the number of POSIX events folded into a parent.
+  int64_t flush(FileTableType &file_table);
+
+  // Remove every POSIX event from events that has an MPI parent in events,
+  // merging it into the parent. All the events must be from one rank.
+  // Returns the number of events removed.
+  static int64_t mergeChildren(std::vector<Event> &events);
+
+private:
+  static const int64_t MIN_SPILL_BYTES = 1 << 20;
+
+  SpillStore *spill_store;
+  int64_t held_bytes = 0;  // in memory, in all the Pending lists
+
+  struct Pending {
+    // (offset in spill_store, count) of the events spilled, which come
+    // before the events still in memory
+    std::vector<std::pair<int64_t,size_t>> spilled;
+    std::vector<Event> events;
+  };
+  std::map<std::pair<File*,int>, Pending> pending;
+
+  // write every event in memory to spill_store
+  void spill();
+};
+
+
+/* Reads the events of an EventSequence with spilled runs in order of
+   offset, as load() would leave them, without bringing the runs back into
+   memory. Each run is read CHUNK_EVENTS at a time, and the runs and the
+   events still in memory are merged, swept, and minimized as they are
+   read. Each run is already sorted, so this is the merge phase of an
+   external sort, and a scan only needs a chunk of each run in memory. */
+class SpillMerge {
+public:
+  // If stats isn't null, the list sizes are added to it at the end.
+  SpillMerge(const EventSequence &seq, SpillStore &store,
+             File::Stats *stats = nullptr);
+
+  // Set e to the next event. Returns false if there are none left.
+  bool next(SeqEvent &e);
+
+private:
+  static const size_t CHUNK_EVENTS = 4096;
+
+  SpillStore &store;
+  File::Stats *stats;
+
+  struct Run {
+    int64_t offset = 0;    // in store of the events not read yet
+    size_t remaining = 0;  // number of events not read yet
+    EventSequence::EventList chunk;
+    EventSequence::EventList::const_iterator it, end;
+  };
+  // the spilled runs, and then the events in memory
+  std::vector<Run> runs;
+
+  // (offset of the next event, index in runs) of each run with events left
+  using RunHead = std::pair<int64_t, size_t>;
+  std::priority_queue<RunHead, std::vector<RunHead>, std::greater<RunHead>>
+    heads;
+
+  MinimizingSweep sweep;
+  bool finished = false;
+
+  // read the next chunk of run
+  void readChunk(Run &run);
 };
 
 
+/* The events of one rank's EventSequence in order of offset, for
+   RangeMerge. The sequence keeps the mode of every byte; with -blocksize,
+   the events are rounded out to whole blocks here and swept together, so
+   each block gets one mode for the rank, as BlockConflictCounter gives it:
+   WRITE if the rank wrote any byte of it without reading that byte. */
 class RankSeq {
   const int rank_;
   EventSequence::EventList::const_iterator it_, end_;
 
+  // if the sequence has spilled runs, its events are read from here
+  std::unique_ptr<SpillMerge> spill_merge_;
+
+  // with -blocksize, the events rounded out to blocks go through here
+  std::unique_ptr<MinimizingSweep> blocks_;
+  bool source_done_ = false;
+
+  // If either of those is used, the events are produced one at a time
+  // into event_, and it_ isn't the current event.
+  bool streamed_ = false;
+  SeqEvent event_;
+  bool done_ = false;
+
+  // offset() and endOffset() are clipped to this range
+  int64_t clip_start = INT64_MIN, clip_end = INT64_MAX;
+
+  // offset() and endOffset() of the current event, since the queues in
+  // RangeMerge compare them constantly
+  int64_t offset_, end_offset_;
+
+  void loadOffsets() {
+    if (done()) {
+      offset_ = end_offset_ = INT64_MAX;
+    } else {
+      offset_ = std::max(event().offset, clip_start);
+      end_offset_ = std::min(event().endOffset(), clip_end);
+    }
+  }
+
+  // Read the next event of the sequence itself. Returns false at the end.
+  bool readSource(SeqEvent &e) {
+    if (spill_merge_) return spill_merge_->next(e);
+    if (it_ == end_) return false;
+    e = *it_++;
+    return true;
+  }
+
+  // Set event_ to the next event, and done_ if there are none left.
+  void readStreamed();
+
+  // Set up the streamed modes and read the first event.
+  void start(EventSequence &seq, SpillStore *store, File::Stats *stats);
+
 public:
 
   // RankSeqIter
-  RankSeq(File::RankSeqMap::const_iterator it) : rank_(it->first) {
-    const EventSequence &seq = it->second;
-    it_ = seq.begin();
-    end_ = seq.end();
+  RankSeq(File::RankSeqMap::iterator it) : RankSeq(it->first, it->second) {}
+
+  // If seq has spilled runs, store is the SpillStore they are in, and
+  // stats is passed to their SpillMerge.
+  RankSeq(int rank, EventSequence &seq, SpillStore *store = nullptr,
+          File::Stats *stats = nullptr) : rank_(rank) {
+    start(seq, store, stats);
   }
-  
-  RankSeq(int rank, EventSequence &seq) : rank_(rank) {
-    it_ = seq.begin();
-    end_ = seq.end();
+
+  // Only the parts of the events of seq within start..end-1. seq can't
+  // have spilled runs. With -blocksize, start and end must be on block
+  // boundaries.
+  RankSeq(int rank, EventSequence &seq, int64_t start_, int64_t end)
+    : rank_(rank), clip_start(start_), clip_end(end) {
+    assert(seq.spillRuns().empty());
+    auto ends_before = [start_](const SeqEvent &e) {
+      return e.endOffset() <= start_;
+    };
+    auto starts_before = [end](const SeqEvent &e) {return e.offset < end;};
+    it_ = std::partition_point(seq.begin(), seq.end(), ends_before);
+    end_ = std::partition_point(it_, seq.end(), starts_before);
+    if (Event::block_size > 1) {
+      blocks_.reset(new MinimizingSweep(true));
+      streamed_ = true;
+      readStreamed();
+    }
+    loadOffsets();
   }
   
   int rank() const {return rank_;}
-  bool done() const {return it_ == end_;}
+  bool done() const {return streamed_ ? done_ : it_ == end_;}
   bool next() {
     if (done()) return false;
-    it_++;
-    return !done();
-  }
-  const SeqEvent &event() const {return it_->second;}
-
-  int64_t offset() const {
-    if (done()) {
-      return INT64_MAX;
+    if (streamed_) {
+      readStreamed();
     } else {
-      return event().offset;
+      it_++;
     }
+    loadOffsets();
+    return !done();
   }
-
-  int64_t endOffset() const {
-    if (done()) {
-      return INT64_MAX;
-    } else {
-      return event().endOffset();
-    }
+  const SeqEvent &event() const {
+    return streamed_ ? event_ : *it_;
   }
 
+  // INT64_MAX when done
+  int64_t offset() const {return offset_;}
+  int64_t endOffset() const {return end_offset_;}
+
   struct OrderByOffset {
     bool operator() (RankSeq *a, RankSeq *b) {
       return a->offset() > b->offset();
@@ -501,6 +1487,9 @@ public:
    Starting after the first call to next(), the user can query the bounds
    of the current range with getRangeStart() and getRangeEnd(), and the
    user can query the set of ranks and their modes with getActiveSet().
+   The number of active ranks with each mode is kept up to date as ranks
+   enter and leave, so checking a range for a conflict doesn't need to
+   look at the active set at all.
 */
 class RangeMerge {
 public:
@@ -512,15 +1501,26 @@ private:
 
   // rank -> Event::Mode
   ActiveSet active_set;
+
+  // number of ranks in active_set with each Event::Mode
+  int mode_count[3];
   
   std::priority_queue<RankSeq*, std::vector<RankSeq*>, RankSeq::OrderByOffset>
     incoming_queue;
   std::priority_queue<RankSeq*, std::vector<RankSeq*>, RankSeq::OrderByEndOffset>
     outgoing_queue;
-  
+
+  // queue up the ranks that have events
+  void init();
   
 public:
-  RangeMerge(File::RankSeqMap &rank_sequences);
+  // If some of the sequences have spilled runs, store is the SpillStore
+  // they are in, and stats is passed to their SpillMerges.
+  RangeMerge(File::RankSeqMap &rank_sequences, SpillStore *store = nullptr,
+             File::Stats *stats = nullptr);
+
+  // Only merge the parts of the sequences within start..end-1.
+  RangeMerge(File::RankSeqMap &rank_sequences, int64_t start, int64_t end);
 
   // move to the next range. Returns false iff there are no more ranges.
   bool next();
@@ -528,11 +1528,351 @@ public:
   int64_t getRangeStart() {return range_start;}
   int64_t getRangeEnd() {return range_end;}
   const ActiveSet& getActiveSet() {return active_set;}
+
+  // number of active ranks with the given mode
+  int getModeCount(Event::Mode mode) const {return mode_count[mode];}
+
+  // More than one rank is accessing the current range, and one of them
+  // is writing.
+  bool isConflict() const {
+    return active_set.size() > 1 && mode_count[Event::WRITE] > 0;
+  }
 };
 
 
-// map (pid,fd) to a file currently open on that processes
-using OpenFileMap = std::map< std::pair<int,int> , File*>;
+/* An index of all the saved events of one file, for finding the events
+   that overlap a range of bytes (the -audit option) without looking at
+   every event.
+
+   The events are sorted by offset, and form an implicit balanced binary
+   tree: the element at the middle of the array is the root, and so on
+   down, like a binary search. Each element also holds the largest end
+   offset in its subtree, so a query can skip any subtree that ends before
+   the range it is looking for. A query visits O(log n + m) elements,
+   where m is the number of matches.
+
+   Each element remembers its position in the original order of the
+   events (by rank, then in the order they were saved), so the matches
+   can be listed in exactly the order a scan of every event would give.
+   That position is all it holds besides the largest end offset; the
+   event's own offsets are read from the saved events, so the index
+   takes 16 bytes per event.
+*/
+class EventIndex {
+public:
+  EventIndex(const File::RankSeqMap &rank_sequences);
+
+  /* Set matches to every event that overlaps offset..offset_end-1,
+     sorted by start time. Events with the same start time are in the
+     order of the original events. */
+  void findOverlapping(int64_t offset, int64_t offset_end,
+                       std::vector<Event> &matches) const;
+
+private:
+  struct Node {
+    // the largest end offset in this node's subtree, or while the nodes
+    // are sorted, the offset of the node's event
+    int64_t max_end;
+    // the event is sequences[seq_no][event_no]; these also give the
+    // original order
+    uint32_t seq_no, event_no;
+  };
+
+  std::vector<const SavedEvents*> sequences;
+
+  int64_t nodeOffset(const Node &node) const {
+    return sequences[node.seq_no]->offset(node.event_no);
+  }
+  int64_t nodeEnd(const Node &node) const {
+    return sequences[node.seq_no]->endOffset(node.event_no);
+  }
+
+  // sorted by offset
+  std::vector<Node> nodes;
+
+  // the root is at index (1 << max_level) - 1
+  int max_level;
+
+  void buildTree();
+};
+
+
+/* Counts conflicts at every power-of-two block size in a range, from the
+   subranges of a single RangeMerge sweep (the -blocksizes option).
+
+   At block size b, a block is in conflict if more than one rank accessed
+   some byte of it and at least one of them is a writer. As in
+   RangeMerge::isConflict(), a rank is a writer only if it wrote some
+   byte of the block without also reading that byte (READ_WRITE doesn't
+   count), so at b = 1 the blocks are the bytes the scan reports. For
+   each block size this counts the blocks in conflict, and the distinct
+   pairs of ranks that conflict, where at least one of the pair is a
+   writer.
+
+   Subranges must be added in increasing order of offset. A subrange that
+   spans many blocks is handled in constant time per block size: only
+   the blocks at either end can be shared with other subranges.
+*/
+class BlockConflictCounter {
+public:
+  // min_block_size is rounded up to a power of two
+  BlockConflictCounter(int64_t min_block_size, int64_t max_block_size);
+
+  void add(int64_t start, int64_t end, const RangeMerge::ActiveSet &active);
+
+  // Finish the last blocks, and print a table of the counts.
+  void print(OutputWriter &out, std::string_view file_name);
+
+private:
+  // (rank, mode) sorted by rank. Usually only a few ranks are active,
+  // so this is much cheaper to copy and merge than a map.
+  using RankModes = std::vector<std::pair<int,Event::Mode>>;
+
+  struct Level {
+    int shift;  // block size is 1 << shift
+    int64_t block;  // index of the current block, or -1 if none
+    RankModes ranks;  // ranks that accessed the current block
+    int64_t conflict_blocks;
+    std::set<std::pair<int,int>> rank_pairs;
+  };
+  std::vector<Level> levels;
+
+  // the active set of the subrange being added
+  RankModes active_ranks;
+  RankModes merge_buf;
+
+  // add the ranks in active_ranks to the current block of level
+  void mergeRanks(Level &level);
+
+  // count the current block of level if it is in conflict
+  void finishBlock(Level &level);
+
+  // If ranks conflict, count n_blocks conflicting blocks and record
+  // the conflicting pairs.
+  void countConflict(Level &level, const RankModes &ranks, int64_t n_blocks);
+};
+
+
+/* Totals the conflicts of one file by pair of ranks, for -report matrix
+   and -report topk, rather than printing every conflicting subrange.
+
+   Two ranks conflict where both accessed the same bytes and, as in
+   RangeMerge::isConflict(), at least one of the two only wrote them (a
+   READ_WRITE rank, which read and wrote the same bytes, isn't a writer
+   by itself). This depends only on the two ranks, so other ranks that
+   accessed the same bytes don't change a pair's counts. Adjacent bytes
+   where a pair conflicts with the same modes are one conflict.
+
+   Each conflict is also split by the order of the accesses, from the
+   saved events (so, as for -audit, the file must save all its events).
+   Every event of one rank that overlaps an event of the other in the
+   conflict, where at least one of them is a write, is a write after
+   write (WAW) if both are writes, and otherwise a read after write (RAW)
+   if the read started no earlier than the write, or else a write after
+   read (WAR). The bytes where such events overlap are counted for that
+   type, so a conflict accessed more than once can have several types.
+
+   The totals for the file join adjacent conflicting subranges with the
+   same ranks in the same modes, as the detailed report lists them.
+*/
+class RankPairMatrix {
+public:
+  enum Type {RAW, WAR, WAW, N_TYPES};
+
+  struct Counts {
+    int64_t conflicts = 0, bytes = 0;
+    // the conflicts with some bytes of each Type, and those bytes
+    int64_t type_conflicts[N_TYPES] = {0, 0, 0};
+    int64_t type_bytes[N_TYPES] = {0, 0, 0};
+  };
+
+  // (lower rank, higher rank) -> counts
+  using PairMap = std::map<std::pair<int,int>, Counts>;
+
+  // The saved events of rank_seq are indexed when the first conflict is
+  // counted.
+  explicit RankPairMatrix(const File::RankSeqMap &rank_seq_)
+    : rank_seq(rank_seq_) {}
+
+  // Add a conflicting subrange. They must be added in increasing order
+  // of offset.
+  void add(int64_t start, int64_t end, const RangeMerge::ActiveSet &active);
+
+  // number of conflicts in the file, after joining adjacent subranges
+  int64_t conflicts() {finish(); return n_conflicts;}
+
+  const PairMap& pairs() {finish(); return pair_counts;}
+
+  // Print the counts for every pair of ranks in conflict, or if top_k
+  // is nonzero, only the top_k pairs with the most bytes in conflict.
+  void print(OutputWriter &out, std::string_view file_name,
+             int top_k = 0);
+
+private:
+  const File::RankSeqMap &rank_seq;
+  std::unique_ptr<EventIndex> index;
+
+  PairMap pair_counts;
+  int64_t n_conflicts = 0, conflict_bytes = 0;
+
+  // the conflict of the file being extended, if start < end
+  int64_t start = 0, end = 0;
+  RangeMerge::ActiveSet ranks;
+
+  // the conflict of each pair being extended
+  struct PairConflict {
+    int64_t start, end;
+    Event::Mode mode, other_mode;
+  };
+  std::map<std::pair<int,int>, PairConflict> open_conflicts;
+
+  // the events overlapping query_start..query_end-1, by rank
+  int64_t query_start = 0, query_end = 0;
+  std::vector<Event> matches;
+  std::map<int,std::vector<Event>> matches_by_rank;
+
+  // count every conflict being extended
+  void finish();
+
+  void countPairConflict(const std::pair<int,int> &pair,
+                         const PairConflict &conflict);
+};
+
+
+// What a file descriptor refers to. Descriptors made with dup() share
+// one, including the file position.
+struct OpenFile {
+  File *file;
+  int64_t position;
+};
+
+// map (pid,fd) to the file currently open on it in that process
+using OpenFileMap = std::unordered_map<uint64_t, std::shared_ptr<OpenFile>>;
+
+inline uint64_t openFileKey(int pid, int fd) {
+  return ((uint64_t)(uint32_t)pid << 32) | (uint32_t)fd;
+}
+
+
+/* Parses the lines of a strace log (after its header line) and adds the
+   events to a FileTableType. It keeps track of the open file descriptors
+   of each process, so a log can be fed to it a few lines at a time as it
+   is written (the -follow option). */
+class StraceReader {
+public:
+  // save_all_events: keep a copy of all events
+  // spill_store: if not null, spill events to it when memory runs low
+  StraceReader(FileTableType &file_table, const std::string &input_filename,
+               bool save_all_events, SpillStore *spill_store);
+
+  void addLine(std::string_view line);
+
+private:
+  FileTableType &file_table;
+  const std::string input_filename;
+  const bool save_all_events;
+  SpillStore *spill_store;
+  long line_no;  // for error messages
+  OpenFileMap open_files;
+
+  // the most recent read or write, since they often repeat
+  uint64_t last_key;
+  OpenFile *last_open;
+
+  void error(const char *message, std::string_view line);
+
+  // the File for a path, created if it's new
+  File *getFile(std::string_view name, bool save_all);
+
+  // Find what fd refers to in pid. Standard streams are open if they
+  // haven't been closed.
+  OpenFile *findOpenFile(int pid, int fd);
+};
+
+
+// the first line of darshan-parser output
+extern std::string DARSHAN_HEADER;
+
+// Read one input file, detecting its format from the first line.
+// Returns false if the file could not be read.
+bool readInputFile(const std::string &filename, LineReader &line_reader,
+                   FileTableType &file_table, const Options &opt,
+                   SpillStore *spill_store);
+
+// Read the sections of darshan-parser output, after the header line.
+// save_all_events: keep a copy of all events
+// spill_store: if not null, spill events to it when memory runs low
+int readDarshanDxtInput(LineReader &line_reader, FileTableType &file_table,
+                        bool output_per_rank_summary, bool save_all_events,
+                        SpillStore *spill_store);
+
+// Load a file's events, report its conflicts to out, and release them.
+void scanFile(File *f, const Options &opt, SpillStore *spill_store,
+              OutputWriter &out);
+
+/* The reports of a list of files, written on several threads in any
+   order and read back in order. Each report arrives in pieces, as the
+   OutputWriter of its scan fills (see sink()), so a report can be read
+   while it is still being written. A piece waits in memory while fewer
+   than max_held bytes of pieces do and spill_store isn't over its limit.
+   Otherwise it waits in spill_store, or in a temporary file of its own if
+   there is no spill_store. Pieces waiting in memory are counted in
+   spill_store. */
+class ReportQueue {
+public:
+  // max_held for each thread writing reports, a few pieces each
+  static const int64_t HELD_PER_THREAD = 4 << 20;
+
+  ReportQueue(size_t count, int64_t max_held, SpillStore *spill_store);
+
+  // A sink for the OutputWriter of report i. Any thread may use it.
+  OutputWriter::Sink sink(size_t i) {
+    return [this, i](std::string_view piece) {append(i, piece);};
+  }
+
+  // Add a piece to the end of report i.
+  void append(size_t i, std::string_view piece);
+
+  // Report i is complete.
+  void finish(size_t i);
+
+  // Wait for the next piece of report i and move it into piece. Returns
+  // false once the report is finished and every piece has been read.
+  // The reports must be read in order.
+  bool next(size_t i, std::string &piece);
+
+  // The length of report i, which must be finished.
+  int64_t length(size_t i) const {return reports[i].length;}
+
+private:
+  struct Piece {
+    std::string text;
+    int64_t offset = -1;  // in the store, if it was written there
+    size_t length = 0;
+  };
+  struct Report {
+    std::vector<Piece> pieces;
+    size_t n_read = 0;
+    int64_t length = 0;
+    bool finished = false;
+  };
+  std::vector<Report> reports;
+  const int64_t max_held;
+  int64_t held = 0;
+
+  SpillStore *spill_store;
+  std::unique_ptr<SpillStore> own_store;
+  bool own_store_failed = false;
+
+  std::mutex lock;
+  std::condition_variable piece_ready;
+
+  // With lock held, the store for pieces that aren't held in memory, or
+  // null if the temporary file can't be created.
+  SpillStore *store();
+};
 
+// the CSV header rows of every record type; nothing in the other formats
+void writeRecordHeaders(OutputWriter &out);
 
 #endif // DARSHAN_DXT_CONFLICTS_HH
@@ -0,0 +1,355 @@
+/*
+  Decoder for the DXT modules of binary Darshan logs.
+
+  Layout of a Darshan 3.2 log (all integers in the byte order of the
+  machine that wrote it):
+
+    header (360 bytes)
+      char     version[8]         "3.21"
+      int64    magic              DARSHAN_MAGIC
+      uint32   comp_type          0=zlib, 1=bzip2, 2=none
+      uint32   partial_flag
+      {uint64 off, uint64 len}    name_map
+      {uint64 off, uint64 len}    mod_map[16]
+      uint32   mod_ver[16]
+    job record, exe name, mount table (compressed, ignored here)
+    name records (compressed): {uint64 id, char name[] NUL-terminated}
+    one compressed region for each module
+
+  A DXT module is a sequence of records, each followed by its write
+  segments and then its read segments:
+
+    record (104 bytes)
+      uint64   id                 hash of the file name
+      int64    rank
+      int64    shared
+      char     hostname[64]
+      int64    write_count
+      int64    read_count
+    segment (32 bytes)
+      int64    offset
+      int64    length
+      double   start_time
+      double   end_time
+
+  A compressed region may hold several concatenated zlib streams, because
+  the runtime compresses data in chunks.
+*/
+
+#include "darshan_log.hh"
+#include <zlib.h>
+
+using namespace std;
+
+
+static const int64_t DARSHAN_MAGIC = 6567223;
+static const size_t HEADER_SIZE = 360;
+static const size_t NAME_MAP_POS = 24;
+static const size_t MOD_MAP_POS = 40;
+static const size_t DXT_RECORD_SIZE = 104;
+static const size_t DXT_SEGMENT_SIZE = 32;
+
+enum CompressionType {COMP_ZLIB = 0, COMP_BZIP2 = 1, COMP_NONE = 2};
+
+// module ids of Darshan 3.2 and later
+enum ModuleId {DXT_POSIX_MOD = 9, DXT_MPIIO_MOD = 10};
+
+
+/* Reads fixed-size fields out of a byte buffer, swapping their byte order
+   if the log was written on a machine with the other byte order. */
+class FieldReader {
+  const char *data;
+  bool swap;
+
+public:
+  FieldReader(const char *data_, bool swap_) : data(data_), swap(swap_) {}
+
+  template<class T>
+  T get(size_t pos) const {
+    T value;
+    if (swap) {
+      char bytes[sizeof(T)];
+      for (size_t i = 0; i < sizeof(T); i++)
+        bytes[i] = data[pos + sizeof(T) - 1 - i];
+      memcpy(&value, bytes, sizeof(T));
+    } else {
+      memcpy(&value, data + pos, sizeof(T));
+    }
+    return value;
+  }
+};
+
+
+static int64_t byteSwap(int64_t x) {
+  return (int64_t) __builtin_bswap64((uint64_t) x);
+}
+
+
+/* Decompresses one region of the log a piece at a time, so a large DXT
+   module never has to be decompressed into memory all at once. */
+class RegionReader {
+  const unsigned char *src, *src_end;
+  bool compressed;
+  z_stream zs;
+  bool in_stream;
+  bool failed;
+
+  static const size_t BLOCK_SIZE = 1024 * 1024;
+  vector<char> buf;
+  size_t buf_pos, buf_end;
+
+  // decompress another block into buf, keeping the unread part.
+  // Returns false at the end of the region or on error.
+  bool fill();
+
+public:
+  RegionReader(string_view region, bool compressed_)
+    : src((const unsigned char*) region.data()),
+      src_end((const unsigned char*) region.data() + region.length()),
+      compressed(compressed_), in_stream(false), failed(false),
+      buf_pos(0), buf_end(0) {
+    memset(&zs, 0, sizeof zs);
+    if (compressed) buf.resize(BLOCK_SIZE);
+  }
+
+  ~RegionReader() {
+    if (in_stream) inflateEnd(&zs);
+  }
+
+  // True if the data is corrupt. Check this after read() returns false.
+  bool error() const {return failed;}
+
+  /* Sets p to the next len bytes of decompressed data. They stay valid
+     until the next call. Returns false if there are fewer than len
+     bytes left. */
+  bool read(size_t len, const char *&p);
+};
+
+
+bool RegionReader::fill() {
+  if (failed) return false;
+
+  size_t remaining = buf_end - buf_pos;
+  if (buf_pos > 0) {
+    memmove(buf.data(), buf.data() + buf_pos, remaining);
+    buf_pos = 0;
+    buf_end = remaining;
+  }
+  if (buf_end == buf.size()) {
+    buf.resize(buf.size() * 2);
+  }
+
+  size_t start_end = buf_end;
+  while (buf_end < buf.size()) {
+    if (!in_stream) {
+      if (src == src_end) break;
+      memset(&zs, 0, sizeof zs);
+      if (inflateInit(&zs) != Z_OK) {
+        failed = true;
+        return false;
+      }
+      in_stream = true;
+    }
+
+    zs.next_in = (Bytef*) src;
+    zs.avail_in = (uInt) min<size_t>(src_end - src, UINT32_MAX);
+    zs.next_out = (Bytef*) buf.data() + buf_end;
+    zs.avail_out = (uInt) (buf.size() - buf_end);
+
+    int rc = inflate(&zs, Z_NO_FLUSH);
+    src = (const unsigned char*) zs.next_in;
+    buf_end = (char*) zs.next_out - buf.data();
+
+    if (rc == Z_STREAM_END) {
+      // another stream may follow this one
+      inflateEnd(&zs);
+      in_stream = false;
+    } else if (rc != Z_OK) {
+      failed = true;
+      return false;
+    }
+  }
+
+  return buf_end > start_end;
+}
+
+
+bool RegionReader::read(size_t len, const char *&p) {
+  if (!compressed) {
+    if ((size_t)(src_end - src) < len) return false;
+    p = (const char*) src;
+    src += len;
+    return true;
+  }
+
+  while (buf_end - buf_pos < len) {
+    if (!fill()) return false;
+  }
+  p = buf.data() + buf_pos;
+  buf_pos += len;
+  return true;
+}
+
+
+bool isDarshanBinaryLog(string_view data) {
+  if (data.length() < DARSHAN_LOG_HEADER_PEEK) return false;
+  int64_t magic;
+  memcpy(&magic, data.data() + 8, sizeof magic);
+  return magic == DARSHAN_MAGIC || byteSwap(magic) == DARSHAN_MAGIC;
+}
+
+
+// Returns false if region is outside the bounds of data.
+static bool getRegion(string_view data, const FieldReader &header,
+                      size_t map_pos, string_view &region) {
+  uint64_t off = header.get<uint64_t>(map_pos);
+  uint64_t len = header.get<uint64_t>(map_pos + 8);
+  if (off > data.length() || len > data.length() - off) return false;
+  region = data.substr(off, len);
+  return true;
+}
+
+
+static bool readNameRecords(RegionReader &reader, bool swap,
+                            unordered_map<uint64_t,string> &names) {
+  const char *p;
+  while (reader.read(sizeof(uint64_t), p)) {
+    uint64_t id = FieldReader(p, swap).get<uint64_t>(0);
+    string name;
+    while (true) {
+      if (!reader.read(1, p)) return false;
+      if (*p == 0) break;
+      name += *p;
+    }
+    names[id] = name;
+  }
+  return !reader.error();
+}
+
+
+static bool readDxtModule(RegionReader &reader, bool swap, Event::API api,
+                          const unordered_map<uint64_t,string> &names,
+                          FileTableType &file_table, bool save_all_events,
+                          SpillStore *spill_store,
+                          ParentEventMerger *parent_merger) {
+  const char *p;
+  while (reader.read(DXT_RECORD_SIZE, p)) {
+    FieldReader record(p, swap);
+    uint64_t id = record.get<uint64_t>(0);
+    int rank = (int) record.get<int64_t>(8);
+    int64_t write_count = record.get<int64_t>(88);
+    int64_t read_count = record.get<int64_t>(96);
+    if (write_count < 0 || read_count < 0) return false;
+
+    File *current_file = file_table.find(id);
+    if (!current_file) {
+      auto name_iter = names.find(id);
+      string_view file_name = name_iter == names.end()
+        ? string_view("<unknown>") : string_view(name_iter->second);
+      current_file = file_table.add(unique_ptr<File>
+        (new File(id, file_name, save_all_events, spill_store)));
+    }
+
+    // write segments come first, then read segments
+    for (int64_t i = 0; i < write_count + read_count; i++) {
+      if (!reader.read(DXT_SEGMENT_SIZE, p)) return false;
+      FieldReader segment(p, swap);
+      Event event(rank, i < write_count ? Event::WRITE : Event::READ, api,
+                  segment.get<int64_t>(0), segment.get<int64_t>(8),
+                  segment.get<double>(16), segment.get<double>(24));
+
+      // ignore events with an invalid offset
+      if (event.offset < 0) continue;
+
+      if (parent_merger) {
+        parent_merger->addEvent(current_file, event);
+      } else {
+        current_file->addEvent(event);
+        checkMemoryLimit(file_table, spill_store);
+      }
+    }
+  }
+
+  return !reader.error();
+}
+
+
+bool readDarshanBinaryLog(string_view data, const string &filename,
+                          FileTableType &file_table, bool save_all_events,
+                          SpillStore *spill_store) {
+  if (data.length() < HEADER_SIZE) {
+    fprintf(stderr, "%s: truncated Darshan log header\n", filename.c_str());
+    return false;
+  }
+
+  int64_t magic;
+  memcpy(&magic, data.data() + 8, sizeof magic);
+  bool swap = (magic != DARSHAN_MAGIC);
+  FieldReader header(data.data(), swap);
+
+  // version is "<major>.<minor>", for example "3.21"
+  string version(data.data(), strnlen(data.data(), 8));
+  int major = 0, minor = 0;
+  if (sscanf(version.c_str(), "%d.%d", &major, &minor) != 2
+      || major != 3 || minor < 20) {
+    fprintf(stderr, "%s: unsupported Darshan log version \"%s\", "
+            "3.20 or later is required\n", filename.c_str(), version.c_str());
+    return false;
+  }
+
+  uint32_t comp_type = header.get<uint32_t>(16);
+  if (comp_type != COMP_ZLIB && comp_type != COMP_NONE) {
+    fprintf(stderr, "%s: unsupported Darshan log compression type %u\n",
+            filename.c_str(), (unsigned) comp_type);
+    return false;
+  }
+  bool compressed = (comp_type == COMP_ZLIB);
+
+  if (header.get<uint32_t>(20) != 0) {
+    fprintf(stderr, "Warning: %s is a partial Darshan log, some events "
+            "may be missing\n", filename.c_str());
+  }
+
+  string_view region;
+  unordered_map<uint64_t,string> names;
+  if (!getRegion(data, header, NAME_MAP_POS, region)) {
+    fprintf(stderr, "%s: corrupt Darshan log\n", filename.c_str());
+    return false;
+  }
+  RegionReader name_reader(region, compressed);
+  if (!readNameRecords(name_reader, swap, names)) {
+    fprintf(stderr, "%s: failed to decode file names\n", filename.c_str());
+    return false;
+  }
+
+  // same order as darshan-dxt-parser: all POSIX records, then all MPI-IO
+  const pair<int, Event::API> modules[] = {
+    {DXT_POSIX_MOD, Event::POSIX}, {DXT_MPIIO_MOD, Event::MPI}};
+  string_view regions[2];
+  for (int i = 0; i < 2; i++) {
+    if (!getRegion(data, header, MOD_MAP_POS + 16 * modules[i].first,
+                   regions[i])) {
+      fprintf(stderr, "%s: corrupt Darshan log\n", filename.c_str());
+      return false;
+    }
+  }
+
+  // with both modules, POSIX events may be children of MPI-IO events
+  ParentEventMerger parent_merger(spill_store);
+  bool merge_parents = !regions[0].empty() && !regions[1].empty();
+
+  for (int i = 0; i < 2; i++) {
+    if (regions[i].empty()) continue;
+
+    RegionReader reader(regions[i], compressed);
+    if (!readDxtModule(reader, swap, modules[i].second, names, file_table,
+                       save_all_events, spill_store,
+                       merge_parents ? &parent_merger : nullptr)) {
+      fprintf(stderr, "%s: failed to decode DXT records\n", filename.c_str());
+      return false;
+    }
+  }
+
+  parent_merger.flush(file_table);
+  return true;
+}
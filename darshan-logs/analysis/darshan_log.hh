@@ -0,0 +1,35 @@
+#ifndef DARSHAN_LOG_HH
+#define DARSHAN_LOG_HH
+
+/*
+  Reader for binary Darshan logs (the .darshan files written by the
+  Darshan runtime), so they can be read directly rather than first
+  converting them to text with darshan-dxt-parser.
+
+  Only the DXT_POSIX and DXT_MPIIO modules are decoded. Logs written by
+  Darshan 3.2 and later are supported (the header layout and the DXT
+  module ids haven't changed since then), with zlib compression or no
+  compression, in either byte order.
+*/
+
+#include "darshan_dxt_conflicts.hh"
+#include <string>
+#include <string_view>
+
+
+// number of bytes needed by isDarshanBinaryLog()
+const size_t DARSHAN_LOG_HEADER_PEEK = 16;
+
+// Returns true if data starts with the header of a binary Darshan log.
+bool isDarshanBinaryLog(std::string_view data);
+
+/* Decode the DXT records in a binary Darshan log and add their events
+   to file_table. data is the entire log file.
+   save_all_events: keep a copy of all events
+   spill_store: if not null, spill events to it when memory runs low
+   Returns false and prints an error if the log can't be decoded. */
+bool readDarshanBinaryLog(std::string_view data, const std::string &filename,
+                          FileTableType &file_table, bool save_all_events,
+                          SpillStore *spill_store);
+
+#endif // DARSHAN_LOG_HH
@@ -0,0 +1,248 @@
+#include "decompress.hh"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+
+Decompressor::Format Decompressor::detect(string_view header) {
+  const unsigned char *p = (const unsigned char*) header.data();
+  if (header.length() >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+    return GZIP;
+  if (header.length() >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f
+      && p[3] == 0xfd)
+    return ZSTD;
+  return NONE;
+}
+
+
+bool Decompressor::supported(Format format) {
+#ifndef HAVE_ZSTD
+  if (format == ZSTD) return false;
+#endif
+  return format != NONE;
+}
+
+
+Decompressor::Decompressor(Format format_, int fd_, string_view prefix_,
+                           const string &filename_)
+  : format(format_), fd(fd_), prefix(prefix_), filename(filename_),
+    done(false), failed(false), stopping(false), current_pos(0) {
+  thread = std::thread(&Decompressor::run, this);
+}
+
+
+Decompressor::~Decompressor() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  changed.notify_all();
+  thread.join();
+}
+
+
+long Decompressor::read(char *dest, size_t len) {
+  while (current_pos == current.size()) {
+    unique_lock<mutex> guard(lock);
+    if (!current.empty()) {
+      empty.push_back(std::move(current));
+      current.clear();
+    }
+    current_pos = 0;
+    changed.notify_all();
+    changed.wait(guard, [this] {return !full.empty() || done;});
+    if (full.empty()) return failed ? -1 : 0;
+    current = std::move(full.front());
+    full.pop_front();
+  }
+
+  size_t n = min(len, current.size() - current_pos);
+  memcpy(dest, current.data() + current_pos, n);
+  current_pos += n;
+  return n;
+}
+
+
+void Decompressor::run() {
+  bool ok = (format == GZIP) ? runGzip() : runZstd();
+  if (!ok) {
+    fprintf(stderr, "%s: corrupt or truncated %s data\n", filename.c_str(),
+            formatName(format));
+  }
+
+  {
+    lock_guard<mutex> guard(lock);
+    done = true;
+    failed = !ok;
+  }
+  changed.notify_all();
+}
+
+
+long Decompressor::readInput(vector<char> &buf) {
+  if (!prefix.empty()) {
+    size_t n = prefix.length();
+    memcpy(buf.data(), prefix.data(), n);
+    prefix.clear();
+    return n;
+  }
+
+  ssize_t n;
+  do {
+    n = ::read(fd, buf.data(), buf.size());
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) perror("read");
+  return n;
+}
+
+
+bool Decompressor::getEmpty(vector<char> &chunk) {
+  unique_lock<mutex> guard(lock);
+  changed.wait(guard, [this] {return full.size() < MAX_CHUNKS || stopping;});
+  if (stopping) return false;
+  if (!empty.empty()) {
+    chunk = std::move(empty.back());
+    empty.pop_back();
+  }
+  chunk.resize(CHUNK_SIZE);
+  return true;
+}
+
+
+bool Decompressor::putFull(vector<char> &chunk) {
+  {
+    lock_guard<mutex> guard(lock);
+    if (stopping) return false;
+    full.push_back(std::move(chunk));
+  }
+  chunk.clear();
+  changed.notify_all();
+  return true;
+}
+
+
+bool Decompressor::runGzip() {
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  // 32: accept a gzip or zlib header
+  if (inflateInit2(&zs, 15 + 32) != Z_OK) return false;
+
+  vector<char> in(max(CHUNK_SIZE, prefix.length()));
+  vector<char> out;
+  size_t out_len = 0;
+  bool ok = true;
+
+  // true while in the middle of a gzip member; a file may hold several
+  bool in_member = true;
+
+  if (!getEmpty(out)) {
+    inflateEnd(&zs);
+    return true;
+  }
+
+  while (true) {
+    if (zs.avail_in == 0) {
+      long n = readInput(in);
+      if (n <= 0) {
+        ok = (n == 0 && !in_member);
+        break;
+      }
+      zs.next_in = (Bytef*) in.data();
+      zs.avail_in = (uInt) n;
+    }
+
+    if (!in_member) {
+      inflateReset(&zs);
+      in_member = true;
+    }
+
+    zs.next_out = (Bytef*) out.data() + out_len;
+    zs.avail_out = (uInt) (out.size() - out_len);
+    int rc = inflate(&zs, Z_NO_FLUSH);
+    out_len = out.size() - zs.avail_out;
+
+    if (rc == Z_STREAM_END) {
+      in_member = false;
+    } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+      ok = false;
+      break;
+    }
+
+    if (out_len == out.size()) {
+      if (!putFull(out) || !getEmpty(out)) break;
+      out_len = 0;
+    }
+  }
+
+  if (out_len > 0) {
+    out.resize(out_len);
+    putFull(out);
+  }
+  inflateEnd(&zs);
+  return ok;
+}
+
+
+#ifdef HAVE_ZSTD
+bool Decompressor::runZstd() {
+  ZSTD_DStream *zds = ZSTD_createDStream();
+  if (!zds) return false;
+  ZSTD_initDStream(zds);
+
+  vector<char> in(max(CHUNK_SIZE, prefix.length()));
+  ZSTD_inBuffer input = {in.data(), 0, 0};
+  vector<char> out;
+  size_t out_len = 0;
+  bool ok = true;
+
+  // nonzero while in the middle of a frame
+  size_t last_result = 0;
+
+  if (!getEmpty(out)) {
+    ZSTD_freeDStream(zds);
+    return true;
+  }
+
+  while (true) {
+    if (input.pos == input.size) {
+      long n = readInput(in);
+      if (n <= 0) {
+        ok = (n == 0 && last_result == 0);
+        break;
+      }
+      input = {in.data(), (size_t) n, 0};
+    }
+
+    ZSTD_outBuffer output = {out.data() + out_len, out.size() - out_len, 0};
+    last_result = ZSTD_decompressStream(zds, &output, &input);
+    if (ZSTD_isError(last_result)) {
+      ok = false;
+      break;
+    }
+    out_len += output.pos;
+
+    if (out_len == out.size()) {
+      if (!putFull(out) || !getEmpty(out)) break;
+      out_len = 0;
+    }
+  }
+
+  if (out_len > 0) {
+    out.resize(out_len);
+    putFull(out);
+  }
+  ZSTD_freeDStream(zds);
+  return ok;
+}
+#else
+bool Decompressor::runZstd() {
+  return false;
+}
+#endif
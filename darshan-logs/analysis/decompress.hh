@@ -0,0 +1,90 @@
+#ifndef DECOMPRESS_HH
+#define DECOMPRESS_HH
+
+/*
+  Decompression of gzip (and, when built with HAVE_ZSTD, zstd) input
+  files, so compressed traces can be read without first running zcat.
+
+  A Decompressor reads the compressed file on its own thread and hands
+  blocks of output to the reader through a small queue, so decompression
+  overlaps with parsing. LineReader uses one when it sees the magic
+  bytes of a compressed file, and the parsers just see the text.
+*/
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+class Decompressor {
+public:
+  enum Format {NONE, GZIP, ZSTD};
+
+  // number of bytes needed by detect()
+  static const size_t MAGIC_SIZE = 4;
+
+  // Recognize the format from the first bytes of a file.
+  static Format detect(std::string_view header);
+
+  static const char *formatName(Format format) {
+    return format == GZIP ? "gzip" : format == ZSTD ? "zstd" : "none";
+  }
+
+  // True if this build can decompress the given format.
+  static bool supported(Format format);
+
+  /* Start decompressing from fd, which must be positioned at the start
+     of the data, except that the first bytes may already have been read
+     into prefix. filename is used in error messages. fd is not closed. */
+  Decompressor(Format format, int fd, std::string_view prefix,
+               const std::string &filename);
+
+  // stops the decompression thread if it is still running
+  ~Decompressor();
+
+  /* Copy up to len bytes of decompressed data to dest, waiting for them
+     if necessary. Returns the number of bytes copied, 0 at the end of the
+     data, or -1 if the data is corrupt. */
+  long read(char *dest, size_t len);
+
+private:
+  const Format format;
+  const int fd;
+  std::string prefix;
+  const std::string filename;
+
+  static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+  static const size_t MAX_CHUNKS = 4;
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::vector<char>> full;  // decompressed, not yet read
+  std::vector<std::vector<char>> empty;  // for reuse
+  bool done, failed, stopping;
+
+  // the chunk being read, and the position in it
+  std::vector<char> current;
+  size_t current_pos;
+
+  std::thread thread;
+
+  void run();
+  bool runGzip();
+  bool runZstd();
+
+  // Read more compressed input into buf. Returns the number of bytes,
+  // 0 at EOF, or -1 on error.
+  long readInput(std::vector<char> &buf);
+
+  // Get an empty chunk to fill. Returns false if the reader has stopped.
+  bool getEmpty(std::vector<char> &chunk);
+
+  // Queue a filled chunk for the reader. Returns false if it has stopped.
+  bool putFull(std::vector<char> &chunk);
+};
+
+#endif // DECOMPRESS_HH
@@ -0,0 +1,210 @@
+/*
+  dxt_trace_gen - writes a synthetic I/O trace in the text format read by
+  darshan_dxt_conflicts, either darshan-dxt-parser output or strace2dxt
+  output, for testing and benchmarking.
+
+  Access patterns (each rank does -events accesses of -blocksize bytes):
+    nn         each rank accesses its own file sequentially
+    strided    all ranks share one file; access i of rank r is at
+               block (i * ranks + r)
+    segmented  all ranks share one file; rank r accesses its own
+               contiguous segment sequentially
+    random     all ranks share one file; accesses are at random offsets
+               anywhere in the file, and half of them are reads
+    overlap    all ranks write every other block of one shared file,
+               with odd ranks shifted by half a block, so every block
+               written is a conflict
+*/
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+
+struct GenOptions {
+  std::string format = "dxt";
+  std::string pattern = "strided";
+  int n_ranks = 4;
+  int64_t n_events = 1000;  // per rank
+  int64_t block_size = 4096;
+  int read_percent = -1;  // -1: the default for the pattern
+  unsigned seed = 1;
+
+  bool parseArgs(int argc, const char **argv);
+};
+
+
+static void printHelp() {
+  fprintf(stderr, "\n"
+    "  dxt_trace_gen [options]\n"
+    "  Write a synthetic I/O trace to stdout.\n"
+    "\n"
+    "  options:\n"
+    "  -format dxt|strace : darshan-dxt-parser output (the default) or\n"
+    "     strace2dxt output.\n"
+    "  -pattern nn|strided|segmented|random|overlap : access pattern\n"
+    "     (default strided).\n"
+    "  -ranks <n> : number of ranks (default 4).\n"
+    "  -events <n> : number of accesses by each rank (default 1000).\n"
+    "  -blocksize <bytes> : size of each access (default 4096).\n"
+    "  -reads <percent> : percentage of accesses that are reads (default\n"
+    "     50 for the random pattern, otherwise 0).\n"
+    "  -seed <n> : random number seed (default 1).\n"
+    "\n");
+  exit(1);
+}
+
+
+bool GenOptions::parseArgs(int argc, const char **argv) {
+  for (int argno = 1; argno < argc; argno += 2) {
+    const char *arg = argv[argno];
+    if (argno+1 >= argc) return false;
+    const char *value = argv[argno+1];
+
+    if (!strcmp(arg, "-format")) {
+      format = value;
+      if (format != "dxt" && format != "strace") return false;
+    } else if (!strcmp(arg, "-pattern")) {
+      pattern = value;
+      if (pattern != "nn" && pattern != "strided" && pattern != "segmented"
+          && pattern != "random" && pattern != "overlap")
+        return false;
+    } else if (!strcmp(arg, "-ranks")) {
+      n_ranks = atoi(value);
+      if (n_ranks < 1) return false;
+    } else if (!strcmp(arg, "-events")) {
+      n_events = atoll(value);
+      if (n_events < 0) return false;
+    } else if (!strcmp(arg, "-blocksize")) {
+      block_size = atoll(value);
+      if (block_size < 1) return false;
+    } else if (!strcmp(arg, "-reads")) {
+      read_percent = atoi(value);
+      if (read_percent < 0 || read_percent > 100) return false;
+    } else if (!strcmp(arg, "-seed")) {
+      seed = (unsigned) atoi(value);
+    } else {
+      return false;
+    }
+  }
+
+  if (read_percent < 0) {
+    read_percent = (pattern == "random") ? 50 : 0;
+  }
+  return true;
+}
+
+
+/* Generates the accesses of one rank, in the order it makes them. */
+class AccessGenerator {
+  const GenOptions &opt;
+  const int rank;
+  std::mt19937_64 rng;
+  int64_t i;
+
+public:
+  AccessGenerator(const GenOptions &opt_, int rank_)
+    : opt(opt_), rank(rank_), rng(opt_.seed * 1000003ull + rank_), i(0) {}
+
+  bool next(int64_t &offset, bool &is_read, double &start_time) {
+    if (i == opt.n_events) return false;
+
+    int64_t block;
+    if (opt.pattern == "strided") {
+      block = i * opt.n_ranks + rank;
+    } else if (opt.pattern == "segmented") {
+      block = rank * opt.n_events + i;
+    } else if (opt.pattern == "random") {
+      block = rng() % (opt.n_events * opt.n_ranks);
+    } else if (opt.pattern == "overlap") {
+      block = 2 * i;
+    } else {
+      block = i;
+    }
+    offset = block * opt.block_size;
+    if (opt.pattern == "overlap" && rank % 2)
+      offset += opt.block_size / 2;
+    is_read = (int)(rng() % 100) < opt.read_percent;
+    start_time = 0.001 * i + 0.0001 * rank;
+    i++;
+    return true;
+  }
+};
+
+
+static std::string fileName(const GenOptions &opt, int rank) {
+  if (opt.pattern == "nn") {
+    return "/synthetic/nn." + std::to_string(rank);
+  } else {
+    return "/synthetic/" + opt.pattern;
+  }
+}
+
+
+static void writeDxt(const GenOptions &opt) {
+  printf("# darshan log version: 3.21\n"
+         "# synthetic trace: pattern %s, %d ranks, %" PRId64
+         " events per rank\n\n",
+         opt.pattern.c_str(), opt.n_ranks, opt.n_events);
+
+  for (int rank = 0; rank < opt.n_ranks; rank++) {
+    std::string name = fileName(opt, rank);
+    uint64_t file_id = std::hash<std::string>()(name);
+
+    printf("# DXT, file_id: %" PRIu64 ", file_name: %s\n"
+           "# DXT, rank: %d, hostname: synthetic\n"
+           "# Module    Rank  Wt/Rd  Segment          Offset       Length"
+           "    Start(s)      End(s)\n",
+           file_id, name.c_str(), rank);
+
+    AccessGenerator gen(opt, rank);
+    int64_t offset, segment = 0;
+    bool is_read;
+    double start_time;
+    while (gen.next(offset, is_read, start_time)) {
+      printf(" X_POSIX %5d %5s %7" PRId64 " %12" PRId64 " %12" PRId64
+             " %11.4f %11.4f\n",
+             rank, is_read ? "read" : "write", segment++, offset,
+             opt.block_size, start_time, start_time + 0.0001);
+    }
+    printf("\n");
+  }
+}
+
+
+// Ranks become pids 1000, 1001, ..., and every file is opened on fd 3.
+static void writeStrace(const GenOptions &opt) {
+  printf("# strace io log\n");
+
+  for (int rank = 0; rank < opt.n_ranks; rank++) {
+    int pid = 1000 + rank;
+    printf("%d\topen\t3\t%s\n", pid, fileName(opt, rank).c_str());
+
+    AccessGenerator gen(opt, rank);
+    int64_t offset;
+    bool is_read;
+    double start_time;
+    while (gen.next(offset, is_read, start_time)) {
+      printf("%d\t%s\t%" PRId64 "\t%" PRId64 "\t%.6f\t3\n", pid,
+             is_read ? "read" : "write", offset, opt.block_size, start_time);
+    }
+  }
+}
+
+
+int main(int argc, const char **argv) {
+  GenOptions opt;
+  if (!opt.parseArgs(argc, argv))
+    printHelp();
+
+  if (opt.format == "dxt") {
+    writeDxt(opt);
+  } else {
+    writeStrace(opt);
+  }
+
+  return 0;
+}
@@ -0,0 +1,330 @@
+/*
+  Layout of an event cache file (all integers in native byte order; every
+  table and column starts at a multiple of 8 bytes):
+
+    header
+      char     magic[8]           "DXTCACHE"
+      uint32   version            CACHE_VERSION
+      uint32   byte_order         0x01020304 as written
+      uint64   file_count, rank_count, event_count
+      uint64   strings_pos, strings_len
+      uint64   files_pos          file_count CacheFile entries
+      uint64   ranks_pos          rank_count CacheRank entries
+
+    for each rank of each file, its event columns:
+      int64    offset[n]
+      int64    length[n]
+      double   start_time[n]
+      double   end_time[n]
+      uint8    mode[n]            Event::Mode
+      uint8    api[n]             Event::API
+
+    string table: file names, not NUL-terminated
+    file table
+    rank table
+
+  The tables come after the columns so the whole file can be written in
+  one pass, one file of the trace at a time.
+*/
+
+#include "event_cache.hh"
+#include <cerrno>
+
+using namespace std;
+
+
+static const char CACHE_MAGIC[8] = {'D','X','T','C','A','C','H','E'};
+static const uint32_t CACHE_VERSION = 2;
+static const uint32_t CACHE_BYTE_ORDER = 0x01020304;
+
+// CacheFile::flags bit: the file's id came from its path (File::id_from_path)
+static const uint64_t CACHE_ID_FROM_PATH = 1;
+
+struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_count, rank_count, event_count;
+  uint64_t strings_pos, strings_len;
+  uint64_t files_pos;
+  uint64_t ranks_pos;
+};
+
+struct CacheFile {
+  uint64_t id;
+  uint64_t flags;  // CACHE_ID_FROM_PATH
+  uint64_t name_pos, name_len;
+  // this file's ranks are ranks[first_rank .. first_rank+rank_count)
+  uint64_t first_rank, rank_count;
+};
+
+struct CacheRank {
+  int64_t rank;
+  uint64_t event_count;
+  // position of each column in the file
+  uint64_t offset_pos, length_pos, start_pos, end_pos, mode_pos, api_pos;
+};
+
+
+/* Appends to a file, keeping track of the position and any error. */
+class CacheWriter {
+  FILE *out;
+  uint64_t pos;
+  bool ok;
+
+public:
+  CacheWriter(FILE *out_) : out(out_), pos(0), ok(true) {}
+
+  bool good() const {return ok;}
+
+  // Returns the position at which the data was written.
+  uint64_t write(const void *data, size_t len) {
+    uint64_t start = pos;
+    if (len > 0 && fwrite(data, 1, len, out) != len) ok = false;
+    pos += len;
+    return start;
+  }
+
+  // pad with zeros to a multiple of 8 bytes
+  void align() {
+    static const char zeros[8] = {0};
+    if (pos % 8) write(zeros, 8 - pos % 8);
+  }
+
+  template<class T>
+  uint64_t writeTable(const vector<T> &table) {
+    align();
+    return write(table.data(), table.size() * sizeof(T));
+  }
+
+  // Overwrite the beginning of the file.
+  void rewriteHeader(const CacheHeader &header) {
+    if (fseek(out, 0, SEEK_SET) != 0
+        || fwrite(&header, sizeof header, 1, out) != 1)
+      ok = false;
+  }
+};
+
+
+// Write one field of every event in seq as a column.
+template<class T, class Getter>
+static uint64_t writeColumn(CacheWriter &writer, const EventSequence &seq,
+                            vector<T> &column, Getter get) {
+  column.clear();
+  for (auto it = seq.allBegin(); it != seq.allEnd(); ++it)
+    column.push_back(get(*it));
+  return writer.writeTable(column);
+}
+
+
+bool saveEventCache(const string &filename, FileTableType &file_table,
+                    SpillStore *spill_store) {
+  FILE *out = fopen(filename.c_str(), "wb");
+  if (!out) {
+    fprintf(stderr, "Failed to create cache file %s: %s\n",
+            filename.c_str(), strerror(errno));
+    return false;
+  }
+
+  CacheWriter writer(out);
+  CacheHeader header;
+  memset(&header, 0, sizeof header);
+  writer.write(&header, sizeof header);
+
+  string strings;
+  vector<CacheFile> files;
+  vector<CacheRank> ranks;
+  vector<int64_t> int_column;
+  vector<double> double_column;
+  vector<uint8_t> byte_column;
+
+  for (File *f : file_table.byName()) {
+    if (spill_store) f->load(spill_store);
+
+    CacheFile cf;
+    cf.id = f->id;
+    cf.flags = f->id_from_path ? CACHE_ID_FROM_PATH : 0;
+    cf.name_pos = strings.length();
+    cf.name_len = f->name.length();
+    strings += f->name;
+    cf.first_rank = ranks.size();
+
+    for (auto &rank_it : f->rank_seq) {
+      const EventSequence &seq = rank_it.second;
+      CacheRank cr;
+      cr.rank = rank_it.first;
+      cr.event_count = seq.allEnd() - seq.allBegin();
+      cr.offset_pos = writeColumn(writer, seq, int_column,
+                                  [](const Event &e) {return e.offset;});
+      cr.length_pos = writeColumn(writer, seq, int_column,
+                                  [](const Event &e) {return e.length;});
+      cr.start_pos = writeColumn(writer, seq, double_column,
+                                 [](const Event &e) {return e.start_time;});
+      cr.end_pos = writeColumn(writer, seq, double_column,
+                               [](const Event &e) {return e.end_time;});
+      cr.mode_pos = writeColumn(writer, seq, byte_column,
+                                [](const Event &e) {return (uint8_t)e.mode;});
+      cr.api_pos = writeColumn(writer, seq, byte_column,
+                               [](const Event &e) {return (uint8_t)e.api;});
+      ranks.push_back(cr);
+      header.event_count += cr.event_count;
+    }
+
+    cf.rank_count = ranks.size() - cf.first_rank;
+    files.push_back(cf);
+
+    if (spill_store) f->spill(*spill_store);
+  }
+
+  memcpy(header.magic, CACHE_MAGIC, sizeof header.magic);
+  header.version = CACHE_VERSION;
+  header.byte_order = CACHE_BYTE_ORDER;
+  header.file_count = files.size();
+  header.rank_count = ranks.size();
+  header.strings_len = strings.length();
+  header.strings_pos = writer.write(strings.data(), strings.length());
+  header.files_pos = writer.writeTable(files);
+  header.ranks_pos = writer.writeTable(ranks);
+  writer.rewriteHeader(header);
+
+  bool ok = writer.good();
+  if (fclose(out) != 0) ok = false;
+  if (!ok) {
+    fprintf(stderr, "Failed to write cache file %s: %s\n",
+            filename.c_str(), strerror(errno));
+  }
+  return ok;
+}
+
+
+// Returns true if [pos, pos + count*size) is inside data.
+static bool inBounds(string_view data, uint64_t pos, uint64_t count,
+                     size_t size) {
+  return pos <= data.length()
+    && count <= (data.length() - pos) / size;
+}
+
+
+template<class T>
+static T getField(const char *p) {
+  T value;
+  memcpy(&value, p, sizeof value);
+  return value;
+}
+
+
+bool loadEventCache(string_view data, const string &filename,
+                    FileTableType &file_table, bool save_all_events,
+                    SpillStore *spill_store) {
+  CacheHeader header;
+  if (data.length() < sizeof header
+      || memcmp(data.data(), CACHE_MAGIC, sizeof CACHE_MAGIC)) {
+    fprintf(stderr, "%s is not an event cache file\n", filename.c_str());
+    return false;
+  }
+  memcpy(&header, data.data(), sizeof header);
+
+  if (header.byte_order != CACHE_BYTE_ORDER) {
+    fprintf(stderr, "%s: event cache was written on a machine with a "
+            "different byte order\n", filename.c_str());
+    return false;
+  }
+  if (header.version != CACHE_VERSION) {
+    fprintf(stderr, "%s: unsupported event cache version %u (expected %u)\n",
+            filename.c_str(), (unsigned) header.version,
+            (unsigned) CACHE_VERSION);
+    return false;
+  }
+
+  if (!inBounds(data, header.strings_pos, header.strings_len, 1)
+      || !inBounds(data, header.files_pos, header.file_count,
+                   sizeof(CacheFile))
+      || !inBounds(data, header.ranks_pos, header.rank_count,
+                   sizeof(CacheRank))) {
+    fprintf(stderr, "%s: corrupt event cache\n", filename.c_str());
+    return false;
+  }
+  string_view strings = data.substr(header.strings_pos, header.strings_len);
+
+  for (uint64_t file_no = 0; file_no < header.file_count; file_no++) {
+    CacheFile cf = getField<CacheFile>
+      (data.data() + header.files_pos + file_no * sizeof(CacheFile));
+    if (!inBounds(strings, cf.name_pos, cf.name_len, 1)
+        || cf.first_rank > header.rank_count
+        || cf.rank_count > header.rank_count - cf.first_rank) {
+      fprintf(stderr, "%s: corrupt event cache\n", filename.c_str());
+      return false;
+    }
+
+    string_view name = strings.substr(cf.name_pos, cf.name_len);
+    File *current_file;
+    if (cf.flags & CACHE_ID_FROM_PATH) {
+      // the id may differ from the one in the cache if paths collide
+      current_file = file_table.getPathFile(name, save_all_events,
+                                            spill_store);
+    } else {
+      current_file = file_table.find(cf.id);
+      if (!current_file) {
+        current_file = file_table.add(unique_ptr<File>
+          (new File(cf.id, name, save_all_events, spill_store)));
+      }
+    }
+
+    for (uint64_t rank_no = cf.first_rank;
+         rank_no < cf.first_rank + cf.rank_count; rank_no++) {
+      CacheRank cr = getField<CacheRank>
+        (data.data() + header.ranks_pos + rank_no * sizeof(CacheRank));
+      uint64_t n = cr.event_count;
+      if (!inBounds(data, cr.offset_pos, n, sizeof(int64_t))
+          || !inBounds(data, cr.length_pos, n, sizeof(int64_t))
+          || !inBounds(data, cr.start_pos, n, sizeof(double))
+          || !inBounds(data, cr.end_pos, n, sizeof(double))
+          || !inBounds(data, cr.mode_pos, n, 1)
+          || !inBounds(data, cr.api_pos, n, 1)) {
+        fprintf(stderr, "%s: corrupt event cache\n", filename.c_str());
+        return false;
+      }
+
+      const char *offsets = data.data() + cr.offset_pos;
+      const char *lengths = data.data() + cr.length_pos;
+      const char *starts = data.data() + cr.start_pos;
+      const char *ends = data.data() + cr.end_pos;
+      const uint8_t *modes = (const uint8_t*) data.data() + cr.mode_pos;
+      const uint8_t *apis = (const uint8_t*) data.data() + cr.api_pos;
+
+      for (uint64_t i = 0; i < n; i++) {
+        if (modes[i] > Event::READ_WRITE || apis[i] > Event::MPI) {
+          fprintf(stderr, "%s: corrupt event cache\n", filename.c_str());
+          return false;
+        }
+        Event event((int) cr.rank, (Event::Mode) modes[i],
+                    (Event::API) apis[i],
+                    getField<int64_t>(offsets + i * sizeof(int64_t)),
+                    getField<int64_t>(lengths + i * sizeof(int64_t)),
+                    getField<double>(starts + i * sizeof(double)),
+                    getField<double>(ends + i * sizeof(double)));
+        current_file->addEvent(event);
+        checkMemoryLimit(file_table, spill_store);
+      }
+    }
+  }
+
+  return true;
+}
+
+
+bool readEventCacheFile(const string &filename, LineReader &line_reader,
+                        FileTableType &file_table, bool save_all_events,
+                        SpillStore *spill_store) {
+  if (!line_reader.open(filename)) {
+    cerr << "Failed to open \"" << filename << "\"\n";
+    return false;
+  }
+
+  string_view data;
+  line_reader.readAll(data);
+  bool ok = loadEventCache(data, filename, file_table, save_all_events,
+                           spill_store);
+  line_reader.close();
+  return ok;
+}
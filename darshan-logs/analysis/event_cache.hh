@@ -0,0 +1,44 @@
+#ifndef EVENT_CACHE_HH
+#define EVENT_CACHE_HH
+
+/*
+  A cache of the events read from a trace (the -save-cache and -load-cache
+  options), so the same trace can be analyzed again with different options
+  without parsing it again.
+
+  The cache is a binary file laid out in columns, meant to be mapped into
+  memory: a string table holding file ids and names, a table of files, a
+  table of ranks, and for each rank of each file, separate arrays of the
+  offset, length, mode, api, start time, and end time of its events. See
+  event_cache.cc for the exact layout. The file starts with a magic string
+  and a version number, and a cache with a different version or byte order
+  is rejected rather than misread.
+*/
+
+#include "darshan_dxt_conflicts.hh"
+#include <string>
+#include <string_view>
+
+
+/* Write every event in file_table to a cache file. Every File must have
+   been read with save_all_events set. If spill_store is not null, each
+   file is loaded from it while it is written, then spilled again.
+   Returns false and prints an error on failure. */
+bool saveEventCache(const std::string &filename, FileTableType &file_table,
+                    SpillStore *spill_store);
+
+/* Add the events in a cache file to file_table. data is the entire file.
+   save_all_events: keep a copy of all events
+   spill_store: if not null, spill events to it when memory runs low
+   Returns false and prints an error if the cache is invalid. */
+bool loadEventCache(std::string_view data, const std::string &filename,
+                    FileTableType &file_table, bool save_all_events,
+                    SpillStore *spill_store);
+
+// Read a cache file with line_reader (which maps it, if possible), and
+// add its events to file_table.
+bool readEventCacheFile(const std::string &filename, LineReader &line_reader,
+                        FileTableType &file_table, bool save_all_events,
+                        SpillStore *spill_store);
+
+#endif // EVENT_CACHE_HH
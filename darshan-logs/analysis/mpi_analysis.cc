@@ -0,0 +1,646 @@
+#include "mpi_analysis.hh"
+#include "thread_pool.hh"
+#include <climits>
+#include <mpi.h>
+
+using namespace std;
+
+
+/* A part of an input, read by one process. Every process has the same
+   list of pieces, in input order, which is the order a single process
+   would read them in. */
+struct InputPiece {
+  int32_t input_no;  // index in the list of inputs
+  int32_t reader;  // rank of the process that reads it
+  // If whole is zero, the bytes [start, end) of a darshan-parser text
+  // file, starting at a section. Otherwise the whole input.
+  int32_t whole;
+  // Nonzero if the input's POSIX events are to be merged into their
+  // MPI-IO parents once all of its events have been collected.
+  int32_t merge_parents;
+  int64_t start, end;
+};
+
+// a run of events of one file from one piece, sent to the file's owner
+struct PackedFileHeader {
+  int64_t piece_no;
+  uint64_t file_id;
+  uint64_t id_from_path;  // File::id_from_path
+  uint64_t name_len;  // followed by the name
+  uint64_t event_count;  // followed by this many PackedEvents
+};
+
+struct PackedEvent {
+  int64_t offset, length;
+  double start_time, end_time;
+  int32_t rank;
+  uint8_t mode, api;
+};
+
+// one file's report, in the list sent to rank 0
+struct ReportHeader {
+  uint64_t file_id;
+  uint64_t name_len;  // followed by the name
+  uint64_t report_len;
+};
+
+// Events are exchanged while they are read, in rounds in which each
+// process receives at most about this many bytes. See EventExchange.
+static const int64_t ROUND_SIZE = 64 << 20;
+static const int64_t MIN_ROUND_SEND = 64 << 10;
+static const int REPORT_TAG = 1;
+// Reports are sent to rank 0 in messages of this size, the last one of
+// each report shorter, so neither side holds more than a message of one.
+static const int64_t REPORT_MESSAGE_SIZE = 1 << 20;
+
+
+template<class T>
+static void appendStruct(string &buf, const T &value) {
+  buf.append((const char*) &value, sizeof value);
+}
+
+
+template<class T>
+static T getStruct(const char *p) {
+  T value;
+  memcpy(&value, p, sizeof value);
+  return value;
+}
+
+
+/* If filename is darshan-parser output in an uncompressed regular file,
+   add a piece for each of n_procs processes to read, and return true.
+   The pieces are about the same size, and each starts at a section, so
+   each process's reader starts where a single reader would be after the
+   sections before it. */
+static bool splitTextInput(const string &filename, int input_no,
+                           int n_procs, vector<InputPiece> &pieces) {
+  if (filename == "-") return false;
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat statbuf;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode)
+      && statbuf.st_size > 0) {
+    map = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (map == MAP_FAILED) return false;
+
+  size_t size = statbuf.st_size;
+  string_view data((const char*) map, size);
+  bool is_text = !data.compare(0, DARSHAN_HEADER.length(), DARSHAN_HEADER);
+
+  if (is_text) {
+    // darshan-parser puts a blank line before each section
+    static const string_view section_start = "\n\n# DXT, file_id: ";
+    size_t first = data.find(section_start);
+    first = (first == string_view::npos) ? size : first + 2;
+
+    // the modules are listed in the header, before the first section
+    bool merge_parents = data.substr(0, first).find("\n# DXT_MPIIO module:")
+      != string_view::npos;
+
+    size_t start = first;
+    for (int reader = 0; reader < n_procs; reader++) {
+      size_t end = size;
+      if (reader < n_procs - 1) {
+        size_t target = first + (size - first) * (reader + 1) / n_procs;
+        size_t pos = data.find(section_start, max(target, start) - 2);
+        if (pos != string_view::npos) end = pos + 2;
+      }
+      if (end > start) {
+        pieces.push_back({input_no, reader, 0, merge_parents,
+                          (int64_t) start, (int64_t) end});
+      }
+      start = end;
+    }
+  }
+
+  munmap(map, size);
+  return is_text;
+}
+
+
+// Decide who reads what. Only rank 0 does this.
+static vector<InputPiece> planPieces(const vector<string> &inputs,
+                                     int n_procs) {
+  vector<InputPiece> pieces;
+  int next_reader = 0;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (splitTextInput(inputs[i], i, n_procs, pieces)) continue;
+
+    // everything else is read whole, and only rank 0 can read stdin
+    int reader = 0;
+    if (inputs[i] != "-") {
+      reader = next_reader;
+      next_reader = (next_reader + 1) % n_procs;
+    }
+    pieces.push_back({(int32_t) i, reader, 1, 0, 0, 0});
+  }
+  return pieces;
+}
+
+
+static void broadcastPieces(vector<InputPiece> &pieces) {
+  int64_t count = pieces.size();
+  MPI_Bcast(&count, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+  pieces.resize(count);
+  MPI_Bcast(pieces.data(), count * sizeof(InputPiece), MPI_BYTE, 0,
+            MPI_COMM_WORLD);
+}
+
+
+/* Sends the events this process reads to the owners of their files, and
+   adds the events it receives to its own files, while the inputs are
+   being read.
+
+   The events for each owner are packed into an outbox as they are read.
+   When one process's outboxes hold its share of ROUND_SIZE, it starts a
+   round: every process says which piece it is reading, and the outboxes
+   are swapped with MPI_Alltoallv. A process waits for the others to
+   fill their share or finish reading, so no process holds more than one
+   round's events in its buffers, and those are counted in the SpillStore.
+
+   Each owner adds the events of a piece only once every earlier piece is
+   finished, so each file gets its events in the order a single process
+   would have read them. Events of later pieces are held until then, and
+   once the memory limit is reached they are held in the SpillStore. */
+class EventExchange {
+public:
+  EventExchange(const vector<InputPiece> &pieces_, const Options &opt_,
+                FileTableType &file_table_, SpillStore *spill_store_,
+                int n_procs_);
+
+  // Called as this process starts reading piece_no.
+  void startPiece(int64_t piece_no);
+
+  // Pack e, an event of f in the piece being read. f is in the table of
+  // the piece, not in file_table.
+  void addEvent(File &f, const Event &e);
+
+  // Run rounds until every process has sent all of its events.
+  void finish();
+
+private:
+  const vector<InputPiece> &pieces;
+  const Options &opt;
+  FileTableType &file_table;
+  SpillStore *spill_store;
+  const int n_procs;
+  const int64_t send_share;  // bytes that start a round
+
+  // reading side
+  int64_t piece_no = 0;
+  vector<string> outbox;  // for each owner
+  int64_t outbox_size = 0;
+  // the run of events being packed for each owner
+  vector<const File*> run_file;
+  vector<size_t> run_header_pos;
+  vector<uint64_t> run_count;
+
+  // owning side
+  vector<int64_t> progress;  // the piece each process is reading
+  int64_t next_piece = 0;  // the first piece not completely added
+  struct HeldRun {
+    string data;  // the packed run, unless spilled
+    int64_t spill_pos, len;
+  };
+  vector<vector<HeldRun>> held;  // by piece
+  ParentEventMerger parent_merger;
+  int input_no = -1;  // of the events in parent_merger
+
+  void endRun(int owner);
+  void round();
+  void addRun(string_view run);
+  void hold(int64_t run_piece, string_view run);
+};
+
+
+EventExchange::EventExchange(const vector<InputPiece> &pieces_,
+                             const Options &opt_, FileTableType &file_table_,
+                             SpillStore *spill_store_, int n_procs_)
+  : pieces(pieces_), opt(opt_), file_table(file_table_),
+    spill_store(spill_store_), n_procs(n_procs_),
+    send_share(max(MIN_ROUND_SEND,
+                   (opt.memory_limit > 0
+                    ? min(ROUND_SIZE, opt.memory_limit / 4) : ROUND_SIZE)
+                   / n_procs)),
+    outbox(n_procs), run_file(n_procs, nullptr), run_header_pos(n_procs),
+    run_count(n_procs), progress(n_procs), held(pieces.size()),
+    parent_merger(spill_store) {}
+
+
+void EventExchange::startPiece(int64_t piece_no_) {
+  // the Files of the previous piece are gone
+  for (int owner = 0; owner < n_procs; owner++) endRun(owner);
+  piece_no = piece_no_;
+}
+
+
+void EventExchange::addEvent(File &f, const Event &e) {
+  int owner = FileTableType::shard(f, n_procs);
+  string &buf = outbox[owner];
+  size_t old_size = buf.size();
+  if (run_file[owner] != &f) {
+    endRun(owner);
+    run_file[owner] = &f;
+    run_header_pos[owner] = buf.size();
+    appendStruct(buf, PackedFileHeader{piece_no, f.id, f.id_from_path,
+                                       f.name.length(), 0});
+    buf.append(f.name);
+  }
+
+  PackedEvent packed;
+  memset(&packed, 0, sizeof packed);
+  packed.offset = e.offset;
+  packed.length = e.length;
+  packed.start_time = e.start_time;
+  packed.end_time = e.end_time;
+  packed.rank = e.rank;
+  packed.mode = e.mode;
+  packed.api = e.api;
+  appendStruct(buf, packed);
+  run_count[owner]++;
+
+  outbox_size += buf.size() - old_size;
+  if (spill_store) spill_store->addMemory(buf.size() - old_size);
+  if (outbox_size >= send_share) round();
+}
+
+
+// Write the event count into the header of the run for owner.
+void EventExchange::endRun(int owner) {
+  if (!run_file[owner]) return;
+  memcpy(&outbox[owner][run_header_pos[owner]
+                        + offsetof(PackedFileHeader, event_count)],
+         &run_count[owner], sizeof run_count[owner]);
+  run_file[owner] = nullptr;
+  run_count[owner] = 0;
+}
+
+
+void EventExchange::finish() {
+  startPiece(pieces.size());
+  while (true) {
+    round();
+    if (all_of(progress.begin(), progress.end(), [this](int64_t p) {
+          return p == (int64_t) pieces.size();
+        })) break;
+  }
+  assert(next_piece == (int64_t) pieces.size());
+  parent_merger.flush(file_table);
+  checkMemoryLimit(file_table, spill_store);
+}
+
+
+void EventExchange::round() {
+  for (int owner = 0; owner < n_procs; owner++) endRun(owner);
+
+  // Every run of a piece before the one a process is reading is in this
+  // round or an earlier one.
+  MPI_Allgather(&piece_no, 1, MPI_INT64_T, progress.data(), 1, MPI_INT64_T,
+                MPI_COMM_WORLD);
+
+  // Each outbox is a little over send_share at most, so the counts fit
+  // in an int.
+  vector<int> send_counts(n_procs), send_displs(n_procs);
+  vector<int> recv_counts(n_procs), recv_displs(n_procs);
+  for (int r = 0; r < n_procs; r++) send_counts[r] = outbox[r].size();
+  MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT,
+               MPI_COMM_WORLD);
+  int64_t send_total = 0, recv_total = 0;
+  for (int r = 0; r < n_procs; r++) {
+    send_displs[r] = send_total;
+    send_total += send_counts[r];
+    recv_displs[r] = recv_total;
+    recv_total += recv_counts[r];
+  }
+  assert(send_total <= INT_MAX && recv_total <= INT_MAX);
+
+  vector<char> send_buf(send_total), recv_buf(recv_total);
+  if (spill_store) spill_store->addMemory(send_total + recv_total);
+  for (int r = 0; r < n_procs; r++) {
+    memcpy(send_buf.data() + send_displs[r], outbox[r].data(),
+           send_counts[r]);
+    outbox[r].clear();
+  }
+  MPI_Alltoallv(send_buf.data(), send_counts.data(), send_displs.data(),
+                MPI_BYTE, recv_buf.data(), recv_counts.data(),
+                recv_displs.data(), MPI_BYTE, MPI_COMM_WORLD);
+  vector<char>().swap(send_buf);
+  if (spill_store) spill_store->addMemory(-send_total - outbox_size);
+  outbox_size = 0;
+
+  // the runs received, by piece; each piece comes from one process
+  vector<pair<int64_t,string_view>> runs;
+  const char *p = recv_buf.data(), *end = p + recv_buf.size();
+  while (p < end) {
+    PackedFileHeader h = getStruct<PackedFileHeader>(p);
+    size_t len = sizeof h + h.name_len + h.event_count * sizeof(PackedEvent);
+    runs.push_back({h.piece_no, string_view(p, len)});
+    p += len;
+  }
+  assert(p == end);
+  stable_sort(runs.begin(), runs.end(),
+              [](const pair<int64_t,string_view> &a,
+                 const pair<int64_t,string_view> &b) {
+                return a.first < b.first;
+              });
+
+  // The events received are for this process's own files.
+  File::EventSink sink;
+  sink.swap(File::event_sink);
+
+  size_t run_no = 0;
+  string spilled;
+  for (; next_piece < (int64_t) pieces.size(); next_piece++) {
+    for (HeldRun &h : held[next_piece]) {
+      if (h.spill_pos >= 0) {
+        spilled.resize(h.len);
+        spill_store->read(h.spill_pos, &spilled[0], h.len);
+        addRun(spilled);
+      } else {
+        addRun(h.data);
+        if (spill_store) spill_store->addMemory(-h.len);
+      }
+    }
+    vector<HeldRun>().swap(held[next_piece]);
+    for (; run_no < runs.size() && runs[run_no].first == next_piece;
+         run_no++) {
+      addRun(runs[run_no].second);
+    }
+    // stop at a piece that is still being read
+    if (progress[pieces[next_piece].reader] <= next_piece) break;
+  }
+  for (; run_no < runs.size(); run_no++) {
+    hold(runs[run_no].first, runs[run_no].second);
+  }
+
+  sink.swap(File::event_sink);
+  if (spill_store) spill_store->addMemory(-recv_total);
+}
+
+
+// Add the events of a run to this process's files.
+void EventExchange::addRun(string_view run) {
+  PackedFileHeader h = getStruct<PackedFileHeader>(run.data());
+  string_view name = run.substr(sizeof h, h.name_len);
+  const InputPiece &piece = pieces[h.piece_no];
+
+  // as in readDarshanDxtInput, parents are merged one input at a time
+  if (piece.input_no != input_no) {
+    parent_merger.flush(file_table);
+    input_no = piece.input_no;
+  }
+
+  File *f;
+  if (h.id_from_path) {
+    f = file_table.getPathFile(name, opt.saveAllEvents(), spill_store);
+  } else {
+    f = file_table.find(h.file_id);
+    if (!f) {
+      f = file_table.add(unique_ptr<File>
+        (new File(h.file_id, name, opt.saveAllEvents(), spill_store)));
+    }
+  }
+
+  const char *p = run.data() + sizeof h + h.name_len;
+  for (uint64_t i = 0; i < h.event_count; i++) {
+    PackedEvent packed = getStruct<PackedEvent>(p);
+    p += sizeof packed;
+    Event e(packed.rank, (Event::Mode) packed.mode, (Event::API) packed.api,
+            packed.offset, packed.length, packed.start_time,
+            packed.end_time);
+    if (piece.merge_parents) {
+      parent_merger.addEvent(f, e);
+    } else {
+      f->addEvent(e);
+      checkMemoryLimit(file_table, spill_store);
+    }
+  }
+}
+
+
+// Keep a run of a piece after next_piece until it can be added.
+void EventExchange::hold(int64_t run_piece, string_view run) {
+  HeldRun h;
+  h.len = run.length();
+  if (spill_store && spill_store->overLimit()) {
+    h.spill_pos = spill_store->write(run.data(), run.length());
+  } else {
+    h.spill_pos = -1;
+    h.data = run;
+    if (spill_store) spill_store->addMemory(h.len);
+  }
+  held[run_piece].push_back(std::move(h));
+}
+
+
+/* Read this process's pieces, sending their events to the processes that
+   own their files, and add the events sent to this one to file_table. */
+static void readPieces(const vector<string> &inputs,
+                       const vector<InputPiece> &pieces, const Options &opt,
+                       int my_rank, int n_procs, FileTableType &file_table,
+                       SpillStore *spill_store) {
+  ReadProgress progress(my_rank == 0 ? 5000 : LONG_MAX);
+  LineReader line_reader(progress);
+  EventExchange exchange(pieces, opt, file_table, spill_store, n_procs);
+
+  File::event_sink = [&exchange](File &f, const Event &e) {
+    exchange.addEvent(f, e);
+  };
+  for (size_t piece_no = 0; piece_no < pieces.size(); piece_no++) {
+    const InputPiece &piece = pieces[piece_no];
+    if (piece.reader != my_rank) continue;
+    const string &filename = inputs[piece.input_no];
+    exchange.startPiece(piece_no);
+
+    FileTableType piece_files;
+    if (piece.whole) {
+      readInputFile(filename, line_reader, piece_files, opt, nullptr);
+    } else if (line_reader.open(filename)
+               && line_reader.setRange(piece.start, piece.end)) {
+      // Parents are merged by the owners, who will have all of the
+      // input's events.
+      readDarshanDxtInput(line_reader, piece_files, false, false, nullptr);
+      line_reader.close();
+    } else {
+      cerr << "Failed to open \"" << filename << "\"\n";
+      line_reader.close();
+    }
+  }
+  File::event_sink = nullptr;
+  exchange.finish();
+  progress.done();
+}
+
+
+// Send report i in messages of REPORT_MESSAGE_SIZE, as it is read back
+// from reports.
+static void sendReport(ReportQueue &reports, size_t i, int dest) {
+  string buf, piece;
+  auto send = [&buf, dest](int64_t len) {
+    MPI_Send(buf.data(), len, MPI_BYTE, dest, REPORT_TAG, MPI_COMM_WORLD);
+    buf.erase(0, len);
+  };
+  while (reports.next(i, piece)) {
+    buf.append(piece);
+    while ((int64_t) buf.length() >= REPORT_MESSAGE_SIZE)
+      send(REPORT_MESSAGE_SIZE);
+  }
+  if (!buf.empty()) send(buf.length());
+}
+
+
+// Receive a report of len bytes sent by sendReport(), and write it to out.
+static void recvReport(int64_t len, int source, OutputWriter &out) {
+  string buf;
+  for (int64_t pos = 0; pos < len; pos += REPORT_MESSAGE_SIZE) {
+    buf.resize(min(REPORT_MESSAGE_SIZE, len - pos));
+    MPI_Recv(&buf[0], buf.length(), MPI_BYTE, source, REPORT_TAG,
+             MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    out << buf;
+  }
+}
+
+
+/* Scan this process's files, and write the reports of every process on
+   rank 0, in order of file name.
+
+   Each report goes into a ReportQueue as it is written, so only a few
+   MiB of them are in memory and the rest wait in the SpillStore or a
+   temporary file. Rank 0 gathers the name and report length of every
+   file, and then receives the reports one at a time in order, writing
+   each as it arrives. Each process's files are in name order, so each
+   sends its reports in the order rank 0 wants them. */
+static void scanAndReport(FileTableType &file_table, const Options &opt,
+                          SpillStore *spill_store, int my_rank,
+                          int n_procs) {
+  vector<File*> files = file_table.byName();
+  ReportQueue reports(files.size(),
+                      opt.n_threads * ReportQueue::HELD_PER_THREAD,
+                      spill_store);
+  {
+    OrderedPool pool(opt.n_threads, files.size(), [&](size_t i) {
+        OutputWriter file_out(reports.sink(i), opt.format);
+        scanFile(files[i], opt, spill_store, file_out);
+        file_out.flush();
+        reports.finish(i);
+      });
+  }
+
+  string index;
+  for (size_t i = 0; i < files.size(); i++) {
+    appendStruct(index, ReportHeader{files[i]->id, files[i]->name.length(),
+                                     (uint64_t) reports.length(i)});
+    index.append(files[i]->name);
+  }
+
+  int index_len = index.length();
+  vector<int> index_lens(n_procs), index_displs(n_procs);
+  MPI_Gather(&index_len, 1, MPI_INT, index_lens.data(), 1, MPI_INT, 0,
+             MPI_COMM_WORLD);
+  string all_index;
+  if (my_rank == 0) {
+    int64_t total = 0;
+    for (int r = 0; r < n_procs; r++) {
+      index_displs[r] = total;
+      total += index_lens[r];
+    }
+    all_index.resize(total);
+  }
+  MPI_Gatherv(index.data(), index_len, MPI_BYTE, &all_index[0],
+              index_lens.data(), index_displs.data(), MPI_BYTE, 0,
+              MPI_COMM_WORLD);
+
+  if (my_rank != 0) {
+    for (size_t i = 0; i < files.size(); i++) sendReport(reports, i, 0);
+    return;
+  }
+
+  struct Entry {
+    string_view name;
+    uint64_t file_id, report_len;
+    int owner;
+    size_t file_no;  // index in files, if owner is 0
+  };
+  vector<Entry> entries;
+  for (int r = 0; r < n_procs; r++) {
+    const char *p = all_index.data() + index_displs[r];
+    const char *end = p + index_lens[r];
+    for (size_t file_no = 0; p < end; file_no++) {
+      ReportHeader h = getStruct<ReportHeader>(p);
+      p += sizeof h;
+      entries.push_back({string_view(p, h.name_len), h.file_id,
+                         h.report_len, r, file_no});
+      p += h.name_len;
+    }
+  }
+  // the order of FileTableType::byName()
+  sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+    return a.name != b.name ? a.name < b.name : a.file_id < b.file_id;
+  });
+
+  OutputWriter out(&cout, opt.format);
+  writeRecordHeaders(out);
+  string piece;
+  for (const Entry &entry : entries) {
+    if (entry.owner == 0) {
+      while (reports.next(entry.file_no, piece)) out << piece;
+    } else {
+      recvReport(entry.report_len, entry.owner, out);
+    }
+  }
+  out.flush();
+}
+
+
+int runMpiAnalysis(const Options &opt) {
+  MPI_Init(nullptr, nullptr);
+  int my_rank, n_procs;
+  MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &n_procs);
+
+  if (opt.output_per_rank_summary || opt.follow || opt.throughput_bins
+      || !opt.save_cache_file.empty() || !opt.load_cache_files.empty()
+      || opt.output_stats || !opt.stats_json_file.empty()) {
+    if (my_rank == 0) {
+      fprintf(stderr, "-summary, -follow, -throughput, -save-cache, "
+              "-load-cache, -stats, and -stats-json are not supported "
+              "with MPI\n");
+    }
+    MPI_Finalize();
+    return 1;
+  }
+
+  // "-" means stdin, which can only be read once
+  vector<string> inputs;
+  bool stdin_seen = false;
+  for (const string &filename : opt.input_files) {
+    if (filename == "-") {
+      if (stdin_seen) continue;
+      stdin_seen = true;
+    }
+    inputs.push_back(filename);
+  }
+
+  unique_ptr<SpillStore> spill_store;
+  if (opt.memory_limit > 0) {
+    spill_store.reset(new SpillStore(opt.memory_limit));
+    if (!spill_store->open()) MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  vector<InputPiece> pieces;
+  if (my_rank == 0) pieces = planPieces(inputs, n_procs);
+  broadcastPieces(pieces);
+
+  FileTableType file_table;
+  readPieces(inputs, pieces, opt, my_rank, n_procs, file_table,
+             spill_store.get());
+
+  scanAndReport(file_table, opt, spill_store.get(), my_rank, n_procs);
+
+  MPI_Finalize();
+  return 0;
+}
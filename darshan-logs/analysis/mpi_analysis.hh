@@ -0,0 +1,30 @@
+#ifndef MPI_ANALYSIS_HH
+#define MPI_ANALYSIS_HH
+
+/*
+  Analysis of a trace by several MPI processes, for traces from a whole
+  machine that one node can't read and scan in a reasonable time. This
+  is only in the MPI build, darshan_dxt_conflicts.mpi, which is run with
+  mpirun.
+
+  Rank 0 splits each darshan-parser text input into one byte range per
+  process, each starting at a section, and every process parses its
+  range of every input. Inputs that can't be split (binary logs, strace
+  logs, compressed files, and stdin) are each read whole by one process.
+
+  Each file is owned by one process, chosen by a hash of its id. The
+  events are exchanged with MPI_Alltoallv in rounds of bounded size
+  while they are read, and each owner adds them to its files in the
+  order a single process would have read them, then scans its files.
+  Rank 0 collects the reports and writes them in order of file name, so
+  the output is the same as without MPI.
+*/
+
+#include "darshan_dxt_conflicts.hh"
+
+
+// Initialize MPI, run the analysis described by opt on every process in
+// MPI_COMM_WORLD, and finalize MPI. Returns the exit code.
+int runMpiAnalysis(const Options &opt);
+
+#endif // MPI_ANALYSIS_HH
@@ -0,0 +1,207 @@
+#include "output_writer.hh"
+#include <cassert>
+#include <charconv>
+
+using namespace std;
+
+
+bool OutputWriter::parseFormat(string_view name, Format &format) {
+  if (name == "text") {
+    format = TEXT;
+  } else if (name == "csv") {
+    format = CSV;
+  } else if (name == "jsonl") {
+    format = JSONL;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+OutputWriter::OutputWriter(ostream *out_, Format format)
+  : out(out_), format_(format), record(nullptr), field_no(0),
+    list_empty(true) {
+  if (out) buf.reserve(FLUSH_SIZE + 4096);
+}
+
+
+OutputWriter::OutputWriter(Sink sink_, Format format)
+  : out(nullptr), sink(sink_), format_(format), record(nullptr),
+    field_no(0), list_empty(true) {
+  buf.reserve(FLUSH_SIZE + 4096);
+}
+
+
+void OutputWriter::appendInt(int64_t value) {
+  char tmp[24];
+  to_chars_result r = to_chars(tmp, tmp + sizeof tmp, value);
+  buf.append(tmp, r.ptr - tmp);
+}
+
+
+OutputWriter& OutputWriter::fixed(double value, int precision) {
+  // enough for any double in fixed notation with a few digits
+  char tmp[400];
+  to_chars_result r = to_chars(tmp, tmp + sizeof tmp, value,
+                               chars_format::fixed, precision);
+  buf.append(tmp, r.ptr - tmp);
+  return *this;
+}
+
+
+OutputWriter& OutputWriter::aligned(int64_t value, int width) {
+  char tmp[24];
+  to_chars_result r = to_chars(tmp, tmp + sizeof tmp, value);
+  int len = r.ptr - tmp;
+  if (len < width) buf.append(width - len, ' ');
+  buf.append(tmp, len);
+  return *this;
+}
+
+
+void OutputWriter::writeHeader(const OutputRecord &header) {
+  if (format_ != CSV) return;
+  buf.push_back('#');
+  buf.append(header.type);
+  for (const char *name : header.fields) {
+    buf.push_back(',');
+    buf.append(name);
+  }
+  buf.push_back('\n');
+}
+
+
+void OutputWriter::beginRecord(const OutputRecord &record_) {
+  assert(format_ != TEXT && !record);
+  record = &record_;
+  field_no = 0;
+  if (format_ == JSONL) {
+    buf.append("{\"type\":\"");
+    buf.append(record->type);
+    buf.push_back('"');
+  } else {
+    buf.append(record->type);
+  }
+}
+
+
+void OutputWriter::startField() {
+  assert(record && field_no < record->fields.size());
+  buf.push_back(',');
+  if (format_ == JSONL) {
+    buf.push_back('"');
+    buf.append(record->fields[field_no]);
+    buf.append("\":");
+  }
+  field_no++;
+}
+
+
+void OutputWriter::field(int64_t value) {
+  startField();
+  appendInt(value);
+}
+
+
+void OutputWriter::field(string_view value) {
+  startField();
+  appendQuoted(value);
+}
+
+
+void OutputWriter::field(double value, int precision) {
+  startField();
+  fixed(value, precision);
+}
+
+
+void OutputWriter::beginList() {
+  startField();
+  if (format_ == JSONL) buf.push_back('[');
+  list_empty = true;
+}
+
+
+void OutputWriter::listItem(int64_t value) {
+  if (!list_empty) buf.push_back(format_ == JSONL ? ',' : ' ');
+  list_empty = false;
+  appendInt(value);
+}
+
+
+void OutputWriter::endList() {
+  if (format_ == JSONL) buf.push_back(']');
+}
+
+
+void OutputWriter::endRecord() {
+  assert(record && field_no == record->fields.size());
+  if (format_ == JSONL) buf.push_back('}');
+  buf.push_back('\n');
+  record = nullptr;
+  maybeFlush();
+}
+
+
+/* In JSON, a string with quotes and escapes. In CSV, the string as is,
+   unless it has a comma, quote, or line break, in which case it is
+   quoted, with any quotes doubled. */
+void OutputWriter::appendQuoted(string_view value) {
+  if (format_ == CSV) {
+    if (value.find_first_of(",\"\r\n") == string_view::npos) {
+      buf.append(value);
+      return;
+    }
+    buf.push_back('"');
+    for (char c : value) {
+      if (c == '"') buf.push_back('"');
+      buf.push_back(c);
+    }
+    buf.push_back('"');
+    return;
+  }
+
+  buf.push_back('"');
+  for (char c : value) {
+    switch (c) {
+    case '"': buf.append("\\\""); break;
+    case '\\': buf.append("\\\\"); break;
+    case '\n': buf.append("\\n"); break;
+    case '\r': buf.append("\\r"); break;
+    case '\t': buf.append("\\t"); break;
+    default:
+      if ((unsigned char)c < 0x20) {
+        static const char hex[] = "0123456789abcdef";
+        buf.append("\\u00");
+        buf.push_back(hex[c >> 4]);
+        buf.push_back(hex[c & 15]);
+      } else {
+        buf.push_back(c);
+      }
+    }
+  }
+  buf.push_back('"');
+}
+
+
+void OutputWriter::flush() {
+  if (buf.empty()) return;
+  if (out) {
+    out->write(buf.data(), buf.size());
+    out->flush();
+  } else if (sink) {
+    sink(buf);
+  } else {
+    return;
+  }
+  buf.clear();
+}
+
+
+string OutputWriter::take() {
+  assert(!out && !sink);
+  string result;
+  result.swap(buf);
+  return result;
+}
@@ -0,0 +1,128 @@
+#ifndef OUTPUT_WRITER_HH
+#define OUTPUT_WRITER_HH
+
+/*
+  Buffered output of the reports, as text for people or as CSV or JSON
+  lines for other programs (the -format option).
+
+  Everything is appended to one large buffer, which is written out when
+  it fills and on flush(), and numbers are formatted with std::to_chars,
+  so a report with millions of lines costs little more than the bytes.
+
+  Text is written with operator<<, in whatever layout the caller likes.
+  For CSV and JSON lines, each item is a record: beginRecord(), then
+  field() for each of the record's fields in order, then endRecord().
+  The names of the fields come from an OutputRecord. In JSON lines each
+  record is an object on one line, with its type in "type". In CSV each
+  record is a row whose first column is its type; writeHeader() writes
+  the matching header row, which has "#" before the type, like
+  "#conflict,file,offset,...".
+*/
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+
+// a type of record, and the names of its fields
+struct OutputRecord {
+  const char *type;
+  std::vector<const char*> fields;
+};
+
+
+class OutputWriter {
+public:
+  enum Format {TEXT, CSV, JSONL};
+
+  // Parse "text", "csv", or "jsonl". Returns false if it's none of them.
+  static bool parseFormat(std::string_view name, Format &format);
+
+  // If out is null, the output is only kept, to be returned by take().
+  OutputWriter(std::ostream *out, Format format = TEXT);
+
+  // The output is passed to sink in pieces of about FLUSH_SIZE bytes,
+  // and whatever is left on flush().
+  using Sink = std::function<void(std::string_view)>;
+  OutputWriter(Sink sink, Format format = TEXT);
+  ~OutputWriter() {flush();}
+
+  Format format() const {return format_;}
+  bool isText() const {return format_ == TEXT;}
+
+  OutputWriter& operator<<(std::string_view s) {
+    buf.append(s);
+    maybeFlush();
+    return *this;
+  }
+  OutputWriter& operator<<(const char *s) {return *this << std::string_view(s);}
+  OutputWriter& operator<<(char c) {
+    buf.push_back(c);
+    return *this;
+  }
+
+  template <typename T>
+  std::enable_if_t<std::is_integral_v<T>, OutputWriter&> operator<<(T value) {
+    appendInt(value);
+    return *this;
+  }
+
+  // value with the given number of digits after the decimal point
+  OutputWriter& fixed(double value, int precision);
+
+  // value right-aligned in a field of the given width
+  OutputWriter& aligned(int64_t value, int width);
+
+  // the CSV header row for record; nothing in the other formats
+  void writeHeader(const OutputRecord &record);
+
+  void beginRecord(const OutputRecord &record);
+  void field(int64_t value);
+  void field(std::string_view value);
+  void field(double value, int precision);
+
+  // A list of integers as one field: separated by spaces in CSV, and an
+  // array in JSON.
+  void beginList();
+  void listItem(int64_t value);
+  void endList();
+
+  void endRecord();
+
+  // write everything buffered to the stream or sink
+  void flush();
+
+  // Return everything written so far, and clear it. Only for a writer
+  // with no stream or sink.
+  std::string take();
+
+private:
+  std::ostream *out;
+  Sink sink;
+  const Format format_;
+  std::string buf;
+
+  // the record being written, and the number of its fields written
+  const OutputRecord *record;
+  size_t field_no;
+  bool list_empty;
+
+  static const size_t FLUSH_SIZE = 1024 * 1024;
+
+  void maybeFlush() {
+    if ((out || sink) && buf.size() >= FLUSH_SIZE) flush();
+  }
+
+  void appendInt(int64_t value);
+
+  // the separator and, for JSON, the name of the next field
+  void startField();
+
+  void appendQuoted(std::string_view value);
+};
+
+#endif // OUTPUT_WRITER_HH
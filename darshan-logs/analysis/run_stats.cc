@@ -0,0 +1,206 @@
+#include "run_stats.hh"
+#include <cerrno>
+#include <sys/resource.h>
+
+using namespace std;
+
+
+static double getWallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+}
+
+
+double RunStats::getCpuTime() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + 1e-6 * usage.ru_utime.tv_usec
+    + usage.ru_stime.tv_sec + 1e-6 * usage.ru_stime.tv_usec;
+}
+
+
+int64_t RunStats::getPeakRss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is in KiB on Linux
+  return (int64_t) usage.ru_maxrss * 1024;
+}
+
+
+void RunStats::startPhase(const string &name) {
+  endPhase();
+  phases.push_back({name, 0, 0});
+  in_phase = true;
+  phase_wall_start = getWallTime();
+  phase_cpu_start = getCpuTime();
+}
+
+
+void RunStats::endPhase() {
+  if (!in_phase) return;
+  phases.back().wall_time = getWallTime() - phase_wall_start;
+  phases.back().cpu_time = getCpuTime() - phase_cpu_start;
+  in_phase = false;
+}
+
+
+// totals over all files
+struct FileTotals {
+  int64_t files = 0, ranks = 0, events = 0;
+  int64_t list_size_before_minimize = 0, list_size_after_minimize = 0;
+  int64_t subranges = 0, conflicts = 0;
+};
+
+static int64_t fileEvents(const File &f) {
+  int64_t events = 0;
+  for (auto &re : f.stats.rank_events) events += re.second;
+  return events;
+}
+
+static FileTotals getTotals(const FileTableType &file_table) {
+  FileTotals t;
+  for (auto &f : file_table) {
+    const File::Stats &s = f->stats;
+    t.files++;
+    t.ranks += s.rank_events.size();
+    t.events += fileEvents(*f);
+    t.list_size_before_minimize += s.list_size_before_minimize;
+    t.list_size_after_minimize += s.list_size_after_minimize;
+    t.subranges += s.subranges;
+    t.conflicts += s.conflicts;
+  }
+  return t;
+}
+
+
+void RunStats::printText(FILE *out, const FileTableType &file_table) const {
+  static const size_t LARGEST_FILES = 10;
+
+  fprintf(out, "Run statistics:\n");
+  fprintf(out, "  %-12s %10s %10s\n", "phase", "wall s", "cpu s");
+  double total_wall = 0, total_cpu = 0;
+  for (const Phase &p : phases) {
+    fprintf(out, "  %-12s %10.3f %10.3f\n", p.name.c_str(), p.wall_time,
+            p.cpu_time);
+    total_wall += p.wall_time;
+    total_cpu += p.cpu_time;
+  }
+  fprintf(out, "  %-12s %10.3f %10.3f\n", "total", total_wall, total_cpu);
+
+  FileTotals t = getTotals(file_table);
+  fprintf(out, "  files %" PRId64 ", file/rank pairs %" PRId64
+          ", events ingested %" PRId64 "\n", t.files, t.ranks, t.events);
+  fprintf(out, "  event list entries %" PRId64 " before minimize, %" PRId64
+          " after\n", t.list_size_before_minimize,
+          t.list_size_after_minimize);
+  fprintf(out, "  subranges swept %" PRId64 ", conflicts %" PRId64 "\n",
+          t.subranges, t.conflicts);
+  fprintf(out, "  peak RSS %.1f MiB\n", getPeakRss() / (1024.0 * 1024.0));
+
+  vector<File*> files = file_table.byName();
+  size_t n = min(files.size(), LARGEST_FILES);
+  // ties in name order
+  partial_sort(files.begin(), files.begin() + n, files.end(),
+               [](const File *a, const File *b) {
+                 int64_t a_events = fileEvents(*a), b_events = fileEvents(*b);
+                 if (a_events != b_events) return a_events > b_events;
+                 return a->name != b->name ? a->name < b->name : a->id < b->id;
+               });
+  if (n == 0) return;
+
+  fprintf(out, "  largest files by events:\n");
+  fprintf(out, "  %12s %6s %12s %12s %12s %10s  %s\n", "events", "ranks",
+          "list before", "list after", "subranges", "conflicts", "name");
+  for (size_t i = 0; i < n; i++) {
+    const File::Stats &s = files[i]->stats;
+    fprintf(out, "  %12" PRId64 " %6zu %12" PRId64 " %12" PRId64
+            " %12" PRId64 " %10" PRId64 "  %.*s\n",
+            fileEvents(*files[i]), s.rank_events.size(),
+            s.list_size_before_minimize, s.list_size_after_minimize,
+            s.subranges, s.conflicts, (int) files[i]->name.length(),
+            files[i]->name.data());
+  }
+}
+
+
+static string jsonString(string_view s) {
+  string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if ((unsigned char) c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof buf, "\\u%04x", (unsigned char) c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+  return out;
+}
+
+
+bool RunStats::writeJson(const string &filename,
+                         const FileTableType &file_table) const {
+  FILE *out = (filename == "-") ? stdout : fopen(filename.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "Failed to create %s: %s\n", filename.c_str(),
+            strerror(errno));
+    return false;
+  }
+
+  fprintf(out, "{\"phases\": [");
+  for (size_t i = 0; i < phases.size(); i++) {
+    fprintf(out, "%s\n  {\"name\": %s, \"wall_seconds\": %.6f, "
+            "\"cpu_seconds\": %.6f}", i ? "," : "",
+            jsonString(phases[i].name).c_str(), phases[i].wall_time,
+            phases[i].cpu_time);
+  }
+  fprintf(out, "],\n");
+
+  FileTotals t = getTotals(file_table);
+  fprintf(out, "\"peak_rss_bytes\": %" PRId64 ",\n", getPeakRss());
+  fprintf(out, "\"totals\": {\"files\": %" PRId64 ", \"file_ranks\": %" PRId64
+          ", \"events\": %" PRId64 ", \"list_size_before_minimize\": %" PRId64
+          ", \"list_size_after_minimize\": %" PRId64
+          ", \"subranges\": %" PRId64 ", \"conflicts\": %" PRId64 "},\n",
+          t.files, t.ranks, t.events, t.list_size_before_minimize,
+          t.list_size_after_minimize, t.subranges, t.conflicts);
+
+  fprintf(out, "\"files\": [");
+  bool first = true;
+  for (const File *file : file_table.byName()) {
+    const File &f = *file;
+    const File::Stats &s = f.stats;
+    fprintf(out, "%s\n  {\"id\": %s, \"name\": %s, \"events\": %" PRId64
+            ", \"list_size_before_minimize\": %" PRId64
+            ", \"list_size_after_minimize\": %" PRId64
+            ", \"subranges\": %" PRId64 ", \"conflicts\": %" PRId64
+            ", \"rank_events\": {",
+            first ? "" : ",", jsonString(to_string(f.id)).c_str(),
+            jsonString(f.name).c_str(), fileEvents(f),
+            s.list_size_before_minimize, s.list_size_after_minimize,
+            s.subranges, s.conflicts);
+    first = false;
+    for (size_t i = 0; i < s.rank_events.size(); i++) {
+      fprintf(out, "%s\"%d\": %" PRId64, i ? ", " : "",
+              s.rank_events[i].first, s.rank_events[i].second);
+    }
+    fprintf(out, "}}");
+  }
+  fprintf(out, "]}\n");
+
+  bool ok = !ferror(out);
+  if (out != stdout) {
+    if (fclose(out) != 0) ok = false;
+  } else {
+    fflush(out);
+  }
+  if (!ok) {
+    fprintf(stderr, "Failed to write %s\n", filename.c_str());
+  }
+  return ok;
+}
@@ -0,0 +1,49 @@
+#ifndef RUN_STATS_HH
+#define RUN_STATS_HH
+
+/*
+  Timing and resource statistics for a run (the -stats and -stats-json
+  options): wall and CPU time for each phase of the run, peak RSS, and
+  the per-file counts kept in File::Stats.
+*/
+
+#include "darshan_dxt_conflicts.hh"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+class RunStats {
+public:
+  RunStats() : in_phase(false) {}
+
+  // End the current phase, if any, and start timing a new one.
+  void startPhase(const std::string &name);
+  void endPhase();
+
+  // Print a summary, with the largest files by number of events.
+  void printText(FILE *out, const FileTableType &file_table) const;
+
+  // Write everything, including the counts for every file and rank,
+  // as one JSON object. filename may be "-" for stdout.
+  bool writeJson(const std::string &filename,
+                 const FileTableType &file_table) const;
+
+private:
+  struct Phase {
+    std::string name;
+    double wall_time, cpu_time;
+  };
+  std::vector<Phase> phases;
+
+  bool in_phase;
+  double phase_wall_start, phase_cpu_start;
+
+  // process user + system time, over all threads
+  static double getCpuTime();
+
+  // peak resident set size, in bytes
+  static int64_t getPeakRss();
+};
+
+#endif // RUN_STATS_HH
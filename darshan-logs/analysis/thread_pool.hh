@@ -0,0 +1,135 @@
+#ifndef THREAD_POOL_HH
+#define THREAD_POOL_HH
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/* Runs task(i) for each i in [0, count) on a fixed set of worker threads.
+
+   The indices are split into contiguous blocks, one per worker, so each
+   worker starts out on its own run of tasks in ascending order. A worker
+   takes tasks from the front of its own deque, and when that runs dry it
+   steals from the back of another worker's deque. Tasks never create new
+   tasks, so a worker exits once every deque is empty.
+
+   The constructor starts the workers; join() waits for all the tasks
+   to finish.
+*/
+class WorkStealingPool {
+public:
+  using Task = std::function<void(size_t)>;
+
+  WorkStealingPool(int n_threads, size_t count, Task task_)
+    : task(task_) {
+    if (n_threads < 1) n_threads = 1;
+    for (int w = 0; w < n_threads; w++) {
+      queues.emplace_back(new Queue());
+      size_t begin = count * w / n_threads;
+      size_t end = count * (w+1) / n_threads;
+      for (size_t i = begin; i < end; i++)
+        queues[w]->tasks.push_back(i);
+    }
+
+    for (int w = 0; w < n_threads; w++)
+      threads.emplace_back(&WorkStealingPool::work, this, w);
+  }
+
+  ~WorkStealingPool() {join();}
+
+  void join() {
+    for (std::thread &t : threads)
+      if (t.joinable()) t.join();
+  }
+
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+
+  Task task;
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> threads;
+
+  bool popOwn(int w, size_t &i) {
+    Queue &q = *queues[w];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty()) return false;
+    i = q.tasks.front();
+    q.tasks.pop_front();
+    return true;
+  }
+
+  // try every other worker's queue, starting with the next one over
+  bool steal(int w, size_t &i) {
+    int n = (int) queues.size();
+    for (int k = 1; k < n; k++) {
+      Queue &q = *queues[(w + k) % n];
+      std::lock_guard<std::mutex> guard(q.lock);
+      if (!q.tasks.empty()) {
+        i = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void work(int w) {
+    size_t i;
+    while (popOwn(w, i) || steal(w, i)) {
+      task(i);
+    }
+  }
+};
+
+
+
+/* Runs task(i) for each i in [0, count) on a fixed set of worker threads,
+   handing out the indices in ascending order from a shared counter. Use
+   this rather than WorkStealingPool when the results are used in order,
+   so the next one needed is always among the first to finish.
+
+   The constructor starts the workers; join() waits for all the tasks
+   to finish.
+*/
+class OrderedPool {
+public:
+  using Task = std::function<void(size_t)>;
+
+  OrderedPool(int n_threads, size_t count_, Task task_)
+    : count(count_), task(task_), next(0) {
+    if (n_threads < 1) n_threads = 1;
+    for (int w = 0; w < n_threads; w++)
+      threads.emplace_back(&OrderedPool::work, this);
+  }
+
+  ~OrderedPool() {join();}
+
+  void join() {
+    for (std::thread &t : threads)
+      if (t.joinable()) t.join();
+  }
+
+private:
+  const size_t count;
+  Task task;
+  std::atomic<size_t> next;
+  std::vector<std::thread> threads;
+
+  void work() {
+    size_t i;
+    while ((i = next++) < count) {
+      task(i);
+    }
+  }
+};
+
+
+#endif // THREAD_POOL_HH
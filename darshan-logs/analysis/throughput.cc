@@ -0,0 +1,120 @@
+#include "throughput.hh"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+
+// about a microsecond, finer than any timestamp in DXT or strace logs
+static const int MIN_WIDTH_EXP = -20;
+
+
+ThroughputHistogram::ThroughputHistogram(int capacity_)
+  : capacity(max(capacity_, 2)), width_exp(MIN_WIDTH_EXP), first_index(0),
+    min_time(0), max_time(0) {}
+
+
+int64_t ThroughputHistogram::binIndex(double time) const {
+  return (int64_t) floor(ldexp(time, -width_exp));
+}
+
+
+void ThroughputHistogram::add(double time, int64_t bytes, bool is_write) {
+  if (bins.empty()) {
+    min_time = max_time = time;
+  } else {
+    min_time = min(min_time, time);
+    max_time = max(max_time, time);
+  }
+
+  int64_t index = binIndex(time);
+  if (bins.empty() || index < first_index || index > lastIndex())
+    cover(index);
+
+  Bin &bin = bins[index - first_index];
+  if (is_write) {
+    bin.write_bytes += bytes;
+    bin.write_count++;
+  } else {
+    bin.read_bytes += bytes;
+    bin.read_count++;
+  }
+}
+
+
+void ThroughputHistogram::merge(const ThroughputHistogram &other) {
+  if (other.bins.empty()) return;
+  if (bins.empty()) {
+    *this = other;
+    return;
+  }
+
+  ThroughputHistogram o(other);
+  int64_t lo, hi;
+  while (true) {
+    int exp = max(width_exp, o.width_exp);
+    coarsenTo(exp);
+    o.coarsenTo(exp);
+    lo = min(first_index, o.first_index);
+    hi = max(lastIndex(), o.lastIndex());
+    if (hi - lo < capacity) break;
+    coarsen();
+  }
+  cover(lo);
+  cover(hi);
+
+  for (size_t i = 0; i < o.bins.size(); i++) {
+    bins[o.first_index + i - first_index] += o.bins[i];
+  }
+  min_time = min(min_time, o.min_time);
+  max_time = max(max_time, o.max_time);
+}
+
+
+void ThroughputHistogram::coarsen() {
+  // >> rounds toward negative infinity, so this works for negative times
+  int64_t new_first = first_index >> 1;
+  vector<Bin> new_bins(((lastIndex() >> 1) - new_first) + 1);
+  for (size_t i = 0; i < bins.size(); i++) {
+    new_bins[((first_index + (int64_t)i) >> 1) - new_first] += bins[i];
+  }
+  bins.swap(new_bins);
+  first_index = new_first;
+  width_exp++;
+}
+
+
+void ThroughputHistogram::cover(int64_t &index) {
+  if (bins.empty()) {
+    first_index = index;
+    bins.resize(1);
+    return;
+  }
+
+  while (max(lastIndex(), index) - min(first_index, index) >= capacity) {
+    coarsen();
+    index >>= 1;
+  }
+
+  if (index < first_index) {
+    bins.insert(bins.begin(), first_index - index, Bin());
+    first_index = index;
+  } else if (index > lastIndex()) {
+    bins.resize(index - first_index + 1);
+  }
+}
+
+
+vector<ThroughputHistogram::Bin> ThroughputHistogram::getBins
+(int n_bins, double start_time, double end_time) const {
+  vector<Bin> out(n_bins);
+  double bin_size = (end_time - start_time) / n_bins;
+  for (size_t i = 0; i < bins.size(); i++) {
+    double mid = ldexp(first_index + (int64_t)i + 0.5, width_exp);
+    int64_t out_bin = bin_size > 0
+      ? (int64_t) floor((mid - start_time) / bin_size) : 0;
+    out_bin = max((int64_t)0, min((int64_t)n_bins - 1, out_bin));
+    out[out_bin] += bins[i];
+  }
+  return out;
+}
@@ -0,0 +1,83 @@
+#ifndef THROUGHPUT_HH
+#define THROUGHPUT_HH
+
+/*
+  A histogram of read and write bytes and operations over time, for the
+  -throughput option.
+
+  The time range isn't known until every event has been read, so events
+  are first counted in fine bins whose width is a power of two seconds.
+  When the events span more than `capacity` fine bins, the width is
+  doubled by adding together pairs of bins. The fine bins are then added
+  into the requested number of output bins, each fine bin going to the
+  output bin containing its midpoint, so with capacity at least
+  BINS_PER_OUTPUT_BIN times the number of output bins a time is off by
+  at most 1/BINS_PER_OUTPUT_BIN of an output bin.
+*/
+
+#include <cstdint>
+#include <vector>
+
+
+class ThroughputHistogram {
+public:
+  static const int BINS_PER_OUTPUT_BIN = 32;
+
+  struct Bin {
+    int64_t read_bytes = 0, read_count = 0;
+    int64_t write_bytes = 0, write_count = 0;
+
+    Bin& operator+=(const Bin &other) {
+      read_bytes += other.read_bytes;
+      read_count += other.read_count;
+      write_bytes += other.write_bytes;
+      write_count += other.write_count;
+      return *this;
+    }
+  };
+
+  // Keep at most capacity fine bins.
+  ThroughputHistogram(int capacity_);
+
+  // count an access of bytes starting at time
+  void add(double time, int64_t bytes, bool is_write);
+
+  // add all the counts in other to this
+  void merge(const ThroughputHistogram &other);
+
+  bool empty() const {return bins.empty();}
+
+  // the earliest and latest times added
+  double startTime() const {return min_time;}
+  double endTime() const {return max_time;}
+
+  // Sum the counts into n_bins bins of equal width from start_time to
+  // end_time. Counts outside that range go to the first or last bin.
+  std::vector<Bin> getBins(int n_bins, double start_time,
+                           double end_time) const;
+
+private:
+  int capacity;
+
+  // each fine bin is 2^width_exp seconds wide
+  int width_exp;
+
+  // bins[i] covers the times [(first_index+i), (first_index+i+1)) * width
+  int64_t first_index;
+  std::vector<Bin> bins;
+
+  double min_time, max_time;
+
+  int64_t binIndex(double time) const;
+  int64_t lastIndex() const {return first_index + bins.size() - 1;}
+
+  // double the width of the bins
+  void coarsen();
+  void coarsenTo(int exp) {while (width_exp < exp) coarsen();}
+
+  // Extend bins to include index, coarsening them if that would make
+  // more than capacity. Updates index if the bins are coarsened.
+  void cover(int64_t &index);
+};
+
+#endif // THROUGHPUT_HH